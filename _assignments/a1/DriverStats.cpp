@@ -0,0 +1,228 @@
+#include "DriverStats.h"
+#include <algorithm>         // For sort
+#include <cerrno>            // For errno
+#include <cstdio>            // For snprintf
+#include <cstring>           // For memset, strncpy and strnlen
+#include <dirent.h>          // For opendir and readdir
+#include <fcntl.h>           // For open
+#include <linux/ethtool.h>   // For ethtool_gstrings and ethtool_stats
+#include <linux/sockios.h>   // For SIOCETHTOOL
+#include <net/if.h>          // For ifreq
+#include <sys/ioctl.h>       // For ioctl
+#include <unistd.h>          // For pread and close
+
+using namespace std;
+
+// ========== CONSTANTS ==========
+
+// Per-queue files read under queues/tx-<n>, and the suffix each value is
+// named with. Receive queues have no generic counters in sysfs; drivers
+// report their per-queue traffic through ETHTOOL_GSTATS instead
+static const char *txQueueFiles[] = {"tx_timeout",
+                                     "byte_queue_limits/inflight"};
+static const char *txQueueSuffixes[] = {"timeout", "bql_inflight"};
+static const int txQueueFileCount = 2;
+
+// Size of the stack buffer each queue file is read into
+static const int readBufferSize = 64;
+
+// Maximum length of a queue file path
+static const int pathSize = 512;
+
+// ========== HELPER FUNCTIONS ==========
+
+// Issue one SIOCETHTOOL command for an interface
+static int ethtoolCommand(int ioctlFd, const string &name, void *data) {
+  struct ifreq interfaceRequest;
+  memset(&interfaceRequest, 0, sizeof(interfaceRequest));
+  strncpy(interfaceRequest.ifr_name, name.c_str(), IFNAMSIZ - 1);
+  interfaceRequest.ifr_data = (char *)data;
+  return ioctl(ioctlFd, SIOCETHTOOL, &interfaceRequest);
+}
+
+// Number of driver statistics, or 0 if the driver reports none
+static uint32_t ethtoolStatCount(int ioctlFd, const string &name) {
+  // ethtool_sset_info is followed by one count per set in sset_mask
+  uint64_t buffer[(sizeof(struct ethtool_sset_info) + sizeof(uint32_t) + 7) /
+                  8];
+  memset(buffer, 0, sizeof(buffer));
+  struct ethtool_sset_info *info = (struct ethtool_sset_info *)buffer;
+  info->cmd = ETHTOOL_GSSET_INFO;
+  info->sset_mask = 1ULL << ETH_SS_STATS;
+  if (ethtoolCommand(ioctlFd, name, info) < 0 ||
+      !(info->sset_mask & (1ULL << ETH_SS_STATS)))
+    return 0;
+  return info->data[0];
+}
+
+// Fetch the names of count driver statistics, count having just been read
+// with ethtoolStatCount. The kernel ignores len and writes as many names as
+// the driver has now, so no fixed slack in the buffer would be safe
+static int ethtoolStatNames(int ioctlFd, const string &name, uint32_t count,
+                            vector<string> &names) {
+  vector<uint64_t> buffer(
+      (sizeof(struct ethtool_gstrings) + count * ETH_GSTRING_LEN + 7) / 8);
+  struct ethtool_gstrings *strings = (struct ethtool_gstrings *)buffer.data();
+  strings->cmd = ETHTOOL_GSTRINGS;
+  strings->string_set = ETH_SS_STATS;
+  strings->len = count;
+  if (ethtoolCommand(ioctlFd, name, strings) < 0)
+    return -1;
+  if (strings->len != count) {
+    errno = EAGAIN;
+    return -1;
+  }
+
+  for (uint32_t i = 0; i < count; ++i) {
+    const char *text = (const char *)strings->data + i * ETH_GSTRING_LEN;
+    names.push_back(string(text, strnlen(text, ETH_GSTRING_LEN)));
+  }
+  return 0;
+}
+
+// Open the counter files of every transmit queue, naming each value after
+// its queue, e.g. queue_tx-0_bql_inflight
+static void openQueueFiles(DriverStats &driverStats) {
+  string queuesDirectory = driverStats.directory + "/queues";
+  DIR *directory = opendir(queuesDirectory.c_str());
+  if (directory == nullptr)
+    return;
+
+  vector<string> queues;
+  struct dirent *entry;
+  while ((entry = readdir(directory)) != nullptr) {
+    if (strncmp(entry->d_name, "tx-", 3) == 0)
+      queues.push_back(entry->d_name);
+  }
+  closedir(directory);
+
+  // Number order, so tx-10 follows tx-9
+  sort(queues.begin(), queues.end(), [](const string &a, const string &b) {
+    return a.size() != b.size() ? a.size() < b.size() : a < b;
+  });
+
+  for (const auto &queue : queues) {
+    for (int i = 0; i < txQueueFileCount; ++i) {
+      char path[pathSize];
+      snprintf(path, sizeof(path), "%s/%s/%s", queuesDirectory.c_str(),
+               queue.c_str(), txQueueFiles[i]);
+      int fd = open(path, O_RDONLY | O_CLOEXEC);
+      if (fd < 0)
+        continue;
+      driverStats.queueFds.push_back(fd);
+      driverStats.names.push_back("queue_" + queue + "_" + txQueueSuffixes[i]);
+    }
+  }
+}
+
+// Parse the leading decimal number of a sysfs file without using streams
+static uint64_t parseCounter(const char *text, ssize_t length) {
+  uint64_t value = 0;
+  for (ssize_t i = 0; i < length && text[i] >= '0' && text[i] <= '9'; ++i)
+    value = value * 10 + (text[i] - '0');
+  return value;
+}
+
+// ========== CORE FUNCTIONS ==========
+
+// Prepare the structure for an interface whose sysfs files live under root,
+// without querying anything yet
+void initDriverStats(DriverStats &driverStats, const string &name,
+                     const string &root) {
+  driverStats.name = name;
+  driverStats.directory = root + "/" + name;
+  driverStats.names.clear();
+  driverStats.values.clear();
+  driverStats.ethtoolCount = 0;
+  driverStats.request.clear();
+  driverStats.queueFds.clear();
+  driverStats.isOpen = false;
+  driverStats.namesChanged = false;
+}
+
+// Fetch the names of the driver statistics and open the queue files.
+// Returns -1 if the interface has neither
+int openDriverStats(DriverStats &driverStats, int ioctlFd) {
+  closeDriverStats(driverStats);
+
+  // Drivers without statistics, such as loopback, only have queue files
+  uint32_t count = ethtoolStatCount(ioctlFd, driverStats.name);
+  if (count > 0 &&
+      ethtoolStatNames(ioctlFd, driverStats.name, count, driverStats.names) <
+          0)
+    count = 0;
+  driverStats.ethtoolCount = count;
+  openQueueFiles(driverStats);
+
+  if (driverStats.names.empty()) {
+    errno = EOPNOTSUPP;
+    return -1;
+  }
+
+  // ethtool_stats is followed by the values
+  driverStats.request.assign((sizeof(struct ethtool_stats) + 7) / 8 + count,
+                             0);
+  driverStats.values.assign(driverStats.names.size(), 0);
+  driverStats.isOpen = true;
+  driverStats.namesChanged = true;
+  return 0;
+}
+
+// Close the queue files and forget the names
+void closeDriverStats(DriverStats &driverStats) {
+  for (int fd : driverStats.queueFds)
+    close(fd);
+  driverStats.queueFds.clear();
+  driverStats.names.clear();
+  driverStats.values.clear();
+  driverStats.ethtoolCount = 0;
+  driverStats.isOpen = false;
+}
+
+// Refetch every value. When the driver now reports a different number of
+// statistics, e.g. after its channels changed, the names are fetched again
+// and namesChanged is set. Returns -1 if nothing could be read
+int readDriverStats(DriverStats &driverStats, int ioctlFd) {
+  if (!driverStats.isOpen)
+    return -1;
+
+  // ETHTOOL_GSTATS ignores n_stats and writes as many values as the driver
+  // has now, so the count is checked first and the buffer resized with it
+  if (driverStats.ethtoolCount > 0 &&
+      ethtoolStatCount(ioctlFd, driverStats.name) !=
+          driverStats.ethtoolCount &&
+      openDriverStats(driverStats, ioctlFd) < 0)
+    return -1;
+
+  if (driverStats.ethtoolCount > 0) {
+    struct ethtool_stats *stats =
+        (struct ethtool_stats *)driverStats.request.data();
+    stats->cmd = ETHTOOL_GSTATS;
+    stats->n_stats = driverStats.ethtoolCount;
+    if (ethtoolCommand(ioctlFd, driverStats.name, stats) < 0)
+      return -1;
+    if (stats->n_stats != driverStats.ethtoolCount)
+      return openDriverStats(driverStats, ioctlFd) < 0
+                 ? -1
+                 : readDriverStats(driverStats, ioctlFd);
+    memcpy(driverStats.values.data(), stats->data,
+           driverStats.ethtoolCount * sizeof(uint64_t));
+  }
+
+  char buffer[readBufferSize];
+  for (size_t i = 0; i < driverStats.queueFds.size(); ++i) {
+    ssize_t bytesRead =
+        pread(driverStats.queueFds[i], buffer, sizeof(buffer), 0);
+    driverStats.values[driverStats.ethtoolCount + i] =
+        bytesRead > 0 ? parseCounter(buffer, bytesRead) : 0;
+  }
+  return 0;
+}
+
+// Append every name, each followed by a NUL, as a MSG_DRIVER_STAT_NAMES
+// payload
+void appendDriverStatNames(const DriverStats &driverStats,
+                           vector<char> &payload) {
+  for (const auto &name : driverStats.names)
+    payload.insert(payload.end(), name.c_str(), name.c_str() + name.size() + 1);
+}
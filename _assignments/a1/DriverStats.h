@@ -0,0 +1,33 @@
+#ifndef DRIVER_STATS_H
+#define DRIVER_STATS_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Driver-specific statistics of one interface from SIOCETHTOOL, followed by
+// the per-queue counters under <root>/<name>/queues. The names are fetched
+// once with ETHTOOL_GSTRINGS; every tick only checks their count with
+// ETHTOOL_GSSET_INFO and refetches the values, with a single ETHTOOL_GSTATS
+// call and one pread() per queue file
+struct DriverStats {
+  std::string name;                // Interface name
+  std::string directory;           // Directory of its sysfs files
+  std::vector<std::string> names;  // Name of every value, driver ones first
+  std::vector<uint64_t> values;    // Latest values in the order of names
+  uint32_t ethtoolCount;           // Values that come from the driver
+  std::vector<uint64_t> request;   // ethtool_stats buffer reused every tick
+  std::vector<int> queueFds;       // Open per-queue counter files
+  bool isOpen;                     // Whether names and files are set up
+  bool namesChanged;               // Names must be announced again
+};
+
+void initDriverStats(DriverStats &driverStats, const std::string &name,
+                     const std::string &root);
+int openDriverStats(DriverStats &driverStats, int ioctlFd);
+void closeDriverStats(DriverStats &driverStats);
+int readDriverStats(DriverStats &driverStats, int ioctlFd);
+void appendDriverStatNames(const DriverStats &driverStats,
+                           std::vector<char> &payload);
+
+#endif // DRIVER_STATS_H
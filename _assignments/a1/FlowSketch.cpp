@@ -0,0 +1,153 @@
+#include "FlowSketch.h"
+#include <algorithm> // For max, min and sort
+#include <cstring>   // For memset, memcpy and memcmp
+
+using namespace std;
+
+// ========== CONSTANTS ==========
+
+// Sketch geometry, 64 KiB per interface. With w columns an estimate exceeds
+// the true count by at most e/w of the interval's traffic with probability
+// 1 - e^-d, about 0.3% of it with 99.98% confidence here
+static const size_t flowSketchDepth = 4;
+static const size_t flowSketchWidth = 1024; // Power of two
+
+// ========== HELPER FUNCTIONS ==========
+
+// 64-bit hash of a flow key, mixing it one word at a time
+static uint64_t hashFlowKey(const FlowKey &key) {
+  uint64_t words[sizeof(FlowKey) / sizeof(uint64_t)];
+  memcpy(words, &key, sizeof(words));
+
+  uint64_t hash = 0x9E3779B97F4A7C15ULL;
+  for (uint64_t word : words) {
+    hash = (hash ^ word) * 0xFF51AFD7ED558CCDULL;
+    hash ^= hash >> 32;
+  }
+  hash ^= hash >> 33;
+  hash *= 0xC4CEB9FE1A85EC53ULL;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+// Restore the heap order below an entry whose estimate grew
+static void siftDown(FlowSketch &sketch, size_t index) {
+  while (true) {
+    size_t smallest = index;
+    size_t left = 2 * index + 1;
+    size_t right = left + 1;
+    if (left < sketch.topCount &&
+        sketch.top[left].bytes < sketch.top[smallest].bytes)
+      smallest = left;
+    if (right < sketch.topCount &&
+        sketch.top[right].bytes < sketch.top[smallest].bytes)
+      smallest = right;
+    if (smallest == index)
+      return;
+    swap(sketch.top[index], sketch.top[smallest]);
+    swap(sketch.topHashes[index], sketch.topHashes[smallest]);
+    index = smallest;
+  }
+}
+
+// Restore the heap order above a newly added entry
+static void siftUp(FlowSketch &sketch, size_t index) {
+  while (index > 0) {
+    size_t parent = (index - 1) / 2;
+    if (sketch.top[parent].bytes <= sketch.top[index].bytes)
+      return;
+    swap(sketch.top[index], sketch.top[parent]);
+    swap(sketch.topHashes[index], sketch.topHashes[parent]);
+    index = parent;
+  }
+}
+
+// ========== CORE FUNCTIONS ==========
+
+// Allocate the sketch once, at its fixed size, and clear it
+void initFlowSketch(FlowSketch &sketch) {
+  sketch.cells.assign(flowSketchDepth * flowSketchWidth, FlowCell{0, 0});
+  sketch.topCount = 0;
+}
+
+// Forget every flow, starting a new interval
+void resetFlowSketch(FlowSketch &sketch) {
+  memset(sketch.cells.data(), 0, sketch.cells.size() * sizeof(FlowCell));
+  sketch.topCount = 0;
+}
+
+// Count one IP packet against its flow and update the heaviest flows.
+// Conservative update only raises the cells that hold the minimum, which
+// keeps estimates of light flows sharing cells with heavy ones closer
+void addFlowPacket(FlowSketch &sketch, const PacketInfo &packet) {
+  if (!packet.isIp)
+    return;
+
+  FlowKey key;
+  memset(&key, 0, sizeof(key));
+  memcpy(key.source, packet.source, packet.addressLength);
+  memcpy(key.destination, packet.destination, packet.addressLength);
+  key.sourcePort = packet.sourcePort;
+  key.destinationPort = packet.destinationPort;
+  key.protocol = packet.ipProtocol;
+  key.addressLength = packet.addressLength;
+
+  // Rows index with h1 + i * h2, two halves of a single hash
+  uint64_t hash = hashFlowKey(key);
+  uint32_t first = hash;
+  uint32_t step = (hash >> 32) | 1;
+  FlowCell *cells[flowSketchDepth];
+  uint64_t bytes = UINT64_MAX;
+  uint64_t packets = UINT64_MAX;
+  for (size_t row = 0; row < flowSketchDepth; ++row) {
+    size_t column = (first + row * step) & (flowSketchWidth - 1);
+    cells[row] = &sketch.cells[row * flowSketchWidth + column];
+    bytes = min(bytes, cells[row]->bytes);
+    packets = min(packets, cells[row]->packets);
+  }
+  bytes += packet.length;
+  packets += 1;
+  for (size_t row = 0; row < flowSketchDepth; ++row) {
+    cells[row]->bytes = max(cells[row]->bytes, bytes);
+    cells[row]->packets = max(cells[row]->packets, packets);
+  }
+
+  // A flow already in the heap only has its estimate raised
+  for (size_t i = 0; i < sketch.topCount; ++i) {
+    if (sketch.topHashes[i] != hash ||
+        memcmp(&sketch.top[i].key, &key, sizeof(key)) != 0)
+      continue;
+    sketch.top[i].bytes = bytes;
+    sketch.top[i].packets = packets;
+    siftDown(sketch, i);
+    return;
+  }
+
+  // Otherwise it joins while there is room, or replaces the lightest entry
+  // once its estimate is larger
+  size_t index;
+  if (sketch.topCount < maxTopFlows) {
+    index = sketch.topCount++;
+  } else if (bytes > sketch.top[0].bytes) {
+    index = 0;
+  } else {
+    return;
+  }
+  sketch.top[index].key = key;
+  sketch.top[index].bytes = bytes;
+  sketch.top[index].packets = packets;
+  sketch.topHashes[index] = hash;
+  if (index == 0)
+    siftDown(sketch, 0);
+  else
+    siftUp(sketch, index);
+}
+
+// Copy the heaviest flows, heaviest first
+void copyTopFlows(const FlowSketch &sketch, vector<FlowRecord> &flows) {
+  flows.assign(sketch.top, sketch.top + sketch.topCount);
+  sort(flows.begin(), flows.end(),
+       [](const FlowRecord &a, const FlowRecord &b) {
+         return a.bytes > b.bytes;
+       });
+}
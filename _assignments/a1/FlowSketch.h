@@ -0,0 +1,34 @@
+#ifndef FLOW_SKETCH_H
+#define FLOW_SKETCH_H
+
+#include "MonitorProtocol.h"
+#include "PacketCapture.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Heaviest flows of one interface over an interval, in memory that does not
+// grow with the number of flows. A count-min sketch estimates the bytes and
+// packets of every flow, and a min-heap of maxTopFlows entries keeps the
+// flows with the largest byte estimates. Each packet costs one hash, one
+// counter update per sketch row and a scan of the heap
+
+// Counters of one sketch cell
+struct FlowCell {
+  uint64_t bytes;   // Bytes of every flow hashed to the cell
+  uint64_t packets; // Packets of every flow hashed to the cell
+};
+
+struct FlowSketch {
+  std::vector<FlowCell> cells;    // flowSketchDepth rows of flowSketchWidth
+  FlowRecord top[maxTopFlows];    // Min-heap on the byte estimate
+  uint64_t topHashes[maxTopFlows]; // Hash of each heap entry's key
+  size_t topCount;                // Entries in the heap
+};
+
+void initFlowSketch(FlowSketch &sketch);
+void resetFlowSketch(FlowSketch &sketch);
+void addFlowPacket(FlowSketch &sketch, const PacketInfo &packet);
+void copyTopFlows(const FlowSketch &sketch, std::vector<FlowRecord> &flows);
+
+#endif // FLOW_SKETCH_H
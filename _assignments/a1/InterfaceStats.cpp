@@ -0,0 +1,87 @@
+#include "InterfaceStats.h"
+#include <ctime> // For clock_gettime
+
+using namespace std;
+
+// ========== CONSTANTS ==========
+
+// Name of each IF_OPER_* value, matching /sys/class/net/<if>/operstate
+static const char *operstateNames[] = {"unknown", "notpresent", "down",
+                                       "lowerlayerdown", "testing", "dormant",
+                                       "up"};
+
+// Number of known operational states
+static const int operstateCount =
+    sizeof(operstateNames) / sizeof(operstateNames[0]);
+
+// Name of each counter indexed by STAT, as sysfs names its file
+static const char *statNames[STAT_COUNT] = {
+    "carrier_up_count", "carrier_down_count", "tx_bytes",   "rx_bytes",
+    "rx_dropped",       "rx_errors",          "tx_packets", "tx_dropped",
+    "tx_errors",        "rx_packets"};
+
+// ========== CORE FUNCTIONS ==========
+
+// Current CLOCK_MONOTONIC time in nanoseconds
+uint64_t monotonicTimeNs() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+// IF_OPER_* code of an operational state name, IF_OPER_UNKNOWN if unknown
+uint8_t operstateCode(const string &operstate) {
+  for (int i = 0; i < operstateCount; ++i) {
+    if (operstate == operstateNames[i])
+      return i;
+  }
+  return 0;
+}
+
+// Operational state name of an IF_OPER_* code
+const char *operstateName(uint8_t code) {
+  return code < operstateCount ? operstateNames[code] : operstateNames[0];
+}
+
+// Name of a counter, e.g. "rx_bytes"
+const char *statName(STAT stat) { return statNames[stat]; }
+
+// Reset a sample to "interface missing" with every counter at zero
+void clearInterfaceCounters(InterfaceCounters &counters) {
+  counters.operstate.clear();
+  for (int i = 0; i < STAT_COUNT; ++i)
+    counters.values[i] = 0;
+  counters.timestampNs = 0;
+  counters.isPresent = false;
+}
+
+// Compute the per-second rate of every traffic counter between two samples.
+// A counter lower than in the previous sample means the interface was
+// recreated or its driver reset the statistics; the counter then restarted
+// from zero during the interval, so its current value is the increase
+void computeInterfaceRates(const InterfaceCounters &previous,
+                           const InterfaceCounters &current,
+                           InterfaceRates &rates) {
+  for (int i = 0; i < STAT_COUNT; ++i)
+    rates.values[i] = 0;
+  rates.counterReset = false;
+
+  // Rates need two samples of a present interface, taken in order
+  rates.isValid = previous.isPresent && current.isPresent &&
+                  current.timestampNs > previous.timestampNs;
+  if (!rates.isValid)
+    return;
+
+  double elapsedSeconds = (current.timestampNs - previous.timestampNs) / 1e9;
+
+  for (int i = firstTrafficStat; i < STAT_COUNT; ++i) {
+    uint64_t increase;
+    if (current.values[i] >= previous.values[i]) {
+      increase = current.values[i] - previous.values[i];
+    } else {
+      increase = current.values[i];
+      rates.counterReset = true;
+    }
+    rates.values[i] = increase / elapsedSeconds;
+  }
+}
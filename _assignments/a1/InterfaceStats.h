@@ -0,0 +1,50 @@
+#ifndef INTERFACE_STATS_H
+#define INTERFACE_STATS_H
+
+#include <cstdint>
+#include <string>
+
+// Counters reported for every interface, whichever backend collected them
+typedef enum {
+  STAT_CARRIER_UP_COUNT,
+  STAT_CARRIER_DOWN_COUNT,
+  STAT_TX_BYTES,
+  STAT_RX_BYTES,
+  STAT_RX_DROPPED,
+  STAT_RX_ERRORS,
+  STAT_TX_PACKETS,
+  STAT_TX_DROPPED,
+  STAT_TX_ERRORS,
+  STAT_RX_PACKETS,
+  STAT_COUNT
+} STAT;
+
+// First counter that measures traffic; the carrier counts before it are
+// event counts and get no rate
+const int firstTrafficStat = STAT_TX_BYTES;
+
+// One sample of an interface's state and counters
+struct InterfaceCounters {
+  std::string operstate;     // Operational state, e.g. "up"
+  uint64_t values[STAT_COUNT]; // Counter values indexed by STAT
+  uint64_t timestampNs;      // CLOCK_MONOTONIC time the sample was taken
+  bool isPresent;            // False if the interface is missing
+};
+
+// Per-second rates derived from two consecutive samples
+struct InterfaceRates {
+  double values[STAT_COUNT]; // Rate of each traffic counter, per second
+  bool isValid;              // False until two samples of the interface exist
+  bool counterReset;         // A counter went backwards during this interval
+};
+
+uint64_t monotonicTimeNs();
+uint8_t operstateCode(const std::string &operstate);
+const char *operstateName(uint8_t code);
+const char *statName(STAT stat);
+void clearInterfaceCounters(InterfaceCounters &counters);
+void computeInterfaceRates(const InterfaceCounters &previous,
+                           const InterfaceCounters &current,
+                           InterfaceRates &rates);
+
+#endif // INTERFACE_STATS_H
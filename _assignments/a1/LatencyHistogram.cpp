@@ -0,0 +1,76 @@
+#include "LatencyHistogram.h"
+#include <cstring> // For memset
+
+using namespace std;
+
+// ========== HELPER FUNCTIONS ==========
+
+// Bucket of a duration: values below histogramSubBuckets map to themselves,
+// larger ones to their power of two and the next histogramSubBits bits
+static int bucketIndex(uint64_t durationNs) {
+  if (durationNs < (uint64_t)histogramSubBuckets)
+    return durationNs;
+  int exponent = 63 - __builtin_clzll(durationNs);
+  int subBucket = (durationNs >> (exponent - histogramSubBits)) &
+                  (histogramSubBuckets - 1);
+  return (exponent - histogramSubBits + 1) * histogramSubBuckets + subBucket;
+}
+
+// Smallest duration that falls in a bucket
+static uint64_t bucketLowerBound(int index) {
+  if (index < histogramSubBuckets)
+    return index;
+  int exponent = index / histogramSubBuckets + histogramSubBits - 1;
+  uint64_t subBucket = index % histogramSubBuckets;
+  return (histogramSubBuckets + subBucket) << (exponent - histogramSubBits);
+}
+
+// ========== CORE FUNCTIONS ==========
+
+// Forget every recorded duration
+void clearLatencyHistogram(LatencyHistogram &histogram) {
+  memset(&histogram, 0, sizeof(histogram));
+}
+
+// Count one duration
+void recordLatency(LatencyHistogram &histogram, uint64_t durationNs) {
+  ++histogram.buckets[bucketIndex(durationNs)];
+  ++histogram.count;
+  histogram.sum += durationNs;
+  if (durationNs > histogram.maximum)
+    histogram.maximum = durationNs;
+}
+
+// Add count durations to one bucket, as when merging a histogram received
+// bucket by bucket. Sum and maximum are left to the caller
+void addLatencyBucket(LatencyHistogram &histogram, int bucket, uint64_t count) {
+  if (bucket < 0 || bucket >= histogramBuckets)
+    return;
+  histogram.buckets[bucket] += count;
+  histogram.count += count;
+}
+
+// Duration below which the given percentile (0-100) of the recorded ones
+// fall, reported as the upper end of its bucket. Returns 0 when empty
+uint64_t latencyPercentile(const LatencyHistogram &histogram,
+                           double percentile) {
+  if (histogram.count == 0)
+    return 0;
+
+  // Rank of the duration sought, counted from 1
+  uint64_t rank = percentile / 100.0 * histogram.count + 0.5;
+  if (rank < 1)
+    rank = 1;
+
+  uint64_t seen = 0;
+  for (int i = 0; i < histogramBuckets; ++i) {
+    seen += histogram.buckets[i];
+    if (seen < rank)
+      continue;
+    if (i + 1 == histogramBuckets)
+      return histogram.maximum;
+    uint64_t upperBound = bucketLowerBound(i + 1) - 1;
+    return upperBound < histogram.maximum ? upperBound : histogram.maximum;
+  }
+  return histogram.maximum;
+}
@@ -0,0 +1,26 @@
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <cstdint>
+
+// Durations in nanoseconds counted in log-spaced buckets: every power of two
+// is split into histogramSubBuckets linear buckets, so a percentile read back
+// is within about 6% of the recorded value whatever its magnitude
+const int histogramSubBits = 4;
+const int histogramSubBuckets = 1 << histogramSubBits;
+const int histogramBuckets = (64 - histogramSubBits + 1) * histogramSubBuckets;
+
+struct LatencyHistogram {
+  uint64_t buckets[histogramBuckets]; // Durations counted per bucket
+  uint64_t count;                     // Durations recorded
+  uint64_t sum;                       // Sum of the durations, for the mean
+  uint64_t maximum;                   // Longest duration recorded
+};
+
+void clearLatencyHistogram(LatencyHistogram &histogram);
+void recordLatency(LatencyHistogram &histogram, uint64_t durationNs);
+uint64_t latencyPercentile(const LatencyHistogram &histogram,
+                           double percentile);
+void addLatencyBucket(LatencyHistogram &histogram, int bucket, uint64_t count);
+
+#endif // LATENCY_HISTOGRAM_H
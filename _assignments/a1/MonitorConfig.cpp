@@ -0,0 +1,141 @@
+#include "MonitorConfig.h"
+#include <cerrno>   // For errno
+#include <climits>  // For INT_MAX
+#include <cstdlib>  // For strtol
+#include <cstring>  // For strerror
+#include <fstream>  // For ifstream
+#include <net/if.h> // For IFNAMSIZ
+#include <sstream>  // For istringstream
+
+using namespace std;
+
+// ========== HELPER FUNCTIONS ==========
+
+// Strip spaces and tabs from both ends of a string
+static string trim(const string &text) {
+  size_t first = text.find_first_not_of(" \t\r");
+  if (first == string::npos)
+    return "";
+  size_t last = text.find_last_not_of(" \t\r");
+  return text.substr(first, last - first + 1);
+}
+
+// Parse a positive decimal integer. Returns -1 if value is not one
+static int parsePositive(const string &value, int &result) {
+  char *end;
+  errno = 0;
+  long parsed = strtol(value.c_str(), &end, 10);
+  if (value.empty() || *end != '\0' || errno != 0 || parsed <= 0 ||
+      parsed > INT_MAX)
+    return -1;
+  result = parsed;
+  return 0;
+}
+
+// Apply one key and value to the configuration. Returns -1 with a reason in
+// error if the key is unknown or the value invalid
+static int applySetting(const string &key, const string &value,
+                        MonitorConfig &config, string &error) {
+  if (key == "socket_path" || key == "query_socket") {
+    if (value.empty()) {
+      error = key + " needs a path";
+      return -1;
+    }
+    (key == "socket_path" ? config.socketPath : config.querySocketPath) =
+        value;
+    return 0;
+  }
+
+  if (key == "max_connections" || key == "receive_buffer" ||
+      key == "interval") {
+    int number;
+    if (parsePositive(value, number) < 0) {
+      error = key + " needs a positive number";
+      return -1;
+    }
+    if (key == "max_connections")
+      config.maxConnections = number;
+    else if (key == "receive_buffer")
+      config.receiveBufferSize = number;
+    else
+      config.intervalMs = number;
+    return 0;
+  }
+
+  if (key == "interfaces") {
+    // Names are separated by whitespace, duplicates are monitored once
+    vector<string> interfaces;
+    istringstream names(value);
+    string name;
+    while (names >> name) {
+      if (name.size() >= IFNAMSIZ) {
+        error = "interface name too long: " + name;
+        return -1;
+      }
+      bool isListed = false;
+      for (const auto &listed : interfaces)
+        isListed = isListed || listed == name;
+      if (!isListed)
+        interfaces.push_back(name);
+    }
+    config.interfaces = interfaces;
+    return 0;
+  }
+
+  error = "unknown setting " + key;
+  return -1;
+}
+
+// ========== CORE FUNCTIONS ==========
+
+// Read a configuration file over config. Nothing is changed unless the whole
+// file is valid. Returns -1 with errno set if it cannot be read, or EINVAL
+// and the line at fault in error if it is malformed
+int loadMonitorConfig(const char *path, MonitorConfig &config,
+                      string &error) {
+  ifstream file(path);
+  if (!file) {
+    error = strerror(errno);
+    return -1;
+  }
+
+  MonitorConfig loaded = config;
+  string line;
+  int lineNumber = 0;
+  while (getline(file, line)) {
+    ++lineNumber;
+    line = trim(line);
+    if (line.empty() || line[0] == '#')
+      continue;
+
+    size_t separator = line.find('=');
+    if (separator == string::npos) {
+      error = "line " + to_string(lineNumber) + ": expected key = value";
+      errno = EINVAL;
+      return -1;
+    }
+    string reason;
+    if (applySetting(trim(line.substr(0, separator)),
+                     trim(line.substr(separator + 1)), loaded, reason) < 0) {
+      error = "line " + to_string(lineNumber) + ": " + reason;
+      errno = EINVAL;
+      return -1;
+    }
+  }
+  if (file.bad()) {
+    error = strerror(errno);
+    return -1;
+  }
+
+  config = loaded;
+  return 0;
+}
+
+// Whether two configurations agree on every setting only read at startup
+bool hasSameStartupSettings(const MonitorConfig &first,
+                            const MonitorConfig &second) {
+  return first.socketPath == second.socketPath &&
+         first.querySocketPath == second.querySocketPath &&
+         first.maxConnections == second.maxConnections &&
+         first.receiveBufferSize == second.receiveBufferSize;
+}
@@ -0,0 +1,35 @@
+#ifndef MONITOR_CONFIG_H
+#define MONITOR_CONFIG_H
+
+#include <string>
+#include <vector>
+
+// Settings of networkMonitor read from a configuration file, one
+// "key = value" per line. Blank lines and lines starting with '#' are
+// skipped. Keys absent from the file keep the value they had before loading:
+//
+//   socket_path = /tmp/networkMonitor   socket the monitors connect to
+//   query_socket = /tmp/networkMonitor.query
+//   max_connections = 128              backlog of the monitor socket
+//   receive_buffer = 4096              bytes read from a monitor per read()
+//   interval = 1000                    sampling interval in milliseconds
+//   interfaces = lo eth0               interfaces to monitor
+//
+// socket_path, query_socket, max_connections and receive_buffer only take
+// effect at startup, interval and interfaces are also applied on a reload
+
+struct MonitorConfig {
+  std::string socketPath;              // UNIX socket of the monitors
+  std::string querySocketPath;         // UNIX socket of the query server
+  int maxConnections;                  // listen() backlog of socketPath
+  int receiveBufferSize;               // Bytes per read() from a monitor
+  int intervalMs;                      // Sampling interval of every monitor
+  std::vector<std::string> interfaces; // Interfaces to monitor
+};
+
+int loadMonitorConfig(const char *path, MonitorConfig &config,
+                      std::string &error);
+bool hasSameStartupSettings(const MonitorConfig &first,
+                            const MonitorConfig &second);
+
+#endif // MONITOR_CONFIG_H
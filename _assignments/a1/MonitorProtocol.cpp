@@ -0,0 +1,89 @@
+#include "MonitorProtocol.h"
+#include <cstring> // For memcpy and memset
+
+using namespace std;
+
+// ========== CONSTANTS ==========
+
+// Name of each TRAFFIC_CLASS, as printed and exported
+static const char *trafficClassNames[TRAFFIC_CLASS_COUNT] = {
+    "ipv4",
+    "ipv6",
+    "arp",
+    "other_ethertype",
+    "tcp",
+    "udp",
+    "icmp",
+    "other_protocol",
+    "ports_0_1023",
+    "ports_1024_49151",
+    "ports_49152_65535"};
+
+// ========== CORE FUNCTIONS ==========
+
+// Fill the header of a frame whose payload is sent separately
+void fillFrameHeader(FrameHeader &header, MESSAGE_TYPE type,
+                     uint32_t interfaceId, uint64_t timestampNs,
+                     uint32_t length) {
+  memset(&header, 0, sizeof(header));
+  header.length = length;
+  header.version = protocolVersion;
+  header.type = type;
+  header.interfaceId = interfaceId;
+  header.timestampNs = timestampNs;
+}
+
+// Append a header and its payload to an outgoing buffer
+void appendFrame(vector<char> &buffer, MESSAGE_TYPE type, uint32_t interfaceId,
+                 uint64_t timestampNs, const void *payload, uint32_t length) {
+  FrameHeader header;
+  fillFrameHeader(header, type, interfaceId, timestampNs, length);
+
+  const char *headerBytes = (const char *)&header;
+  buffer.insert(buffer.end(), headerBytes, headerBytes + sizeof(header));
+  buffer.insert(buffer.end(), (const char *)payload,
+                (const char *)payload + length);
+}
+
+// Copy one sample and its rates into the wire record
+void fillStatsRecord(const InterfaceCounters &counters,
+                     const InterfaceRates &rates, StatsRecord &record) {
+  memset(&record, 0, sizeof(record));
+  for (int i = 0; i < STAT_COUNT; ++i) {
+    record.counters[i] = counters.values[i];
+    record.rates[i] = rates.values[i];
+  }
+  record.operstate = operstateCode(counters.operstate);
+  if (counters.isPresent)
+    record.flags |= STATS_PRESENT;
+  if (rates.isValid)
+    record.flags |= STATS_RATES_VALID;
+  if (rates.counterReset)
+    record.flags |= STATS_COUNTER_RESET;
+}
+
+// Extract the next complete frame starting at offset in a reassembly buffer.
+// Returns 1 and advances offset when a frame was extracted, 0 when more bytes
+// are needed and -1 when the stream is corrupt
+int extractFrame(const vector<char> &buffer, size_t &offset,
+                 FrameHeader &header, const char *&payload) {
+  if (buffer.size() - offset < sizeof(FrameHeader))
+    return 0;
+
+  memcpy(&header, buffer.data() + offset, sizeof(header));
+  if (header.version != protocolVersion || header.length > maxFramePayload)
+    return -1;
+
+  if (buffer.size() - offset - sizeof(FrameHeader) < header.length)
+    return 0;
+
+  payload = buffer.data() + offset + sizeof(FrameHeader);
+  offset += sizeof(FrameHeader) + header.length;
+  return 1;
+}
+
+// Name of a traffic class
+const char *trafficClassName(TRAFFIC_CLASS trafficClass) {
+  return trafficClass < TRAFFIC_CLASS_COUNT ? trafficClassNames[trafficClass]
+                                            : "unknown";
+}
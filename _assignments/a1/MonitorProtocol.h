@@ -0,0 +1,210 @@
+#ifndef MONITOR_PROTOCOL_H
+#define MONITOR_PROTOCOL_H
+
+#include "InterfaceStats.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Binary frames sent from intfMonitor to networkMonitor once the
+// ready_to_monitor / start_monitoring handshake is done, and control frames
+// sent back once the monitor's first frame has arrived. Both ends run on the
+// same host, so every field is in host byte order
+
+// Version of the frame layout, bumped whenever a structure changes:
+//   2  CollectorStatus carries droppedSamples
+//   3  Samples are sent as MSG_DELTA_SAMPLES by default
+const uint16_t protocolVersion = 3;
+
+// Largest payload a receiver accepts before dropping the connection
+const uint32_t maxFramePayload = 1 << 20;
+
+// Geometry of the shared-memory ring used by the shm transport. A slot holds
+// one whole frame, header included
+const uint32_t ringSlotCount = 4096;
+const uint32_t ringSlotSize = 256;
+
+// Kind of payload carried by a frame
+typedef enum : uint16_t {
+  MSG_INTERFACE_NAME = 1,   // Payload is the name of interfaceId
+  MSG_INTERFACE_STATS = 2,  // Payload is a StatsRecord for interfaceId
+  MSG_COLLECTOR_STATUS = 3, // Payload is a CollectorStatus
+  MSG_LINK_EVENT = 4,       // Payload is a LinkEventRecord for interfaceId
+  MSG_SHM_RING = 5,         // No payload, carries the ring's memfd and
+                            // eventfd as SCM_RIGHTS ancillary data
+  MSG_SAMPLE_BATCH = 6,     // Payload is a BatchHeader and BatchedSamples
+  MSG_DRIVER_STAT_NAMES = 7, // Payload is the NUL-terminated names of the
+                             // driver statistics of interfaceId
+  MSG_DRIVER_STATS = 8,     // Payload is one uint64_t per name announced
+  MSG_TRAFFIC_CLASSES = 9,  // Payload is a TrafficRecord for interfaceId
+  MSG_TOP_FLOWS = 10,       // Payload is up to maxTopFlows FlowRecords
+  MSG_COLLECTOR_METRICS = 11, // Payload is a CollectorMetrics and the
+                              // HistogramEntries it announces
+  MSG_SET_INTERVAL = 12,    // Control, payload is an IntervalRecord
+  MSG_DELTA_SAMPLES = 13    // Payload is delta-encoded samples, see
+                            // SampleCodec.h
+} MESSAGE_TYPE;
+
+// Interface id of frames describing the monitor itself
+const uint32_t collectorInterfaceId = 0xFFFFFFFF;
+
+// Header in front of every frame
+struct FrameHeader {
+  uint32_t length;      // Payload bytes following the header
+  uint16_t version;     // protocolVersion of the sender
+  uint16_t type;        // MESSAGE_TYPE of the payload
+  uint32_t interfaceId; // Sender-local id of the interface
+  uint32_t reserved;    // Zero, keeps the timestamp 8-byte aligned
+  uint64_t timestampNs; // CLOCK_MONOTONIC time of the sample
+};
+
+// Flags of a StatsRecord
+const uint8_t STATS_PRESENT = 0x01;       // Interface existed when sampled
+const uint8_t STATS_RATES_VALID = 0x02;   // rates[] hold meaningful values
+const uint8_t STATS_COUNTER_RESET = 0x04; // A counter went backwards
+
+// Fixed-layout statistics of one interface
+struct StatsRecord {
+  uint64_t counters[STAT_COUNT]; // Counter values indexed by STAT
+  double rates[STAT_COUNT];      // Per-second rates indexed by STAT
+  uint8_t operstate;             // IF_OPER_* code of the operational state
+  uint8_t flags;                 // STATS_* flags
+  uint8_t reserved[6];           // Zero, pads the record to 8 bytes
+};
+
+// Health of the sampling loop, sent once per tick
+struct CollectorStatus {
+  uint64_t ticks;          // Samples taken since the monitor started
+  uint64_t missedTicks;    // Timer expirations that passed without a sample
+  uint64_t droppedSamples; // Samples discarded while the socket was full
+  uint32_t intervalMs;     // Sampling interval in milliseconds
+  uint32_t reserved;       // Zero, pads the record to 8 bytes
+};
+
+// New sampling interval for a running monitor, applied from its next tick
+struct IntervalRecord {
+  uint32_t intervalMs; // Sampling interval in milliseconds
+  uint32_t reserved;   // Zero, pads the record to 8 bytes
+};
+
+// Cost of the monitor's own sampling over one reporting period. Two sparse
+// LatencyHistograms follow: the time each tick took to sample and send, and
+// how late each tick started after its timer expired
+struct CollectorMetrics {
+  uint64_t periodNs;        // Time the report covers
+  uint64_t bytesSent;       // Frame bytes handed to the socket or ring
+  uint64_t cpuUserNs;       // User CPU time of the monitor
+  uint64_t cpuSystemNs;     // System CPU time, mostly spent in syscalls
+  uint64_t durationSumNs;   // Sum of the sampling durations
+  uint64_t durationMaxNs;   // Longest sampling duration
+  uint64_t lagSumNs;        // Sum of the timer lags
+  uint64_t lagMaxNs;        // Longest timer lag
+  uint32_t durationBuckets; // HistogramEntries of the sampling durations
+  uint32_t lagBuckets;      // HistogramEntries of the timer lags, after them
+};
+
+// One non-empty bucket of a LatencyHistogram
+struct HistogramEntry {
+  uint32_t bucket; // Index into LatencyHistogram::buckets
+  uint32_t count;  // Durations counted in the bucket
+};
+
+// Link state change, sent as soon as the kernel announces it
+struct LinkEventRecord {
+  uint8_t operstate;   // IF_OPER_* code of the new operational state
+  uint8_t hasCarrier;  // 1 if the link has carrier
+  uint8_t isRemoved;   // 1 if the interface no longer exists
+  uint8_t reserved[5]; // Zero, pads the record to 8 bytes
+};
+
+// Classes of captured traffic. A packet counts once per group it belongs
+// to: its ethertype, its IP protocol and, for TCP and UDP, the range of the
+// lower of its two ports, which is usually the service's
+typedef enum {
+  TRAFFIC_IPV4,
+  TRAFFIC_IPV6,
+  TRAFFIC_ARP,
+  TRAFFIC_OTHER_ETHERTYPE,
+  TRAFFIC_TCP,
+  TRAFFIC_UDP,
+  TRAFFIC_ICMP,
+  TRAFFIC_OTHER_PROTOCOL,
+  TRAFFIC_WELL_KNOWN_PORTS, // 0 to 1023
+  TRAFFIC_REGISTERED_PORTS, // 1024 to 49151
+  TRAFFIC_DYNAMIC_PORTS,    // 49152 to 65535
+  TRAFFIC_CLASS_COUNT
+} TRAFFIC_CLASS;
+
+// Traffic captured on one interface since its monitor started
+struct TrafficRecord {
+  uint64_t packets[TRAFFIC_CLASS_COUNT]; // Packets per TRAFFIC_CLASS
+  uint64_t bytes[TRAFFIC_CLASS_COUNT];   // Link-layer bytes per class
+  uint64_t captureDrops; // Packets the capture ring had no room for
+};
+
+// Flows reported per interface and interval, heaviest first
+const uint32_t maxTopFlows = 10;
+
+// 5-tuple of a flow. Addresses are in network byte order, ports in host
+// byte order and zero for protocols without ports
+struct FlowKey {
+  uint8_t source[16];      // Source address, addressLength bytes used
+  uint8_t destination[16]; // Destination address, addressLength bytes used
+  uint16_t sourcePort;     // Source TCP or UDP port
+  uint16_t destinationPort; // Destination TCP or UDP port
+  uint8_t protocol;        // IPPROTO_* of the flow
+  uint8_t addressLength;   // 4 for IPv4, 16 for IPv6
+  uint8_t reserved[2];     // Zero, pads the key to 40 bytes
+};
+
+// One of the heaviest flows of an interface over the last interval. The
+// counts are sketch estimates, never below the true ones
+struct FlowRecord {
+  FlowKey key;      // Flow the counts belong to
+  uint64_t packets; // Estimated packets in the interval
+  uint64_t bytes;   // Estimated link-layer bytes in the interval
+};
+
+// Start of a MSG_SAMPLE_BATCH payload
+struct BatchHeader {
+  uint32_t count;    // BatchedSamples following the header
+  uint32_t reserved; // Zero, pads the header to 8 bytes
+};
+
+// One sample inside a batch, carrying what the frame header would
+struct BatchedSample {
+  uint32_t interfaceId; // Sender-local id of the interface
+  uint32_t reserved;    // Zero, keeps the timestamp 8-byte aligned
+  uint64_t timestampNs; // CLOCK_MONOTONIC time of the sample
+  StatsRecord record;   // Statistics of the interface
+};
+
+// Most samples one batch frame can carry
+const uint32_t maxBatchSamples =
+    (maxFramePayload - sizeof(BatchHeader)) / sizeof(BatchedSample);
+
+static_assert(sizeof(FrameHeader) == 24, "FrameHeader layout changed");
+static_assert(sizeof(StatsRecord) == 168, "StatsRecord layout changed");
+static_assert(sizeof(CollectorStatus) == 32, "CollectorStatus layout changed");
+static_assert(sizeof(LinkEventRecord) == 8, "LinkEventRecord layout changed");
+static_assert(sizeof(BatchedSample) == 184, "BatchedSample layout changed");
+static_assert(sizeof(TrafficRecord) == 184, "TrafficRecord layout changed");
+static_assert(sizeof(FlowKey) == 40, "FlowKey layout changed");
+static_assert(sizeof(CollectorMetrics) == 72, "CollectorMetrics layout changed");
+static_assert(sizeof(HistogramEntry) == 8, "HistogramEntry layout changed");
+static_assert(sizeof(IntervalRecord) == 8, "IntervalRecord layout changed");
+static_assert(sizeof(FlowRecord) == 56, "FlowRecord layout changed");
+
+void fillFrameHeader(FrameHeader &header, MESSAGE_TYPE type,
+                     uint32_t interfaceId, uint64_t timestampNs,
+                     uint32_t length);
+void appendFrame(std::vector<char> &buffer, MESSAGE_TYPE type,
+                 uint32_t interfaceId, uint64_t timestampNs,
+                 const void *payload, uint32_t length);
+void fillStatsRecord(const InterfaceCounters &counters,
+                     const InterfaceRates &rates, StatsRecord &record);
+int extractFrame(const std::vector<char> &buffer, size_t &offset,
+                 FrameHeader &header, const char *&payload);
+const char *trafficClassName(TRAFFIC_CLASS trafficClass);
+
+#endif // MONITOR_PROTOCOL_H
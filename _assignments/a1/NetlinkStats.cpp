@@ -0,0 +1,218 @@
+#include "NetlinkStats.h"
+#include <cerrno>              // For errno
+#include <cstring>             // For memset and memcpy
+#include <linux/if.h>          // For IFF_LOWER_UP
+#include <linux/if_link.h>     // For IFLA_STATS64 and rtnl_link_stats64
+#include <linux/netlink.h>     // For netlink message macros
+#include <linux/rtnetlink.h>   // For RTM_GETLINK and ifinfomsg
+#include <sys/socket.h>        // For socket, send and recv
+#include <unistd.h>            // For close
+
+using namespace std;
+
+// ========== CONSTANTS ==========
+
+// Size of the buffer one batch of dump messages is received into
+static const int receiveBufferSize = 32768;
+
+// ========== HELPER FUNCTIONS ==========
+
+// Fill the counters and carrier state from the attributes of one link
+// message and return the name of the link
+static string parseLinkAttributes(struct nlmsghdr *message,
+                                  InterfaceCounters &counters,
+                                  bool &hasCarrier) {
+  struct ifinfomsg *interfaceInfo = (struct ifinfomsg *)NLMSG_DATA(message);
+  int attributesLength = IFLA_PAYLOAD(message);
+
+  string name;
+  clearInterfaceCounters(counters);
+  hasCarrier = (interfaceInfo->ifi_flags & IFF_LOWER_UP) != 0;
+
+  for (struct rtattr *attribute = IFLA_RTA(interfaceInfo);
+       RTA_OK(attribute, attributesLength);
+       attribute = RTA_NEXT(attribute, attributesLength)) {
+    switch (attribute->rta_type) {
+    case IFLA_IFNAME:
+      name = (const char *)RTA_DATA(attribute);
+      break;
+    case IFLA_OPERSTATE:
+      counters.operstate = operstateName(*(uint8_t *)RTA_DATA(attribute));
+      break;
+    case IFLA_CARRIER:
+      hasCarrier = *(uint8_t *)RTA_DATA(attribute) != 0;
+      break;
+    case IFLA_CARRIER_UP_COUNT:
+      counters.values[STAT_CARRIER_UP_COUNT] =
+          *(unsigned int *)RTA_DATA(attribute);
+      break;
+    case IFLA_CARRIER_DOWN_COUNT:
+      counters.values[STAT_CARRIER_DOWN_COUNT] =
+          *(unsigned int *)RTA_DATA(attribute);
+      break;
+    case IFLA_STATS64: {
+      // The payload is only 4-byte aligned, copy it out before reading
+      struct rtnl_link_stats64 stats;
+      memset(&stats, 0, sizeof(stats));
+      memcpy(&stats, RTA_DATA(attribute),
+             min((size_t)RTA_PAYLOAD(attribute), sizeof(stats)));
+      counters.values[STAT_TX_BYTES] = stats.tx_bytes;
+      counters.values[STAT_RX_BYTES] = stats.rx_bytes;
+      counters.values[STAT_RX_DROPPED] = stats.rx_dropped;
+      counters.values[STAT_RX_ERRORS] = stats.rx_errors;
+      counters.values[STAT_TX_PACKETS] = stats.tx_packets;
+      counters.values[STAT_TX_DROPPED] = stats.tx_dropped;
+      counters.values[STAT_TX_ERRORS] = stats.tx_errors;
+      counters.values[STAT_RX_PACKETS] = stats.rx_packets;
+      break;
+    }
+    }
+  }
+
+  return name;
+}
+
+// Store the counters of one RTM_NEWLINK message of a dump
+static void parseLinkMessage(
+    struct nlmsghdr *message, uint64_t timestampNs,
+    unordered_map<string, InterfaceCounters> &linkCounters) {
+  InterfaceCounters counters;
+  bool hasCarrier;
+  string name = parseLinkAttributes(message, counters, hasCarrier);
+
+  if (!name.empty()) {
+    counters.timestampNs = timestampNs;
+    counters.isPresent = true;
+    linkCounters[name] = counters;
+  }
+}
+
+// ========== CORE FUNCTIONS ==========
+
+// Open the NETLINK_ROUTE socket used for the dumps
+int openNetlinkStats(NetlinkStats &netlinkStats) {
+  netlinkStats.socketFd =
+      socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+  if (netlinkStats.socketFd < 0)
+    return -1;
+
+  netlinkStats.sequence = 0;
+  netlinkStats.buffer.resize(receiveBufferSize);
+  return 0;
+}
+
+// Close the netlink socket
+void closeNetlinkStats(NetlinkStats &netlinkStats) {
+  if (netlinkStats.socketFd >= 0)
+    close(netlinkStats.socketFd);
+  netlinkStats.socketFd = -1;
+}
+
+// Request an RTM_GETLINK dump and store the counters of every link by name.
+// Returns -1 if the dump could not be completed
+int dumpNetlinkStats(NetlinkStats &netlinkStats,
+                     unordered_map<string, InterfaceCounters> &linkCounters) {
+  // Dump request: a netlink header followed by an empty ifinfomsg
+  struct {
+    struct nlmsghdr header;
+    struct ifinfomsg interfaceInfo;
+  } request;
+
+  memset(&request, 0, sizeof(request));
+  request.header.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+  request.header.nlmsg_type = RTM_GETLINK;
+  request.header.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+  request.header.nlmsg_seq = ++netlinkStats.sequence;
+  request.interfaceInfo.ifi_family = AF_UNSPEC;
+
+  if (send(netlinkStats.socketFd, &request, request.header.nlmsg_len, 0) < 0)
+    return -1;
+
+  linkCounters.clear();
+
+  // Every link of one dump shares the time the dump was requested
+  uint64_t timestampNs = monotonicTimeNs();
+
+  // Each recv() returns a batch of messages until NLMSG_DONE arrives
+  while (true) {
+    ssize_t bytesRead = recv(netlinkStats.socketFd, netlinkStats.buffer.data(),
+                             netlinkStats.buffer.size(), 0);
+    if (bytesRead < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+
+    int remaining = bytesRead;
+    for (struct nlmsghdr *message =
+             (struct nlmsghdr *)netlinkStats.buffer.data();
+         NLMSG_OK(message, remaining);
+         message = NLMSG_NEXT(message, remaining)) {
+      // Skip replies to an earlier, abandoned request
+      if (message->nlmsg_seq != netlinkStats.sequence)
+        continue;
+
+      if (message->nlmsg_type == NLMSG_DONE)
+        return 0;
+      if (message->nlmsg_type == NLMSG_ERROR)
+        return -1;
+      if (message->nlmsg_type == RTM_NEWLINK)
+        parseLinkMessage(message, timestampNs, linkCounters);
+    }
+  }
+}
+
+// Open a NETLINK_ROUTE socket subscribed to the RTNLGRP_LINK multicast group,
+// which receives a message whenever a link changes, appears or disappears
+int openLinkEvents() {
+  int socketFd =
+      socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_ROUTE);
+  if (socketFd < 0)
+    return -1;
+
+  struct sockaddr_nl address;
+  memset(&address, 0, sizeof(address));
+  address.nl_family = AF_NETLINK;
+  address.nl_groups = RTMGRP_LINK;
+  if (bind(socketFd, (struct sockaddr *)&address, sizeof(address)) < 0) {
+    close(socketFd);
+    return -1;
+  }
+  return socketFd;
+}
+
+// Read every pending link notification from the non-blocking event socket.
+// Returns -1 with errno set to ENOBUFS when notifications were lost and the
+// link states must be re-read
+int readLinkEvents(int socketFd, vector<LinkEvent> &events) {
+  char buffer[receiveBufferSize];
+  events.clear();
+
+  while (true) {
+    ssize_t bytesRead = recv(socketFd, buffer, sizeof(buffer), 0);
+    if (bytesRead < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return 0;
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+
+    int remaining = bytesRead;
+    for (struct nlmsghdr *message = (struct nlmsghdr *)buffer;
+         NLMSG_OK(message, remaining);
+         message = NLMSG_NEXT(message, remaining)) {
+      if (message->nlmsg_type != RTM_NEWLINK &&
+          message->nlmsg_type != RTM_DELLINK)
+        continue;
+
+      LinkEvent event;
+      InterfaceCounters counters;
+      event.name = parseLinkAttributes(message, counters, event.hasCarrier);
+      event.operstate = counters.operstate;
+      event.isRemoved = message->nlmsg_type == RTM_DELLINK;
+      if (!event.name.empty())
+        events.push_back(event);
+    }
+  }
+}
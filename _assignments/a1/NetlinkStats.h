@@ -0,0 +1,33 @@
+#ifndef NETLINK_STATS_H
+#define NETLINK_STATS_H
+
+#include "InterfaceStats.h"
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// NETLINK_ROUTE socket used to dump the statistics of every link at once
+struct NetlinkStats {
+  int socketFd;              // Netlink socket descriptor
+  unsigned int sequence;     // Sequence number of the last dump request
+  std::vector<char> buffer;  // Receive buffer reused by every dump
+};
+
+// State of a link as announced by an RTNLGRP_LINK notification
+struct LinkEvent {
+  std::string name;      // Interface name
+  std::string operstate; // Operational state after the change
+  bool hasCarrier;       // Whether the link has carrier
+  bool isRemoved;        // True for RTM_DELLINK, the link no longer exists
+};
+
+int openNetlinkStats(NetlinkStats &netlinkStats);
+void closeNetlinkStats(NetlinkStats &netlinkStats);
+int dumpNetlinkStats(
+    NetlinkStats &netlinkStats,
+    std::unordered_map<std::string, InterfaceCounters> &linkCounters);
+
+int openLinkEvents();
+int readLinkEvents(int socketFd, std::vector<LinkEvent> &events);
+
+#endif // NETLINK_STATS_H
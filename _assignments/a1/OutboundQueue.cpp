@@ -0,0 +1,336 @@
+#include "OutboundQueue.h"
+#include "SampleCodec.h"
+#include <algorithm> // For find
+#include <cerrno>    // For errno
+#include <cstring>   // For memcpy
+#include <sys/uio.h> // For writev
+
+using namespace std;
+
+// ========== CONSTANTS ==========
+
+// Frames handed to a single writev()
+const int maxFlushVectors = 64;
+
+// ========== HELPER FUNCTIONS ==========
+
+// Samples carried by a frame, read from its header and payload
+static uint32_t frameSamples(const FrameHeader &header, const char *payload) {
+  if (header.type == MSG_INTERFACE_STATS)
+    return 1;
+  if (header.type == MSG_SAMPLE_BATCH && header.length >= sizeof(BatchHeader)) {
+    BatchHeader batch;
+    memcpy(&batch, payload, sizeof(batch));
+    return batch.count;
+  }
+  if (header.type == MSG_DELTA_SAMPLES) {
+    // The payload starts with the number of records
+    uint64_t count;
+    const char *data = payload;
+    if (readVarint(data, payload + header.length, count) == 0)
+      return count;
+  }
+  return 0;
+}
+
+// Whether only the latest frame of a type and interface matters: status,
+// driver and traffic counters are cumulative, and names and top flows are
+// only current in the latest one
+static bool isLatestOnly(uint16_t type) {
+  return type == MSG_COLLECTOR_STATUS || type == MSG_DRIVER_STAT_NAMES ||
+         type == MSG_DRIVER_STATS || type == MSG_TRAFFIC_CLASSES ||
+         type == MSG_TOP_FLOWS;
+}
+
+// Whether a frame counts against maxEventFrames
+static bool isEventFrame(uint16_t type, uint32_t samples) {
+  return samples == 0 && !isLatestOnly(type);
+}
+
+// Return the buffer of a frame that is no longer queued for reuse
+static void recycleFrame(OutboundQueue &queue, OutboundFrame &frame) {
+  if (frame.samples > 0)
+    --queue.sampleFrames;
+  else if (isEventFrame(frame.type, frame.samples))
+    --queue.eventFrames;
+  if (queue.spares.size() < queue.capacity)
+    queue.spares.push_back(move(frame.data));
+}
+
+// Drop the oldest sample frame that has not started being written. Returns
+// whether one was found
+static bool dropOldestSample(OutboundQueue &queue) {
+  size_t first = queue.headOffset > 0 ? 1 : 0;
+  for (size_t i = first; i < queue.frames.size(); ++i) {
+    if (queue.frames[i].samples == 0)
+      continue;
+    queue.droppedSamples += queue.frames[i].samples;
+    recycleFrame(queue, queue.frames[i]);
+    queue.frames.erase(queue.frames.begin() + i);
+    return true;
+  }
+  return false;
+}
+
+// Drop the oldest link event or metrics frame that has not started being
+// written. Returns whether one was found
+static bool dropOldestEvent(OutboundQueue &queue) {
+  size_t first = queue.headOffset > 0 ? 1 : 0;
+  for (size_t i = first; i < queue.frames.size(); ++i) {
+    if (!isEventFrame(queue.frames[i].type, queue.frames[i].samples))
+      continue;
+    ++queue.droppedEvents;
+    recycleFrame(queue, queue.frames[i]);
+    queue.frames.erase(queue.frames.begin() + i);
+    return true;
+  }
+  return false;
+}
+
+// Overwrite the newest unsent frame of the same type and interface with a
+// newer one, whatever its length. Returns whether one was found
+static bool replaceQueuedFrame(OutboundQueue &queue, const FrameHeader &header,
+                               const char *frame, size_t length) {
+  size_t first = queue.headOffset > 0 ? 1 : 0;
+  for (size_t i = queue.frames.size(); i-- > first;) {
+    OutboundFrame &queued = queue.frames[i];
+    if (queued.type != header.type ||
+        queued.interfaceId != header.interfaceId)
+      continue;
+    queued.data.assign(frame, frame + length);
+    return true;
+  }
+  return false;
+}
+
+// Overwrite the newest queued, unsent sample of each interface in a new
+// batch with the new one, so no queued frame after it holds an older sample
+// of the interface. Samples without a queued counterpart are copied into
+// remaining as a smaller batch frame. Returns the samples left in it
+static uint32_t coalesceBatchSamples(OutboundQueue &queue,
+                                     const FrameHeader &header,
+                                     const char *frame,
+                                     vector<char> &remaining) {
+  BatchHeader batch;
+  memcpy(&batch, frame + sizeof(header), sizeof(batch));
+  const char *samples = frame + sizeof(header) + sizeof(batch);
+  size_t first = queue.headOffset > 0 ? 1 : 0;
+
+  remaining.assign(frame, frame + sizeof(header) + sizeof(batch));
+  uint32_t kept = 0;
+  for (uint32_t n = 0; n < batch.count; ++n) {
+    BatchedSample sample;
+    memcpy(&sample, samples + n * sizeof(sample), sizeof(sample));
+
+    // Newest queued sample of the interface, searched from the back
+    char *target = nullptr;
+    for (size_t i = queue.frames.size(); i-- > first && target == nullptr;) {
+      OutboundFrame &queued = queue.frames[i];
+      if (queued.type != MSG_SAMPLE_BATCH)
+        continue;
+      char *queuedSamples =
+          queued.data.data() + sizeof(FrameHeader) + sizeof(BatchHeader);
+      for (uint32_t j = queued.samples; j-- > 0;) {
+        uint32_t interfaceId;
+        memcpy(&interfaceId, queuedSamples + j * sizeof(BatchedSample),
+               sizeof(interfaceId));
+        if (interfaceId == sample.interfaceId) {
+          target = queuedSamples + j * sizeof(BatchedSample);
+          break;
+        }
+      }
+    }
+
+    if (target != nullptr) {
+      memcpy(target, &sample, sizeof(sample));
+      ++queue.droppedSamples;
+    } else {
+      remaining.insert(remaining.end(), (const char *)&sample,
+                       (const char *)&sample + sizeof(sample));
+      ++kept;
+    }
+  }
+
+  // Fix up the lengths of the smaller frame
+  FrameHeader remainingHeader = header;
+  remainingHeader.length = sizeof(BatchHeader) + kept * sizeof(BatchedSample);
+  batch.count = kept;
+  memcpy(remaining.data(), &remainingHeader, sizeof(remainingHeader));
+  memcpy(remaining.data() + sizeof(remainingHeader), &batch, sizeof(batch));
+  return kept;
+}
+
+// Overwrite the newest unsent MSG_DELTA_SAMPLES frame with a new one made
+// of keyframes for at least the same interfaces. The frames queued before it
+// still decode, and the keyframes resynchronise every interface it carried,
+// while replacing an older frame would leave the deltas after it without
+// their bases. Returns whether the frame was replaced
+static bool replaceDeltaFrame(OutboundQueue &queue, const FrameHeader &header,
+                              const char *frame, size_t length,
+                              uint32_t samples) {
+  size_t first = queue.headOffset > 0 ? 1 : 0;
+  size_t newest = queue.frames.size();
+  for (size_t i = queue.frames.size(); i-- > first;) {
+    if (queue.frames[i].type == MSG_DELTA_SAMPLES) {
+      newest = i;
+      break;
+    }
+  }
+  if (newest == queue.frames.size())
+    return false;
+
+  vector<uint32_t> newIds, queuedIds;
+  bool isKeyframes, queuedKeyframes;
+  OutboundFrame &queued = queue.frames[newest];
+  if (scanSampleRecords(frame + sizeof(header), header.length, newIds,
+                        isKeyframes) < 0 ||
+      !isKeyframes ||
+      scanSampleRecords(queued.data.data() + sizeof(FrameHeader),
+                        queued.data.size() - sizeof(FrameHeader), queuedIds,
+                        queuedKeyframes) < 0)
+    return false;
+  for (uint32_t interfaceId : queuedIds) {
+    if (find(newIds.begin(), newIds.end(), interfaceId) == newIds.end())
+      return false;
+  }
+
+  queue.droppedSamples += queued.samples;
+  queued.data.assign(frame, frame + length);
+  queued.samples = samples;
+  return true;
+}
+
+// ========== CORE FUNCTIONS ==========
+
+// Set up an empty queue holding at most capacity sample frames
+void initOutboundQueue(OutboundQueue &queue, size_t capacity,
+                       OVERFLOW_POLICY policy) {
+  queue.frames.clear();
+  queue.spares.clear();
+  queue.headOffset = 0;
+  queue.sampleFrames = 0;
+  queue.eventFrames = 0;
+  queue.capacity = capacity;
+  queue.policy = policy;
+  queue.droppedSamples = 0;
+  queue.droppedEvents = 0;
+  queue.bytesWritten = 0;
+}
+
+// Queue one complete frame, applying the overflow policy if it carries
+// samples and the queue is full
+void enqueueFrame(OutboundQueue &queue, const char *frame, size_t length) {
+  FrameHeader header;
+  memcpy(&header, frame, sizeof(header));
+  uint32_t samples = frameSamples(header, frame + sizeof(header));
+
+  if (isLatestOnly(header.type) &&
+      replaceQueuedFrame(queue, header, frame, length))
+    return;
+
+  // The oldest event makes room for a new one
+  if (isEventFrame(header.type, samples) &&
+      queue.eventFrames >= maxEventFrames && !dropOldestEvent(queue)) {
+    ++queue.droppedEvents;
+    return;
+  }
+
+  vector<char> remaining;
+  if (samples > 0 && queue.sampleFrames >= queue.capacity) {
+    // Coalescing needs a queued sample of the same interface, otherwise the
+    // oldest sample makes room as with drop-oldest
+    if (queue.policy == OVERFLOW_COALESCE &&
+        header.type == MSG_INTERFACE_STATS &&
+        replaceQueuedFrame(queue, header, frame, length)) {
+      ++queue.droppedSamples;
+      return;
+    }
+
+    // A batch coalesces sample by sample, and only what is left of it is
+    // queued
+    if (queue.policy == OVERFLOW_COALESCE &&
+        header.type == MSG_SAMPLE_BATCH) {
+      samples = coalesceBatchSamples(queue, header, frame, remaining);
+      if (samples == 0)
+        return;
+      frame = remaining.data();
+      length = remaining.size();
+    }
+
+    // A delta frame only replaces a queued one when it is made of
+    // keyframes, which the encoder sends while the queue is full
+    if (queue.policy == OVERFLOW_COALESCE &&
+        header.type == MSG_DELTA_SAMPLES &&
+        replaceDeltaFrame(queue, header, frame, length, samples))
+      return;
+    if (!dropOldestSample(queue)) {
+      queue.droppedSamples += samples;
+      return;
+    }
+  }
+
+  OutboundFrame queued;
+  if (!queue.spares.empty()) {
+    queued.data = move(queue.spares.back());
+    queue.spares.pop_back();
+  }
+  queued.data.assign(frame, frame + length);
+  queued.type = header.type;
+  queued.interfaceId = header.interfaceId;
+  queued.samples = samples;
+  if (samples > 0)
+    ++queue.sampleFrames;
+  else if (isEventFrame(header.type, samples))
+    ++queue.eventFrames;
+  queue.frames.push_back(move(queued));
+}
+
+// Queue every frame of a buffer built with appendFrame
+void enqueueFrames(OutboundQueue &queue, const vector<char> &frames) {
+  FrameHeader header;
+  size_t offset = 0;
+  while (offset + sizeof(FrameHeader) <= frames.size()) {
+    memcpy(&header, frames.data() + offset, sizeof(header));
+    size_t frameLength = sizeof(FrameHeader) + header.length;
+    enqueueFrame(queue, frames.data() + offset, frameLength);
+    offset += frameLength;
+  }
+}
+
+// Write as many queued frames as the socket accepts without blocking, several
+// per writev(). Returns 0 once the queue is empty, 1 if the socket is full
+// and -1 on error
+int flushOutboundQueue(OutboundQueue &queue, int socket) {
+  while (!queue.frames.empty()) {
+    struct iovec vectors[maxFlushVectors];
+    int count = 0;
+    for (size_t i = 0; i < queue.frames.size() && count < maxFlushVectors;
+         ++i) {
+      size_t skip = i == 0 ? queue.headOffset : 0;
+      vectors[count].iov_base = queue.frames[i].data.data() + skip;
+      vectors[count].iov_len = queue.frames[i].data.size() - skip;
+      ++count;
+    }
+
+    ssize_t result = writev(socket, vectors, count);
+    if (result < 0) {
+      if (errno == EINTR)
+        continue;
+      return (errno == EAGAIN || errno == EWOULDBLOCK) ? 1 : -1;
+    }
+
+    // Release the frames written in full and remember how far into the
+    // next one the write got
+    size_t written = result;
+    queue.bytesWritten += written;
+    while (!queue.frames.empty() &&
+           written >= queue.frames.front().data.size() - queue.headOffset) {
+      written -= queue.frames.front().data.size() - queue.headOffset;
+      queue.headOffset = 0;
+      recycleFrame(queue, queue.frames.front());
+      queue.frames.pop_front();
+    }
+    queue.headOffset += written;
+  }
+  return 0;
+}
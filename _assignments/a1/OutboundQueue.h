@@ -0,0 +1,53 @@
+#ifndef OUTBOUND_QUEUE_H
+#define OUTBOUND_QUEUE_H
+
+#include "MonitorProtocol.h"
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+// Link events and collector metrics frames queued at most
+const size_t maxEventFrames = 1024;
+
+// Frames waiting to be written to a non-blocking socket. Frames carrying
+// samples count against the capacity. Only the latest status frame, and the
+// latest driver statistic names, driver statistics, traffic and top flows
+// frame of each interface, is kept. Link events and collector metrics are
+// kept up to maxEventFrames, beyond which the oldest is dropped
+
+// What happens to a new sample when the queue is full
+typedef enum {
+  OVERFLOW_DROP_OLDEST, // Discard the oldest queued sample frame
+  OVERFLOW_COALESCE     // Overwrite the interface's queued sample in place,
+                        // inside queued batches too
+} OVERFLOW_POLICY;
+
+// One queued frame, header included
+struct OutboundFrame {
+  std::vector<char> data; // Header and payload
+  uint16_t type;          // Frame type, copied from the header
+  uint32_t interfaceId;   // Interface id, copied from the header
+  uint32_t samples;       // Samples carried, 0 for control frames
+};
+
+struct OutboundQueue {
+  std::deque<OutboundFrame> frames;        // Oldest frame first
+  std::vector<std::vector<char>> spares;   // Buffers of sent frames, reused
+  size_t headOffset;                       // Bytes of the first frame sent
+  size_t sampleFrames;                     // Queued frames carrying samples
+  size_t eventFrames;                      // Queued link events and metrics
+  size_t capacity;                         // Most sample frames kept
+  OVERFLOW_POLICY policy;                  // Policy applied when full
+  uint64_t droppedSamples;                 // Samples discarded or overwritten
+  uint64_t droppedEvents;                  // Link events and metrics dropped
+  uint64_t bytesWritten;                   // Bytes the socket accepted
+};
+
+void initOutboundQueue(OutboundQueue &queue, size_t capacity,
+                       OVERFLOW_POLICY policy);
+void enqueueFrame(OutboundQueue &queue, const char *frame, size_t length);
+void enqueueFrames(OutboundQueue &queue, const std::vector<char> &frames);
+int flushOutboundQueue(OutboundQueue &queue, int socket);
+
+#endif // OUTBOUND_QUEUE_H
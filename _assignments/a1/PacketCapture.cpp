@@ -0,0 +1,326 @@
+#include "PacketCapture.h"
+#include <algorithm>            // For min
+#include <arpa/inet.h>          // For ntohs and htons
+#include <cerrno>               // For errno
+#include <cstring>              // For memset and memcpy
+#include <linux/filter.h>       // For sock_filter and sock_fprog
+#include <linux/if_packet.h>    // For tpacket_req3 and tpacket3_hdr
+#include <net/ethernet.h>       // For ETH_P_ALL
+#include <net/if.h>             // For if_nametoindex and IFF_LOOPBACK
+#include <netinet/in.h>         // For IPPROTO_*
+#include <sys/ioctl.h>          // For ioctl
+#include <sys/mman.h>           // For mmap and munmap
+#include <sys/socket.h>         // For socket, bind and setsockopt
+#include <unistd.h>             // For close
+
+using namespace std;
+
+// ========== CONSTANTS ==========
+
+// Ring geometry: 4 blocks of 1 MiB per interface. A block is handed over
+// when it is full, or after captureBlockTimeoutMs when traffic is light
+static const uint32_t captureBlockSize = 1 << 20;
+static const uint32_t captureBlockCount = 4;
+static const uint32_t captureFrameSize = 2048;
+static const uint32_t captureBlockTimeoutMs = 20;
+
+// Bytes of each packet copied into the ring, enough for an Ethernet header,
+// a VLAN tag, an IPv6 header with extension headers and the ports
+static const uint32_t captureSnapLength = 128;
+
+// Ethertypes told apart
+static const uint16_t ethertypeIpv4 = 0x0800;
+static const uint16_t ethertypeIpv6 = 0x86DD;
+static const uint16_t ethertypeArp = 0x0806;
+
+// ========== HELPER FUNCTIONS ==========
+
+// Count a packet in one traffic class
+static void countPacket(TrafficRecord &traffic, TRAFFIC_CLASS trafficClass,
+                        uint32_t length) {
+  ++traffic.packets[trafficClass];
+  traffic.bytes[trafficClass] += length;
+}
+
+// Read the ports of a TCP or UDP header if they were captured
+static void parsePorts(PacketInfo &packet, const uint8_t *transport,
+                       size_t available) {
+  if ((packet.ipProtocol != IPPROTO_TCP && packet.ipProtocol != IPPROTO_UDP) ||
+      available < 4)
+    return;
+  packet.sourcePort = (transport[0] << 8) | transport[1];
+  packet.destinationPort = (transport[2] << 8) | transport[3];
+  packet.hasPorts = true;
+}
+
+// Parse an IPv4 header. Only the first fragment of a datagram has ports
+static void parseIpv4(PacketInfo &packet, const uint8_t *network,
+                      size_t available) {
+  if (available < 20 || (network[0] >> 4) != 4)
+    return;
+  size_t headerLength = (network[0] & 0x0F) * 4;
+  if (headerLength < 20 || headerLength > available)
+    return;
+
+  packet.isIp = true;
+  packet.ipProtocol = network[9];
+  packet.addressLength = 4;
+  memcpy(packet.source, network + 12, 4);
+  memcpy(packet.destination, network + 16, 4);
+
+  uint16_t fragmentOffset = ((network[6] & 0x1F) << 8) | network[7];
+  if (fragmentOffset == 0)
+    parsePorts(packet, network + headerLength, available - headerLength);
+}
+
+// Parse an IPv6 header, skipping the extension headers that may come before
+// the transport header
+static void parseIpv6(PacketInfo &packet, const uint8_t *network,
+                      size_t available) {
+  if (available < 40 || (network[0] >> 4) != 6)
+    return;
+
+  packet.isIp = true;
+  packet.addressLength = 16;
+  memcpy(packet.source, network + 8, 16);
+  memcpy(packet.destination, network + 24, 16);
+
+  uint8_t nextHeader = network[6];
+  size_t offset = 40;
+  bool isLaterFragment = false;
+  while (offset + 8 <= available) {
+    if (nextHeader == IPPROTO_HOPOPTS || nextHeader == IPPROTO_ROUTING ||
+        nextHeader == IPPROTO_DSTOPTS) {
+      uint8_t following = network[offset];
+      offset += (network[offset + 1] + 1) * 8;
+      nextHeader = following;
+    } else if (nextHeader == IPPROTO_FRAGMENT) {
+      isLaterFragment = (((network[offset + 2] << 8) | network[offset + 3]) &
+                         0xFFF8) != 0;
+      nextHeader = network[offset];
+      offset += 8;
+    } else {
+      break;
+    }
+  }
+
+  packet.ipProtocol = nextHeader;
+  if (!isLaterFragment && offset <= available)
+    parsePorts(packet, network + offset, available - offset);
+}
+
+// Classify one packet into its ethertype, IP protocol and port range
+static void classifyPacket(TrafficRecord &traffic, const PacketInfo &packet) {
+  switch (packet.ethertype) {
+  case ethertypeIpv4:
+    countPacket(traffic, TRAFFIC_IPV4, packet.length);
+    break;
+  case ethertypeIpv6:
+    countPacket(traffic, TRAFFIC_IPV6, packet.length);
+    break;
+  case ethertypeArp:
+    countPacket(traffic, TRAFFIC_ARP, packet.length);
+    break;
+  default:
+    countPacket(traffic, TRAFFIC_OTHER_ETHERTYPE, packet.length);
+    break;
+  }
+  if (!packet.isIp)
+    return;
+
+  if (packet.ipProtocol == IPPROTO_TCP)
+    countPacket(traffic, TRAFFIC_TCP, packet.length);
+  else if (packet.ipProtocol == IPPROTO_UDP)
+    countPacket(traffic, TRAFFIC_UDP, packet.length);
+  else if (packet.ipProtocol == IPPROTO_ICMP ||
+           packet.ipProtocol == IPPROTO_ICMPV6)
+    countPacket(traffic, TRAFFIC_ICMP, packet.length);
+  else
+    countPacket(traffic, TRAFFIC_OTHER_PROTOCOL, packet.length);
+
+  if (!packet.hasPorts)
+    return;
+  uint16_t servicePort = min(packet.sourcePort, packet.destinationPort);
+  if (servicePort < 1024)
+    countPacket(traffic, TRAFFIC_WELL_KNOWN_PORTS, packet.length);
+  else if (servicePort < 49152)
+    countPacket(traffic, TRAFFIC_REGISTERED_PORTS, packet.length);
+  else
+    countPacket(traffic, TRAFFIC_DYNAMIC_PORTS, packet.length);
+}
+
+// Parse and classify every packet of a block the kernel handed over
+static void walkBlock(PacketCapture &capture, struct tpacket_block_desc *block,
+                      PACKET_VISITOR visitor, void *context) {
+  uint32_t packetCount = block->hdr.bh1.num_pkts;
+  uint8_t *position = (uint8_t *)block + block->hdr.bh1.offset_to_first_pkt;
+
+  for (uint32_t i = 0; i < packetCount; ++i) {
+    struct tpacket3_hdr *header = (struct tpacket3_hdr *)position;
+    const struct sockaddr_ll *link =
+        (const struct sockaddr_ll *)(position +
+                                     TPACKET_ALIGN(sizeof(*header)));
+    position += header->tp_next_offset;
+
+    if (capture.skipOutgoing && link->sll_pkttype == PACKET_OUTGOING)
+      continue;
+
+    // The network header offset and sll_protocol do not depend on the link
+    // type, so Ethernet, VLAN-stripped and tunnel devices parse alike
+    PacketInfo packet;
+    packet.length = header->tp_len;
+    packet.ethertype = ntohs(link->sll_protocol);
+    packet.isIp = false;
+    packet.hasPorts = false;
+    packet.addressLength = 0;
+    packet.ipProtocol = 0;
+    packet.sourcePort = 0;
+    packet.destinationPort = 0;
+
+    const uint8_t *network = (const uint8_t *)header + header->tp_net;
+    size_t available =
+        header->tp_net < header->tp_mac + header->tp_snaplen
+            ? header->tp_mac + header->tp_snaplen - header->tp_net
+            : 0;
+    if (packet.ethertype == ethertypeIpv4)
+      parseIpv4(packet, network, available);
+    else if (packet.ethertype == ethertypeIpv6)
+      parseIpv6(packet, network, available);
+
+    classifyPacket(capture.traffic, packet);
+    if (visitor != nullptr)
+      visitor(packet, context);
+  }
+}
+
+// ========== CORE FUNCTIONS ==========
+
+// Prepare a closed capture with zeroed counters
+void initPacketCapture(PacketCapture &capture, const string &name) {
+  capture.name = name;
+  capture.socketFd = -1;
+  capture.ring = nullptr;
+  capture.ringSize = 0;
+  capture.blockSize = 0;
+  capture.blockCount = 0;
+  capture.nextBlock = 0;
+  capture.skipOutgoing = false;
+  memset(&capture.traffic, 0, sizeof(capture.traffic));
+}
+
+// Open the socket, truncate packets to their headers, set up and map the
+// ring and bind to the interface. The counters keep running across reopens
+int openPacketCapture(PacketCapture &capture) {
+  closePacketCapture(capture);
+
+  unsigned int interfaceIndex = if_nametoindex(capture.name.c_str());
+  if (interfaceIndex == 0)
+    return -1;
+
+  // Nothing is received before the ring exists and the socket is bound
+  int socketFd = socket(AF_PACKET, SOCK_RAW | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+  if (socketFd < 0)
+    return -1;
+
+  struct sock_filter truncate = {BPF_RET | BPF_K, 0, 0, captureSnapLength};
+  struct sock_fprog filter = {1, &truncate};
+  int version = TPACKET_V3;
+  struct tpacket_req3 request;
+  memset(&request, 0, sizeof(request));
+  request.tp_block_size = captureBlockSize;
+  request.tp_block_nr = captureBlockCount;
+  request.tp_frame_size = captureFrameSize;
+  request.tp_frame_nr = captureBlockSize / captureFrameSize * captureBlockCount;
+  request.tp_retire_blk_tov = captureBlockTimeoutMs;
+
+  struct sockaddr_ll address;
+  memset(&address, 0, sizeof(address));
+  address.sll_family = AF_PACKET;
+  address.sll_protocol = htons(ETH_P_ALL);
+  address.sll_ifindex = interfaceIndex;
+
+  void *ring = MAP_FAILED;
+  if (setsockopt(socketFd, SOL_SOCKET, SO_ATTACH_FILTER, &filter,
+                 sizeof(filter)) < 0 ||
+      setsockopt(socketFd, SOL_PACKET, PACKET_VERSION, &version,
+                 sizeof(version)) < 0 ||
+      setsockopt(socketFd, SOL_PACKET, PACKET_RX_RING, &request,
+                 sizeof(request)) < 0 ||
+      (ring = mmap(nullptr, (size_t)captureBlockSize * captureBlockCount,
+                   PROT_READ | PROT_WRITE, MAP_SHARED, socketFd, 0)) ==
+          MAP_FAILED ||
+      bind(socketFd, (struct sockaddr *)&address, sizeof(address)) < 0) {
+    int savedErrno = errno;
+    if (ring != MAP_FAILED)
+      munmap(ring, (size_t)captureBlockSize * captureBlockCount);
+    close(socketFd);
+    errno = savedErrno;
+    return -1;
+  }
+
+  // A loopback device receives every packet it sends
+  struct ifreq interfaceRequest;
+  memset(&interfaceRequest, 0, sizeof(interfaceRequest));
+  strncpy(interfaceRequest.ifr_name, capture.name.c_str(), IFNAMSIZ - 1);
+  capture.skipOutgoing =
+      ioctl(socketFd, SIOCGIFFLAGS, &interfaceRequest) == 0 &&
+      (interfaceRequest.ifr_flags & IFF_LOOPBACK);
+
+  capture.socketFd = socketFd;
+  capture.ring = (uint8_t *)ring;
+  capture.ringSize = (size_t)captureBlockSize * captureBlockCount;
+  capture.blockSize = captureBlockSize;
+  capture.blockCount = captureBlockCount;
+  capture.nextBlock = 0;
+  return 0;
+}
+
+// Unmap the ring and close the socket, keeping the counters
+void closePacketCapture(PacketCapture &capture) {
+  if (capture.socketFd < 0)
+    return;
+  updateCaptureDrops(capture);
+  munmap(capture.ring, capture.ringSize);
+  close(capture.socketFd);
+  capture.socketFd = -1;
+  capture.ring = nullptr;
+}
+
+// Classify the packets of every block the kernel has handed over, in ring
+// order, and give the blocks back. visitor, if set, sees every packet too.
+// Returns the number of blocks processed
+size_t drainPacketCapture(PacketCapture &capture, PACKET_VISITOR visitor,
+                          void *context) {
+  if (capture.socketFd < 0)
+    return 0;
+
+  size_t blocks = 0;
+  while (blocks < capture.blockCount) {
+    struct tpacket_block_desc *block =
+        (struct tpacket_block_desc *)(capture.ring +
+                                      (size_t)capture.nextBlock *
+                                          capture.blockSize);
+    if (!(__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) &
+          TP_STATUS_USER))
+      break;
+
+    walkBlock(capture, block, visitor, context);
+    __atomic_store_n(&block->hdr.bh1.block_status, TP_STATUS_KERNEL,
+                     __ATOMIC_RELEASE);
+    capture.nextBlock = (capture.nextBlock + 1) % capture.blockCount;
+    ++blocks;
+  }
+  return blocks;
+}
+
+// Add the packets dropped since the last call, the kernel resets its count
+// on every read
+void updateCaptureDrops(PacketCapture &capture) {
+  if (capture.socketFd < 0)
+    return;
+  struct tpacket_stats_v3 stats;
+  socklen_t length = sizeof(stats);
+  if (getsockopt(capture.socketFd, SOL_PACKET, PACKET_STATISTICS, &stats,
+                 &length) == 0)
+    capture.traffic.captureDrops += stats.tp_drops;
+}
@@ -0,0 +1,50 @@
+#ifndef PACKET_CAPTURE_H
+#define PACKET_CAPTURE_H
+
+#include "MonitorProtocol.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// AF_PACKET socket with a TPACKET_V3 receive ring mapped into this process.
+// The kernel fills whole blocks of packets and hands them over by flipping a
+// status word, so classifying traffic costs no syscall and no copy per
+// packet. A socket filter truncates every packet to its headers
+
+// Headers of one captured packet, as far as they were understood
+struct PacketInfo {
+  uint32_t length;         // Length of the packet on the link
+  uint16_t ethertype;      // Host byte order, e.g. 0x0800
+  uint8_t ipProtocol;      // IPPROTO_* if isIp
+  bool isIp;               // Whether an IPv4 or IPv6 header was parsed
+  bool hasPorts;           // Whether sourcePort and destinationPort are set
+  uint8_t addressLength;   // 4 or 16 when isIp
+  uint8_t source[16];      // Source address, addressLength bytes
+  uint8_t destination[16]; // Destination address, addressLength bytes
+  uint16_t sourcePort;     // Host byte order
+  uint16_t destinationPort; // Host byte order
+};
+
+struct PacketCapture {
+  std::string name;     // Interface name
+  int socketFd;         // AF_PACKET socket, -1 when closed
+  uint8_t *ring;        // Mapped receive ring
+  size_t ringSize;      // Bytes mapped
+  uint32_t blockSize;   // Bytes per block
+  uint32_t blockCount;  // Blocks in the ring
+  uint32_t nextBlock;   // Next block the kernel hands over
+  bool skipOutgoing;    // Loopback sees each packet twice, count it once
+  TrafficRecord traffic; // Everything classified since the monitor started
+};
+
+// Called for every captured packet, after it was classified
+typedef void (*PACKET_VISITOR)(const PacketInfo &packet, void *context);
+
+void initPacketCapture(PacketCapture &capture, const std::string &name);
+int openPacketCapture(PacketCapture &capture);
+void closePacketCapture(PacketCapture &capture);
+size_t drainPacketCapture(PacketCapture &capture, PACKET_VISITOR visitor,
+                          void *context);
+void updateCaptureDrops(PacketCapture &capture);
+
+#endif // PACKET_CAPTURE_H
@@ -0,0 +1,207 @@
+#include "PrometheusMetrics.h"
+#include "InterfaceStats.h"
+#include <algorithm> // For min
+#include <cstdio>    // For snprintf
+
+using namespace std;
+
+// ========== CONSTANTS ==========
+
+const char *prometheusContentType = "text/plain; version=0.0.4; charset=utf-8";
+
+// Prefix of every metric name
+static const char *metricPrefix = "network_monitor_";
+
+// Highest IF_OPER_* code, IF_OPER_UP
+static const int maxOperstate = 6;
+
+// ========== HELPER FUNCTIONS ==========
+
+// Append an interface name as a label value, escaped as the format requires
+static void appendLabelValue(string &body, const string &value) {
+  for (char c : value) {
+    if (c == '\\' || c == '"') {
+      body += '\\';
+      body += c;
+    } else if (c == '\n') {
+      body += "\\n";
+    } else {
+      body += c;
+    }
+  }
+}
+
+// Append the HELP and TYPE lines introducing one metric
+static void appendMetricHeader(string &body, const string &name,
+                               const char *type, const char *help) {
+  body += "# HELP ";
+  body += name;
+  body += ' ';
+  body += help;
+  body += "\n# TYPE ";
+  body += name;
+  body += ' ';
+  body += type;
+  body += '\n';
+}
+
+// Append a label value as a quoted, escaped string
+static void appendQuotedLabel(string &body, const char *label,
+                              const string &value) {
+  body += label;
+  body += "=\"";
+  appendLabelValue(body, value);
+  body += '"';
+}
+
+// Append one sample of a metric for an interface
+static void appendMetricSample(string &body, const string &name,
+                               const string &interface, const char *value) {
+  body += name;
+  body += '{';
+  appendQuotedLabel(body, "interface", interface);
+  body += "} ";
+  body += value;
+  body += '\n';
+}
+
+// ========== CORE FUNCTIONS ==========
+
+// Render every counter and rate of every sampled interface in the Prometheus
+// text format, replacing body. Samples of one metric are grouped together
+// after its HELP and TYPE lines, as the format requires
+void renderPrometheusMetrics(const StatsSnapshot &snapshot, string &body) {
+  body.clear();
+  char value[64];
+
+  string name = string(metricPrefix) + "oper_state";
+  appendMetricHeader(body, name, "gauge",
+                     "Operational state (IF_OPER_*, 6 is up, -1 is missing)");
+  for (const auto &entry : snapshot.interfaces) {
+    if (entry->timestampNs == 0)
+      continue;
+    int state = (entry->latest.flags & STATS_PRESENT)
+                    ? min<int>(entry->latest.operstate, maxOperstate)
+                    : -1;
+    snprintf(value, sizeof(value), "%d", state);
+    appendMetricSample(body, name, entry->name, value);
+  }
+
+  name = string(metricPrefix) + "sample_age_seconds";
+  appendMetricHeader(body, name, "gauge",
+                     "Age of the latest sample when the metrics were built");
+  for (const auto &entry : snapshot.interfaces) {
+    if (entry->timestampNs == 0)
+      continue;
+    uint64_t ageNs = snapshot.publishedNs > entry->timestampNs
+                         ? snapshot.publishedNs - entry->timestampNs
+                         : 0;
+    snprintf(value, sizeof(value), "%.3f", ageNs / 1e9);
+    appendMetricSample(body, name, entry->name, value);
+  }
+
+  for (int i = 0; i < STAT_COUNT; ++i) {
+    name = string(metricPrefix) + statName((STAT)i) + "_total";
+    appendMetricHeader(body, name, "counter", "Interface counter");
+    for (const auto &entry : snapshot.interfaces) {
+      if (entry->timestampNs == 0)
+        continue;
+      snprintf(value, sizeof(value), "%llu",
+               (unsigned long long)entry->latest.counters[i]);
+      appendMetricSample(body, name, entry->name, value);
+    }
+  }
+
+  // Rates only exist from the second sample on, and only for traffic
+  // counters
+  for (int i = firstTrafficStat; i < STAT_COUNT; ++i) {
+    name = string(metricPrefix) + statName((STAT)i) + "_per_second";
+    appendMetricHeader(body, name, "gauge",
+                       "Rate of the interface counter over the last interval");
+    for (const auto &entry : snapshot.interfaces) {
+      if (entry->timestampNs == 0 ||
+          !(entry->latest.flags & STATS_RATES_VALID))
+        continue;
+      snprintf(value, sizeof(value), "%.3f", entry->latest.rates[i]);
+      appendMetricSample(body, name, entry->name, value);
+    }
+  }
+
+  // Monitors are restarted by networkMonitor, so an interface can have
+  // restarts before its first sample
+  name = string(metricPrefix) + "monitor_restarts_total";
+  appendMetricHeader(body, name, "counter",
+                     "Times the interface's monitor died and was restarted");
+  for (const auto &entry : snapshot.interfaces) {
+    snprintf(value, sizeof(value), "%u", entry->monitorRestarts);
+    appendMetricSample(body, name, entry->name, value);
+  }
+
+  // Driver statistics mix counters and gauges, so they stay untyped and are
+  // told apart by a label
+  name = string(metricPrefix) + "driver_stat";
+  bool hasDriverStats = false;
+  for (const auto &entry : snapshot.interfaces) {
+    if (!entry->driverStatNames)
+      continue;
+    if (!hasDriverStats) {
+      appendMetricHeader(body, name, "untyped",
+                         "Driver or per-queue statistic, with intfMonitor -e");
+      hasDriverStats = true;
+    }
+    const vector<string> &names = *entry->driverStatNames;
+    for (size_t i = 0; i < names.size() && i < entry->driverStats.size();
+         ++i) {
+      body += name;
+      body += '{';
+      appendQuotedLabel(body, "interface", entry->name);
+      body += ',';
+      appendQuotedLabel(body, "stat", names[i]);
+      snprintf(value, sizeof(value), "} %llu\n",
+               (unsigned long long)entry->driverStats[i]);
+      body += value;
+    }
+  }
+
+  // Captured traffic, one sample per interface and class
+  bool hasTraffic = false;
+  for (const auto &entry : snapshot.interfaces)
+    hasTraffic = hasTraffic || entry->hasTraffic;
+  if (!hasTraffic)
+    return;
+
+  for (int counter = 0; counter < 2; ++counter) {
+    bool isBytes = counter == 1;
+    name = string(metricPrefix) +
+           (isBytes ? "traffic_bytes_total" : "traffic_packets_total");
+    appendMetricHeader(body, name, "counter",
+                       isBytes ? "Captured bytes per traffic class, with -c"
+                               : "Captured packets per traffic class, with -c");
+    for (const auto &entry : snapshot.interfaces) {
+      if (!entry->hasTraffic)
+        continue;
+      for (int i = 0; i < TRAFFIC_CLASS_COUNT; ++i) {
+        body += name;
+        body += '{';
+        appendQuotedLabel(body, "interface", entry->name);
+        body += ',';
+        appendQuotedLabel(body, "class", trafficClassName((TRAFFIC_CLASS)i));
+        snprintf(value, sizeof(value), "} %llu\n",
+                 (unsigned long long)(isBytes ? entry->traffic.bytes[i]
+                                              : entry->traffic.packets[i]));
+        body += value;
+      }
+    }
+  }
+
+  name = string(metricPrefix) + "capture_drops_total";
+  appendMetricHeader(body, name, "counter",
+                     "Packets the capture ring had no room for");
+  for (const auto &entry : snapshot.interfaces) {
+    if (!entry->hasTraffic)
+      continue;
+    snprintf(value, sizeof(value), "%llu",
+             (unsigned long long)entry->traffic.captureDrops);
+    appendMetricSample(body, name, entry->name, value);
+  }
+}
@@ -0,0 +1,12 @@
+#ifndef PROMETHEUS_METRICS_H
+#define PROMETHEUS_METRICS_H
+
+#include "StatsSnapshot.h"
+#include <string>
+
+// Content-Type of the Prometheus text exposition format
+extern const char *prometheusContentType;
+
+void renderPrometheusMetrics(const StatsSnapshot &snapshot, std::string &body);
+
+#endif // PROMETHEUS_METRICS_H
@@ -0,0 +1,605 @@
+#include "QueryServer.h"
+#include "PrometheusMetrics.h"
+#include <algorithm>     // For min
+#include <arpa/inet.h>   // For inet_ntop
+#include <cerrno>        // For errno
+#include <cstdarg>       // For va_list
+#include <cstdio>        // For vsnprintf and sscanf
+#include <cstdlib>       // For strtoul
+#include <cstring>       // For memset, strncpy and strncasecmp
+#include <netinet/in.h>  // For sockaddr_in
+#include <sys/epoll.h>   // For epoll_create1, epoll_ctl and epoll_wait
+#include <sys/eventfd.h> // For eventfd
+#include <sys/socket.h>  // For socket, bind, listen and accept4
+#include <sys/uio.h>     // For writev
+#include <sys/un.h>      // For sockaddr_un
+#include <unistd.h>      // For read, write, close and unlink
+
+using namespace std;
+
+// ========== CONSTANTS ==========
+
+// Longest request line, and most unanswered input kept per client
+static const size_t maxQueryLine = 256;
+static const size_t maxQueryInput = 64 * 1024;
+
+// Largest HTTP request head accepted from a scraper
+static const size_t maxHttpHead = 8192;
+
+// Events returned by one epoll_wait() call
+static const int maxQueryEvents = 32;
+
+// ========== HELPER FUNCTIONS ==========
+
+// Append printf-style text to an answer
+static void appendText(string &output, const char *format, ...)
+    __attribute__((format(printf, 2, 3)));
+static void appendText(string &output, const char *format, ...) {
+  char line[512];
+  va_list arguments;
+  va_start(arguments, format);
+  int length = vsnprintf(line, sizeof(line), format, arguments);
+  va_end(arguments);
+  if (length > 0)
+    output.append(line, min<size_t>(length, sizeof(line) - 1));
+}
+
+// Append the latest sample of one interface as a single line
+static void appendStatsLine(string &output, const InterfaceSnapshot &entry,
+                            uint64_t nowNs) {
+  const StatsRecord &record = entry.latest;
+  appendText(output, "%s age_ms=%llu state=%s", entry.name.c_str(),
+             (unsigned long long)((nowNs - entry.timestampNs) / 1000000),
+             (record.flags & STATS_PRESENT) ? operstateName(record.operstate)
+                                            : "missing");
+  for (int i = 0; i < STAT_COUNT; ++i) {
+    appendText(output, " %s=%llu", statName((STAT)i),
+               (unsigned long long)record.counters[i]);
+  }
+  if (record.flags & STATS_RATES_VALID) {
+    for (int i = firstTrafficStat; i < STAT_COUNT; ++i)
+      appendText(output, " %s/s=%.1f", statName((STAT)i), record.rates[i]);
+  }
+  output += '\n';
+}
+
+// Append the recent rates of one interface, one line per sample
+static void appendHistoryLines(string &output, const InterfaceSnapshot &entry,
+                               size_t samples, uint64_t nowNs) {
+  size_t first = entry.history.size() > samples
+                     ? entry.history.size() - samples
+                     : 0;
+  for (size_t i = first; i < entry.history.size(); ++i) {
+    const HistoryPoint &point = entry.history[i];
+    if (!point.isValid)
+      continue;
+    appendText(output,
+               "%s age_ms=%llu rx_bytes/s=%.1f tx_bytes/s=%.1f "
+               "rx_packets/s=%.1f tx_packets/s=%.1f\n",
+               entry.name.c_str(),
+               (unsigned long long)((nowNs - point.timestampNs) / 1000000),
+               point.rates[HISTORY_RX_BYTES], point.rates[HISTORY_TX_BYTES],
+               point.rates[HISTORY_RX_PACKETS],
+               point.rates[HISTORY_TX_PACKETS]);
+  }
+}
+
+// Append the driver and per-queue statistics of one interface, one line each
+static void appendDriverLines(string &output, const InterfaceSnapshot &entry) {
+  if (!entry.driverStatNames)
+    return;
+  const vector<string> &names = *entry.driverStatNames;
+  for (size_t i = 0; i < names.size() && i < entry.driverStats.size(); ++i) {
+    appendText(output, "%s %s=%llu\n", entry.name.c_str(), names[i].c_str(),
+               (unsigned long long)entry.driverStats[i]);
+  }
+}
+
+// Append the captured traffic of one interface, one line per class
+static void appendTrafficLines(string &output, const InterfaceSnapshot &entry) {
+  if (!entry.hasTraffic)
+    return;
+  for (int i = 0; i < TRAFFIC_CLASS_COUNT; ++i) {
+    appendText(output, "%s %s packets=%llu bytes=%llu\n", entry.name.c_str(),
+               trafficClassName((TRAFFIC_CLASS)i),
+               (unsigned long long)entry.traffic.packets[i],
+               (unsigned long long)entry.traffic.bytes[i]);
+  }
+  appendText(output, "%s capture_drops=%llu\n", entry.name.c_str(),
+             (unsigned long long)entry.traffic.captureDrops);
+}
+
+// Append the heaviest flows of one interface, heaviest first
+static void appendFlowLines(string &output, const InterfaceSnapshot &entry) {
+  char source[INET6_ADDRSTRLEN];
+  char destination[INET6_ADDRSTRLEN];
+  for (const auto &flow : entry.topFlows) {
+    int family = flow.key.addressLength == 16 ? AF_INET6 : AF_INET;
+    inet_ntop(family, flow.key.source, source, sizeof(source));
+    inet_ntop(family, flow.key.destination, destination, sizeof(destination));
+    appendText(output,
+               "%s protocol=%u source=%s:%u destination=%s:%u packets=%llu "
+               "bytes=%llu\n",
+               entry.name.c_str(), flow.key.protocol, source,
+               flow.key.sourcePort, destination, flow.key.destinationPort,
+               (unsigned long long)flow.packets,
+               (unsigned long long)flow.bytes);
+  }
+}
+
+// Answer one request line from the current snapshot
+static void answerQuery(const QueryServer &server, const string &line,
+                        string &output) {
+  char command[16] = "";
+  char interface[64] = "";
+  char count[16] = "";
+  sscanf(line.c_str(), "%15s %63s %15s", command, interface, count);
+
+  // The snapshot stays alive, unchanged, for the whole answer
+  shared_ptr<const StatsSnapshot> snapshot = loadSnapshot(*server.publisher);
+  uint64_t nowNs = monotonicTimeNs();
+
+  if (strcmp(command, "STATS") == 0 && interface[0] == '\0') {
+    for (const auto &entry : snapshot->interfaces) {
+      if (entry->timestampNs != 0)
+        appendStatsLine(output, *entry, nowNs);
+    }
+    output += "END\n";
+    return;
+  }
+
+  if (strcmp(command, "STATS") != 0 && strcmp(command, "HISTORY") != 0 &&
+      strcmp(command, "DRIVER") != 0 && strcmp(command, "TRAFFIC") != 0 &&
+      strcmp(command, "FLOWS") != 0) {
+    output += "ERR unknown command\n";
+    return;
+  }
+
+  const InterfaceSnapshot *entry = findInterfaceSnapshot(*snapshot, interface);
+  if (entry == nullptr || entry->timestampNs == 0) {
+    output += "ERR unknown interface\n";
+    return;
+  }
+
+  if (strcmp(command, "STATS") == 0) {
+    appendStatsLine(output, *entry, nowNs);
+  } else if (strcmp(command, "DRIVER") == 0) {
+    appendDriverLines(output, *entry);
+  } else if (strcmp(command, "TRAFFIC") == 0) {
+    appendTrafficLines(output, *entry);
+  } else if (strcmp(command, "FLOWS") == 0) {
+    appendFlowLines(output, *entry);
+  } else {
+    size_t samples = count[0] != '\0' ? strtoul(count, nullptr, 10)
+                                      : snapshotHistory;
+    appendHistoryLines(output, *entry, samples, nowNs);
+  }
+  output += "END\n";
+}
+
+// Stop serving a client and forget it
+static void closeQueryClient(QueryServer &server, int socketFd) {
+  epoll_ctl(server.epollFd, EPOLL_CTL_DEL, socketFd, nullptr);
+  close(socketFd);
+  server.clients.erase(socketFd);
+}
+
+// Request input events until the client stops sending, and EPOLLOUT only
+// while part of an answer is waiting to be written
+static void updateClientEvents(QueryServer &server, QueryClient &client) {
+  bool hasPending = !client.output.empty() || client.body;
+  uint32_t events =
+      (client.isInputClosed ? 0 : (uint32_t)(EPOLLIN | EPOLLRDHUP)) |
+      (hasPending ? (uint32_t)EPOLLOUT : 0);
+  if (events == client.events)
+    return;
+
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = events;
+  event.data.fd = client.socketFd;
+  epoll_ctl(server.epollFd, EPOLL_CTL_MOD, client.socketFd, &event);
+  client.events = events;
+}
+
+// Write as much of the pending answer and cached body as the socket takes.
+// Returns -1 if the client is gone, or was answered and asked to be closed
+static int flushQueryClient(QueryServer &server, QueryClient &client) {
+  size_t bodySize = client.body ? client.body->size() : 0;
+  size_t total = client.output.size() + bodySize;
+  while (client.outputOffset < total) {
+    struct iovec parts[2];
+    int partCount = 0;
+    if (client.outputOffset < client.output.size()) {
+      parts[partCount].iov_base =
+          const_cast<char *>(client.output.data()) + client.outputOffset;
+      parts[partCount++].iov_len = client.output.size() - client.outputOffset;
+    }
+    if (bodySize > 0) {
+      size_t bodyOffset = client.outputOffset > client.output.size()
+                              ? client.outputOffset - client.output.size()
+                              : 0;
+      parts[partCount].iov_base =
+          const_cast<char *>(client.body->data()) + bodyOffset;
+      parts[partCount++].iov_len = bodySize - bodyOffset;
+    }
+
+    ssize_t result = writev(client.socketFd, parts, partCount);
+    if (result < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+        return -1;
+      break;
+    }
+    client.outputOffset += result;
+  }
+
+  bool hasPending = client.outputOffset < total;
+  if (!hasPending) {
+    client.output.clear();
+    client.body.reset();
+    client.outputOffset = 0;
+    if (client.isClosing)
+      return -1;
+  }
+
+  updateClientEvents(server, client);
+  return 0;
+}
+
+// Metrics body of the current snapshot, rendered only when a newer snapshot
+// was published since the last scrape
+static shared_ptr<const string> currentMetricsBody(QueryServer &server) {
+  shared_ptr<const StatsSnapshot> snapshot = loadSnapshot(*server.publisher);
+  if (!server.metricsBody || server.metricsGeneration != snapshot->generation) {
+    auto body = make_shared<string>();
+    renderPrometheusMetrics(*snapshot, *body);
+    server.metricsBody = move(body);
+    server.metricsGeneration = snapshot->generation;
+  }
+  return server.metricsBody;
+}
+
+// Queue an HTTP response head, with a short text body when there is no
+// cached one
+static void appendHttpResponse(QueryClient &client, const char *status,
+                               const char *contentType, size_t contentLength,
+                               const char *extraHeaders) {
+  appendText(client.output,
+             "HTTP/1.1 %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\n"
+             "%s%s\r\n",
+             status, contentType, contentLength, extraHeaders,
+             client.isClosing ? "Connection: close\r\n" : "");
+}
+
+// Answer one HTTP request head; only GET and HEAD of /metrics are served
+static void answerHttpRequest(QueryServer &server, QueryClient &client,
+                              const string &head) {
+  char method[16] = "";
+  char target[256] = "";
+  char version[16] = "";
+  sscanf(head.c_str(), "%15s %255s %15s", method, target, version);
+
+  // HTTP/1.1 keeps the connection open unless asked not to, 1.0 closes it
+  bool keepAlive = strcmp(version, "HTTP/1.1") == 0;
+  for (size_t line = head.find("\r\n"); line != string::npos;
+       line = head.find("\r\n", line + 2)) {
+    const char *header = head.c_str() + line + 2;
+    if (strncasecmp(header, "Connection:", 11) == 0) {
+      const char *value = header + 11;
+      while (*value == ' ')
+        ++value;
+      keepAlive = strncasecmp(value, "close", 5) != 0 &&
+                  (keepAlive || strncasecmp(value, "keep-alive", 10) == 0);
+    }
+  }
+  client.isClosing = !keepAlive;
+
+  if (strncmp(version, "HTTP/1.", 7) != 0) {
+    static const char message[] = "bad request\n";
+    client.isClosing = true;
+    appendHttpResponse(client, "400 Bad Request", "text/plain",
+                       sizeof(message) - 1, "");
+    client.output += message;
+    return;
+  }
+
+  bool isHead = strcmp(method, "HEAD") == 0;
+  if (strcmp(method, "GET") != 0 && !isHead) {
+    static const char message[] = "only GET and HEAD are supported\n";
+    appendHttpResponse(client, "405 Method Not Allowed", "text/plain",
+                       sizeof(message) - 1, "Allow: GET, HEAD\r\n");
+    client.output += message;
+    return;
+  }
+
+  // Query strings are ignored, as scrapers may add their own
+  string path = target;
+  path = path.substr(0, path.find('?'));
+  if (path != "/metrics") {
+    static const char message[] = "not found, try /metrics\n";
+    appendHttpResponse(client, "404 Not Found", "text/plain",
+                       sizeof(message) - 1, "");
+    if (!isHead)
+      client.output += message;
+    return;
+  }
+
+  shared_ptr<const string> body = currentMetricsBody(server);
+  appendHttpResponse(client, "200 OK", prometheusContentType, body->size(),
+                     "");
+  if (!isHead)
+    client.body = move(body);
+}
+
+// Answer every complete request head while the previous responses have been
+// written, then drop clients whose head grows too long
+static int serveHttpClient(QueryServer &server, QueryClient &client) {
+  size_t headEnd;
+  while (client.output.empty() && !client.body && !client.isClosing &&
+         (headEnd = client.input.find("\r\n\r\n")) != string::npos) {
+    string head = client.input.substr(0, headEnd + 2);
+    client.input.erase(0, headEnd + 4);
+    answerHttpRequest(server, client, head);
+    if (flushQueryClient(server, client) < 0)
+      return -1;
+  }
+
+  if (client.input.find("\r\n\r\n") == string::npos &&
+      client.input.size() > maxHttpHead)
+    return -1;
+  return 0;
+}
+
+// Answer every complete line while the previous answers have been written,
+// so a client that never reads cannot make the server buffer without bound
+static int serveQueryLines(QueryServer &server, QueryClient &client) {
+  size_t lineEnd;
+  while (client.output.empty() &&
+         (lineEnd = client.input.find('\n')) != string::npos) {
+    string line = client.input.substr(0, lineEnd);
+    client.input.erase(0, lineEnd + 1);
+    if (!line.empty() && line.back() == '\r')
+      line.pop_back();
+    answerQuery(server, line, client.output);
+    if (flushQueryClient(server, client) < 0)
+      return -1;
+  }
+
+  // A line that never ends or a client that only sends is dropped
+  if (client.input.size() > maxQueryInput ||
+      (client.input.find('\n') == string::npos &&
+       client.input.size() > maxQueryLine))
+    return -1;
+  return 0;
+}
+
+// Answer whatever a client has sent. Returns -1 if it must be closed, which
+// includes a client that stopped sending once everything is answered
+static int serveQueryClient(QueryServer &server, QueryClient &client) {
+  int result = client.isHttp ? serveHttpClient(server, client)
+                             : serveQueryLines(server, client);
+  if (result == 0 && client.isInputClosed && client.output.empty() &&
+      !client.body)
+    return -1;
+  return result;
+}
+
+// Read what a client sent and answer it. Returns -1 if it must be closed
+static int readQueryClient(QueryServer &server, QueryClient &client) {
+  char buffer[4096];
+  while (true) {
+    ssize_t bytesRead = read(client.socketFd, buffer, sizeof(buffer));
+    if (bytesRead > 0) {
+      client.input.append(buffer, bytesRead);
+      if (client.input.size() > maxQueryInput)
+        return -1;
+    } else if (bytesRead == 0) {
+      // Requests already sent are still answered
+      client.isInputClosed = true;
+      updateClientEvents(server, client);
+      break;
+    } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      break;
+    } else if (errno != EINTR) {
+      return -1;
+    }
+  }
+  return serveQueryClient(server, client);
+}
+
+// Accept every pending client connection of one listening socket
+static void acceptQueryClients(QueryServer &server, int listenFd) {
+  while (true) {
+    int socketFd = accept4(listenFd, nullptr, nullptr,
+                           SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (socketFd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      return;
+    }
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN | EPOLLRDHUP;
+    event.data.fd = socketFd;
+    if (epoll_ctl(server.epollFd, EPOLL_CTL_ADD, socketFd, &event) < 0) {
+      close(socketFd);
+      continue;
+    }
+
+    QueryClient &client = server.clients[socketFd];
+    client.socketFd = socketFd;
+    client.input.clear();
+    client.output.clear();
+    client.body.reset();
+    client.outputOffset = 0;
+    client.events = event.events;
+    client.isHttp = listenFd == server.metricsFd;
+    client.isClosing = false;
+    client.isInputClosed = false;
+  }
+}
+
+// Body of the server thread: serve clients until stopFd is signalled
+static void runQueryServer(QueryServer *server) {
+  struct epoll_event events[maxQueryEvents];
+  while (true) {
+    int eventCount = epoll_wait(server->epollFd, events, maxQueryEvents, -1);
+    if (eventCount < 0) {
+      if (errno == EINTR)
+        continue;
+      return;
+    }
+
+    for (int i = 0; i < eventCount; ++i) {
+      int fd = events[i].data.fd;
+      if (fd == server->stopFd)
+        return;
+      if (fd == server->listenFd || fd == server->metricsFd) {
+        acceptQueryClients(*server, fd);
+        continue;
+      }
+
+      auto client = server->clients.find(fd);
+      if (client == server->clients.end())
+        continue;
+
+      // Finish writing earlier answers before reading new requests
+      int result = 0;
+      if (events[i].events & EPOLLOUT)
+        result = flushQueryClient(*server, client->second);
+      if (result == 0 && (events[i].events & (EPOLLIN | EPOLLRDHUP)))
+        result = readQueryClient(*server, client->second);
+      else if (result == 0)
+        result = serveQueryClient(*server, client->second);
+      if (result < 0 || (events[i].events & (EPOLLHUP | EPOLLERR)))
+        closeQueryClient(*server, fd);
+    }
+  }
+}
+
+// Listen for scrapers on a loopback TCP port. Returns the socket, or -1
+static int openMetricsListener(uint16_t port) {
+  int listenFd =
+      socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (listenFd < 0)
+    return -1;
+
+  int reuse = 1;
+  struct sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) <
+          0 ||
+      bind(listenFd, (struct sockaddr *)&address, sizeof(address)) < 0 ||
+      listen(listenFd, SOMAXCONN) < 0) {
+    int savedErrno = errno;
+    close(listenFd);
+    errno = savedErrno;
+    return -1;
+  }
+  return listenFd;
+}
+
+// Watch a listening socket, or the stop eventfd, from the server thread
+static int watchListener(int epollFd, int fd) {
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN;
+  event.data.fd = fd;
+  return epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event);
+}
+
+// ========== CORE FUNCTIONS ==========
+
+// Listen on path, and on metricsPort unless it is 0, and start the thread
+// answering from the snapshots of publisher. Returns -1, with nothing left
+// open, if the query socket could not be set up. A metrics port that could
+// not be opened leaves metricsFd at -1 and its errno in metricsError
+int startQueryServer(QueryServer &server, const char *path,
+                     uint16_t metricsPort, const SnapshotPublisher &publisher) {
+  server.path = path;
+  server.publisher = &publisher;
+  server.clients.clear();
+  server.metricsBody.reset();
+  server.metricsGeneration = 0;
+  server.epollFd = -1;
+  server.stopFd = -1;
+  server.metricsFd = -1;
+  server.metricsError = 0;
+
+  server.listenFd =
+      socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (server.listenFd < 0)
+    return -1;
+
+  struct sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+  unlink(path);
+
+  if (bind(server.listenFd, (struct sockaddr *)&address, sizeof(address)) <
+          0 ||
+      listen(server.listenFd, SOMAXCONN) < 0 ||
+      (server.epollFd = epoll_create1(EPOLL_CLOEXEC)) < 0 ||
+      (server.stopFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0 ||
+      watchListener(server.epollFd, server.listenFd) < 0 ||
+      watchListener(server.epollFd, server.stopFd) < 0) {
+    int savedErrno = errno;
+    if (server.stopFd >= 0)
+      close(server.stopFd);
+    if (server.epollFd >= 0)
+      close(server.epollFd);
+    close(server.listenFd);
+    unlink(path);
+    server.listenFd = -1;
+    errno = savedErrno;
+    return -1;
+  }
+
+  // Queries do not depend on the metrics port, which another process may
+  // hold, so the server goes on without it and the caller reports why
+  if (metricsPort != 0) {
+    server.metricsFd = openMetricsListener(metricsPort);
+    if (server.metricsFd >= 0 &&
+        watchListener(server.epollFd, server.metricsFd) < 0) {
+      int savedErrno = errno;
+      close(server.metricsFd);
+      server.metricsFd = -1;
+      errno = savedErrno;
+    }
+    if (server.metricsFd < 0)
+      server.metricsError = errno;
+  }
+
+  server.thread = thread(runQueryServer, &server);
+  return 0;
+}
+
+// Stop the server thread, close every client and remove the socket
+void stopQueryServer(QueryServer &server) {
+  if (server.listenFd < 0)
+    return;
+
+  uint64_t stop = 1;
+  if (write(server.stopFd, &stop, sizeof(stop)) < 0) {
+    // The eventfd counter cannot overflow from a single write
+  }
+  server.thread.join();
+
+  for (auto &client : server.clients)
+    close(client.first);
+  server.clients.clear();
+  close(server.stopFd);
+  close(server.epollFd);
+  if (server.metricsFd >= 0)
+    close(server.metricsFd);
+  close(server.listenFd);
+  unlink(server.path.c_str());
+  server.listenFd = -1;
+}
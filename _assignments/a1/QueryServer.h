@@ -0,0 +1,58 @@
+#ifndef QUERY_SERVER_H
+#define QUERY_SERVER_H
+
+#include "StatsSnapshot.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+// Line-based query endpoint on a UNIX socket, served by its own thread from
+// the published snapshot so queries never hold up sample ingestion.
+//
+//   STATS              latest sample of every interface
+//   STATS <interface>  latest sample of one interface
+//   HISTORY <interface> [samples]  recent rates, oldest first
+//   DRIVER <interface>  driver and per-queue statistics, with -e
+//   TRAFFIC <interface> packets and bytes per traffic class, with -c
+//   FLOWS <interface>   heaviest flows of the last interval, with -f
+//
+// Every answer ends with a line "END", or is a single "ERR <reason>" line.
+//
+// The same thread serves GET /metrics over HTTP/1.1 on a loopback TCP port,
+// in the Prometheus text format. The body is rendered at most once per
+// published snapshot and shared by every scrape until the next one
+
+// One connected query client
+struct QueryClient {
+  int socketFd;         // Non-blocking client socket
+  std::string input;    // Received bytes not yet forming a full line
+  std::string output;   // Answer bytes not yet written
+  std::shared_ptr<const std::string> body; // Cached body sent after output
+  size_t outputOffset;  // Bytes of output and body already written
+  uint32_t events;      // epoll events currently requested
+  bool isHttp;          // Whether the client scrapes /metrics
+  bool isClosing;       // Close once the answer is written
+  bool isInputClosed;   // Whether the client shut down its sending side
+};
+
+struct QueryServer {
+  std::string path;                   // Path of the listening socket
+  int listenFd;                       // Listening socket
+  int metricsFd;                      // Listening HTTP socket, or -1
+  int metricsError;                   // errno if it could not be opened
+  int epollFd;                        // epoll instance of the server thread
+  int stopFd;                         // eventfd that ends the server thread
+  const SnapshotPublisher *publisher; // Source of every answer
+  std::unordered_map<int, QueryClient> clients; // Server thread only
+  std::shared_ptr<const std::string> metricsBody; // Server thread only
+  uint64_t metricsGeneration;         // Snapshot metricsBody was built from
+  std::thread thread;                 // Thread serving the clients
+};
+
+int startQueryServer(QueryServer &server, const char *path,
+                     uint16_t metricsPort, const SnapshotPublisher &publisher);
+void stopQueryServer(QueryServer &server);
+
+#endif // QUERY_SERVER_H
@@ -0,0 +1,221 @@
+#include "SampleCodec.h"
+#include <cstring> // For memset
+
+using namespace std;
+
+// ========== HELPER FUNCTIONS ==========
+
+// Map a signed change to an unsigned one that stays small when the change
+// is small either way: 0, -1, 1, -2, ... become 0, 1, 2, 3, ...
+static uint64_t zigzagEncode(int64_t value) {
+  return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+// Undo zigzagEncode
+static int64_t zigzagDecode(uint64_t value) {
+  return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+// Skip the fields of a record after its interface id, advancing data and
+// reading its flags byte. Returns -1 if it runs past end
+static int skipRecord(const char *&data, const char *end, uint8_t &flags) {
+  uint64_t value;
+  if (end - data < 3)
+    return -1;
+  flags = *data;
+  data += 3;
+  for (int i = 0; i < 1 + STAT_COUNT; ++i) {
+    if (readVarint(data, end, value) < 0)
+      return -1;
+  }
+  return 0;
+}
+
+// ========== CORE FUNCTIONS ==========
+
+// Append an unsigned integer in 7-bit groups, lowest first, the high bit of
+// each byte telling whether another follows
+void appendVarint(vector<char> &buffer, uint64_t value) {
+  while (value >= 0x80) {
+    buffer.push_back((char)(value | 0x80));
+    value >>= 7;
+  }
+  buffer.push_back((char)value);
+}
+
+// Read an integer written by appendVarint, advancing data. Returns -1 if it
+// runs past end or over 64 bits
+int readVarint(const char *&data, const char *end, uint64_t &value) {
+  value = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    if (data == end)
+      return -1;
+    uint8_t byte = *data++;
+    value |= (uint64_t)(byte & 0x7F) << shift;
+    if (!(byte & 0x80))
+      return 0;
+  }
+  return -1;
+}
+
+// Start encoding for interfaces 0 to interfaceCount - 1, each beginning
+// with a keyframe
+void initSampleEncoder(SampleEncoder &encoder, size_t interfaceCount) {
+  encoder.interfaces.assign(interfaceCount, EncodedInterface());
+  for (auto &state : encoder.interfaces)
+    state.hasPrevious = false;
+}
+
+// Make the next record of every interface a keyframe, e.g. after records
+// were dropped before reaching the decoder
+void requestKeyframes(SampleEncoder &encoder) {
+  for (auto &state : encoder.interfaces)
+    state.hasPrevious = false;
+}
+
+// Append one record to a MSG_DELTA_SAMPLES payload, as a keyframe or as the
+// change since the interface's previous record. The caller writes the count
+// in front of the records
+void encodeSample(SampleEncoder &encoder, uint32_t interfaceId,
+                  uint64_t timestampNs, uint64_t baseNs,
+                  const StatsRecord &record, vector<char> &payload) {
+  if (interfaceId >= encoder.interfaces.size())
+    encoder.interfaces.resize(interfaceId + 1, EncodedInterface());
+  EncodedInterface &state = encoder.interfaces[interfaceId];
+  bool isKeyframe =
+      !state.hasPrevious || state.sinceKeyframe + 1 >= keyframeInterval;
+
+  appendVarint(payload, interfaceId);
+  payload.push_back((char)((record.flags & STATS_PRESENT) |
+                           (isKeyframe ? sampleKeyframe : 0)));
+  payload.push_back((char)record.operstate);
+  state.sequence = state.hasPrevious ? state.sequence + 1 : 0;
+  payload.push_back((char)state.sequence);
+  appendVarint(payload, zigzagEncode((int64_t)(timestampNs - baseNs)));
+
+  // Counters only move forward, unless the interface was recreated
+  for (int i = 0; i < STAT_COUNT; ++i) {
+    if (isKeyframe)
+      appendVarint(payload, record.counters[i]);
+    else
+      appendVarint(payload,
+                   zigzagEncode((int64_t)(record.counters[i] -
+                                          state.counters[i])));
+    state.counters[i] = record.counters[i];
+  }
+  state.sinceKeyframe = isKeyframe ? 0 : state.sinceKeyframe + 1;
+  state.hasPrevious = true;
+}
+
+// Start decoding a new stream, every interface waiting for a keyframe
+void initSampleDecoder(SampleDecoder &decoder) {
+  decoder.interfaces.clear();
+  decoder.discarded = 0;
+}
+
+// Decode a MSG_DELTA_SAMPLES payload into full samples, rates included.
+// Deltas without their previous record are counted in discarded and left
+// out. Returns -1 if the payload is malformed
+int decodeSamples(SampleDecoder &decoder, uint64_t baseNs, const char *payload,
+                  uint32_t length, vector<BatchedSample> &samples) {
+  const char *data = payload;
+  const char *end = payload + length;
+  uint64_t count;
+  samples.clear();
+  if (readVarint(data, end, count) < 0 || count > length)
+    return -1;
+
+  for (uint64_t n = 0; n < count; ++n) {
+    uint64_t interfaceId, timeOffset;
+    if (readVarint(data, end, interfaceId) < 0 || interfaceId > UINT32_MAX ||
+        end - data < 3)
+      return -1;
+    uint8_t flags = *data++;
+    uint8_t operstate = *data++;
+    uint8_t sequence = *data++;
+    if (readVarint(data, end, timeOffset) < 0)
+      return -1;
+
+    uint64_t values[STAT_COUNT];
+    for (int i = 0; i < STAT_COUNT; ++i) {
+      if (readVarint(data, end, values[i]) < 0)
+        return -1;
+    }
+
+    // A delta applies only on top of the record right before it
+    DecodedInterface &state = decoder.interfaces[interfaceId];
+    bool isKeyframe = flags & sampleKeyframe;
+    if (!isKeyframe &&
+        (!state.isSynced || sequence != (uint8_t)(state.sequence + 1))) {
+      state.isSynced = false;
+      ++decoder.discarded;
+      continue;
+    }
+
+    InterfaceCounters current;
+    current.isPresent = flags & STATS_PRESENT;
+    current.timestampNs = baseNs + zigzagDecode(timeOffset);
+    for (int i = 0; i < STAT_COUNT; ++i)
+      current.values[i] = isKeyframe
+                              ? values[i]
+                              : state.previous.values[i] +
+                                    zigzagDecode(values[i]);
+
+    // The first sample of an interface has no rates, as at the source
+    InterfaceRates rates;
+    if (state.previous.timestampNs != 0) {
+      computeInterfaceRates(state.previous, current, rates);
+    } else {
+      memset(&rates, 0, sizeof(rates));
+    }
+
+    BatchedSample sample;
+    memset(&sample, 0, sizeof(sample));
+    sample.interfaceId = interfaceId;
+    sample.timestampNs = current.timestampNs;
+    for (int i = 0; i < STAT_COUNT; ++i) {
+      sample.record.counters[i] = current.values[i];
+      sample.record.rates[i] = rates.values[i];
+    }
+    sample.record.operstate = operstate;
+    sample.record.flags = flags & STATS_PRESENT;
+    if (rates.isValid)
+      sample.record.flags |= STATS_RATES_VALID;
+    if (rates.counterReset)
+      sample.record.flags |= STATS_COUNTER_RESET;
+    samples.push_back(sample);
+
+    state.previous.isPresent = current.isPresent;
+    state.previous.timestampNs = current.timestampNs;
+    memcpy(state.previous.values, current.values, sizeof(current.values));
+    state.sequence = sequence;
+    state.isSynced = true;
+  }
+  return data == end ? 0 : -1;
+}
+
+// List the interfaces of a MSG_DELTA_SAMPLES payload without decoding it,
+// and tell whether every record is a keyframe. Returns -1 if the payload is
+// malformed
+int scanSampleRecords(const char *payload, uint32_t length,
+                      vector<uint32_t> &interfaceIds, bool &isKeyframes) {
+  const char *data = payload;
+  const char *end = payload + length;
+  uint64_t count;
+  interfaceIds.clear();
+  isKeyframes = true;
+  if (readVarint(data, end, count) < 0 || count > length)
+    return -1;
+
+  for (uint64_t n = 0; n < count; ++n) {
+    uint64_t interfaceId;
+    uint8_t flags;
+    if (readVarint(data, end, interfaceId) < 0 ||
+        skipRecord(data, end, flags) < 0)
+      return -1;
+    interfaceIds.push_back(interfaceId);
+    if (!(flags & sampleKeyframe))
+      isKeyframes = false;
+  }
+  return data == end ? 0 : -1;
+}
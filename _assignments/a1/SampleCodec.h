@@ -0,0 +1,70 @@
+#ifndef SAMPLE_CODEC_H
+#define SAMPLE_CODEC_H
+
+#include "MonitorProtocol.h"
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// Compact encoding of StatsRecords for MSG_DELTA_SAMPLES frames. The payload
+// is a varint count followed by that many records:
+//
+//   varint  interfaceId
+//   byte    STATS_PRESENT flag, plus sampleKeyframe on a keyframe
+//   byte    operstate
+//   byte    sequence, counting the interface's records modulo 256
+//   varint  zigzag of the sample time minus the frame header's timestamp
+//   varint  STAT_COUNT counters: the values on a keyframe, otherwise the
+//           zigzag of the change since the interface's previous record
+//
+// Rates are not sent; the decoder derives them from consecutive samples as
+// intfMonitor would. A delta that does not follow the previous record of
+// its interface is discarded until the next keyframe, sent every
+// keyframeInterval records and whenever the encoder is told samples were
+// lost on the way
+
+// Records of an interface between two keyframes
+const uint32_t keyframeInterval = 60;
+
+// Marks a keyframe in the flags byte of a record
+const uint8_t sampleKeyframe = 0x80;
+
+// What the encoder knows of the last record it encoded for an interface
+struct EncodedInterface {
+  uint64_t counters[STAT_COUNT]; // Counters of the previous record
+  uint32_t sinceKeyframe;        // Records since the last keyframe
+  uint8_t sequence;              // Sequence of the previous record
+  bool hasPrevious;              // Whether a record was encoded
+};
+
+struct SampleEncoder {
+  std::vector<EncodedInterface> interfaces; // Indexed by interface id
+};
+
+// What the decoder knows of the last record it accepted for an interface
+struct DecodedInterface {
+  InterfaceCounters previous; // Counters and time of the previous record
+  uint8_t sequence;           // Sequence of the previous record
+  bool isSynced;              // Whether deltas can be applied
+};
+
+struct SampleDecoder {
+  std::unordered_map<uint32_t, DecodedInterface> interfaces; // By id
+  uint64_t discarded; // Deltas dropped while waiting for a keyframe
+};
+
+void initSampleEncoder(SampleEncoder &encoder, size_t interfaceCount);
+void requestKeyframes(SampleEncoder &encoder);
+void encodeSample(SampleEncoder &encoder, uint32_t interfaceId,
+                  uint64_t timestampNs, uint64_t baseNs,
+                  const StatsRecord &record, std::vector<char> &payload);
+void initSampleDecoder(SampleDecoder &decoder);
+int decodeSamples(SampleDecoder &decoder, uint64_t baseNs,
+                  const char *payload, uint32_t length,
+                  std::vector<BatchedSample> &samples);
+int scanSampleRecords(const char *payload, uint32_t length,
+                      std::vector<uint32_t> &interfaceIds, bool &isKeyframes);
+void appendVarint(std::vector<char> &buffer, uint64_t value);
+int readVarint(const char *&data, const char *end, uint64_t &value);
+
+#endif // SAMPLE_CODEC_H
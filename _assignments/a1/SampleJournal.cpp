@@ -0,0 +1,276 @@
+#include "SampleJournal.h"
+#include <algorithm>  // For sort, min
+#include <cerrno>     // For errno
+#include <cinttypes>  // For SCNx64
+#include <cstdio>     // For snprintf, sscanf
+#include <cstring>    // For memcpy, memset, strncpy
+#include <dirent.h>   // For opendir, readdir
+#include <fcntl.h>    // For open, fallocate
+#include <sys/mman.h> // For mmap, munmap
+#include <sys/stat.h> // For mkdir, fstat
+#include <time.h>     // For clock_gettime
+#include <unistd.h>   // For pwrite, close, unlink
+
+using namespace std;
+
+// ========== HELPER FUNCTIONS ==========
+
+// CLOCK_REALTIME minus CLOCK_MONOTONIC, to stamp records with wall time
+static int64_t realtimeOffset() {
+  struct timespec realtime, monotonic;
+  clock_gettime(CLOCK_REALTIME, &realtime);
+  clock_gettime(CLOCK_MONOTONIC, &monotonic);
+  return (int64_t)(realtime.tv_sec - monotonic.tv_sec) * 1000000000LL +
+         (realtime.tv_nsec - monotonic.tv_nsec);
+}
+
+// Number of a segment from its file name. Returns -1 for other files
+static int parseSegmentName(const char *name, uint64_t &segment) {
+  char suffix[16];
+  if (sscanf(name, "segment-%16" SCNx64 ".%15s", &segment, suffix) != 2 ||
+      strcmp(suffix, "journal") != 0)
+    return -1;
+  return 0;
+}
+
+// Write the whole buffer at an offset, retrying on short writes
+static int pwriteAll(int fd, const void *data, size_t length, off_t offset) {
+  const char *bytes = (const char *)data;
+  while (length > 0) {
+    ssize_t written = pwrite(fd, bytes, length, offset);
+    if (written < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    bytes += written;
+    length -= written;
+    offset += written;
+  }
+  return 0;
+}
+
+// Delete the oldest segments until at most keep are left
+static void pruneSegments(const SampleJournal &journal, size_t keep) {
+  vector<string> paths;
+  if (listJournalSegments(journal.directory, paths) < 0)
+    return;
+  for (size_t i = 0; i + keep < paths.size(); ++i)
+    unlink(paths[i].c_str());
+}
+
+// Create the next segment with its full size reserved up front, making room
+// for it under the retention limit first
+static int startSegment(SampleJournal &journal, uint64_t segment) {
+  pruneSegments(journal, journal.maxSegments - 1);
+
+  char name[64];
+  snprintf(name, sizeof(name), "/segment-%016llx.journal",
+           (unsigned long long)segment);
+  string path = journal.directory + name;
+  int fd = open(path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+  if (fd < 0)
+    return -1;
+
+  // Filesystems without fallocate() get a sparse file of the same size
+  off_t size = sizeof(JournalHeader) +
+               journal.segmentRecords * sizeof(JournalRecord);
+  if (fallocate(fd, 0, 0, size) < 0 &&
+      (errno != EOPNOTSUPP || ftruncate(fd, size) < 0)) {
+    int error = errno;
+    close(fd);
+    unlink(path.c_str());
+    errno = error;
+    return -1;
+  }
+
+  memset(&journal.header, 0, sizeof(journal.header));
+  memcpy(journal.header.magic, journalMagic, sizeof(journalMagic));
+  journal.header.recordSize = sizeof(JournalRecord);
+  journal.header.capacity = journal.segmentRecords;
+  journal.header.segment = segment;
+  if (pwriteAll(fd, &journal.header, sizeof(journal.header), 0) < 0) {
+    int error = errno;
+    close(fd);
+    errno = error;
+    return -1;
+  }
+  journal.fd = fd;
+  return 0;
+}
+
+// ========== CORE FUNCTIONS ==========
+
+// Start journaling into directory, creating it if needed. Every run starts a
+// new segment after the existing ones. Returns -1 with errno set on failure
+int openSampleJournal(SampleJournal &journal, const string &directory,
+                      uint64_t segmentRecords, size_t maxSegments) {
+  journal.directory = directory;
+  journal.fd = -1;
+  journal.segmentRecords = max<uint64_t>(segmentRecords, 1);
+  journal.maxSegments = max<size_t>(maxSegments, 1);
+  journal.realtimeOffsetNs = realtimeOffset();
+  journal.pending.clear();
+  if (mkdir(directory.c_str(), 0755) < 0 && errno != EEXIST)
+    return -1;
+
+  vector<string> paths;
+  uint64_t segment = 0;
+  if (listJournalSegments(directory, paths) < 0)
+    return -1;
+  if (!paths.empty()) {
+    string name = paths.back().substr(paths.back().rfind('/') + 1);
+    parseSegmentName(name.c_str(), segment);
+    ++segment;
+  }
+  return startSegment(journal, segment);
+}
+
+// Queue one sample for the next flush, stamped with wall-clock time
+void addJournalRecord(SampleJournal &journal, const string &name,
+                      uint64_t timestampNs, const StatsRecord &record) {
+  if (journal.fd < 0)
+    return;
+  JournalRecord entry;
+  memset(&entry, 0, sizeof(entry));
+  entry.timestampNs = timestampNs + journal.realtimeOffsetNs;
+  strncpy(entry.name, name.c_str(), journalNameSize - 1);
+  memcpy(entry.counters, record.counters, sizeof(entry.counters));
+  entry.operstate = record.operstate;
+  entry.flags = record.flags;
+  journal.pending.push_back(entry);
+}
+
+// Append the queued records with one write per segment they land in, then
+// update the segment header. Returns -1 with errno set on failure, after
+// which the journal stops
+int flushSampleJournal(SampleJournal &journal) {
+  size_t written = 0;
+  bool isFailed = false;
+  while (journal.fd >= 0 && written < journal.pending.size()) {
+    JournalHeader &header = journal.header;
+    if (header.records == header.capacity) {
+      close(journal.fd);
+      journal.fd = -1;
+      if (startSegment(journal, header.segment + 1) < 0) {
+        isFailed = true;
+        break;
+      }
+      continue;
+    }
+
+    size_t count = min<uint64_t>(journal.pending.size() - written,
+                                 header.capacity - header.records);
+    const JournalRecord *first = journal.pending.data() + written;
+    off_t offset =
+        sizeof(JournalHeader) + header.records * sizeof(JournalRecord);
+    if (pwriteAll(journal.fd, first, count * sizeof(JournalRecord), offset) <
+        0) {
+      isFailed = true;
+      break;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+      if (header.firstNs == 0 || first[i].timestampNs < header.firstNs)
+        header.firstNs = first[i].timestampNs;
+      if (first[i].timestampNs > header.lastNs)
+        header.lastNs = first[i].timestampNs;
+    }
+    header.records += count;
+    written += count;
+    if (pwriteAll(journal.fd, &header, sizeof(header), 0) < 0) {
+      isFailed = true;
+      break;
+    }
+  }
+  journal.pending.clear();
+
+  // Follow wall-clock adjustments from one tick to the next
+  journal.realtimeOffsetNs = realtimeOffset();
+  if (!isFailed)
+    return 0;
+  int error = errno;
+  if (journal.fd >= 0)
+    close(journal.fd);
+  journal.fd = -1;
+  errno = error;
+  return -1;
+}
+
+// Write what is queued and close the current segment
+void closeSampleJournal(SampleJournal &journal) {
+  flushSampleJournal(journal);
+  if (journal.fd >= 0)
+    close(journal.fd);
+  journal.fd = -1;
+}
+
+// Paths of every segment in a directory, oldest first. Returns -1 with errno
+// set if the directory cannot be read
+int listJournalSegments(const string &directory, vector<string> &paths) {
+  DIR *journalDir = opendir(directory.c_str());
+  if (journalDir == nullptr)
+    return -1;
+
+  vector<pair<uint64_t, string>> segments;
+  struct dirent *entry;
+  while ((entry = readdir(journalDir)) != nullptr) {
+    uint64_t segment;
+    if (parseSegmentName(entry->d_name, segment) == 0)
+      segments.push_back({segment, directory + "/" + entry->d_name});
+  }
+  closedir(journalDir);
+
+  sort(segments.begin(), segments.end());
+  paths.clear();
+  for (const auto &segment : segments)
+    paths.push_back(segment.second);
+  return 0;
+}
+
+// Map a segment read-only and check its header. Returns -1 with errno set,
+// EINVAL if the file is not a segment this build can read
+int mapJournalSegment(const string &path, JournalSegment &segment) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return -1;
+  struct stat status;
+  if (fstat(fd, &status) < 0) {
+    close(fd);
+    return -1;
+  }
+  if ((size_t)status.st_size < sizeof(JournalHeader)) {
+    close(fd);
+    errno = EINVAL;
+    return -1;
+  }
+
+  void *mapping =
+      mmap(nullptr, status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED)
+    return -1;
+
+  // Never trust a count past the end of the file
+  segment.header = (const JournalHeader *)mapping;
+  segment.records = (const JournalRecord *)(segment.header + 1);
+  segment.mappingSize = status.st_size;
+  uint64_t fits =
+      (status.st_size - sizeof(JournalHeader)) / sizeof(JournalRecord);
+  if (memcmp(segment.header->magic, journalMagic, sizeof(journalMagic)) != 0 ||
+      segment.header->recordSize != sizeof(JournalRecord)) {
+    munmap(mapping, status.st_size);
+    errno = EINVAL;
+    return -1;
+  }
+  segment.count = min(segment.header->records, fits);
+  return 0;
+}
+
+// Unmap a segment mapped with mapJournalSegment
+void unmapJournalSegment(JournalSegment &segment) {
+  munmap((void *)segment.header, segment.mappingSize);
+  segment.header = nullptr;
+  segment.records = nullptr;
+  segment.count = 0;
+}
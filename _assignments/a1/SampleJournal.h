@@ -0,0 +1,81 @@
+#ifndef SAMPLE_JOURNAL_H
+#define SAMPLE_JOURNAL_H
+
+#include "MonitorProtocol.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Append-only journal of every sample networkMonitor receives, kept in a
+// directory of segment files named segment-<number>.journal. A segment is a
+// JournalHeader followed by fixed-size JournalRecords, preallocated with
+// fallocate() when it is created, so appending never grows the file and a
+// reader can mmap it and index records directly. Only the oldest segments
+// beyond the retention limit are ever deleted
+
+// First bytes of every segment
+const char journalMagic[8] = {'N', 'M', 'J', 'O', 'U', 'R', 'N', '1'};
+
+// Longest interface name stored, NUL included
+const size_t journalNameSize = 16;
+
+// Start of a segment. records is rewritten after every batch of appended
+// records, so a reader only trusts the records it counts
+struct JournalHeader {
+  char magic[8];       // journalMagic
+  uint32_t recordSize; // sizeof(JournalRecord) of the writer
+  uint32_t reserved;   // Zero
+  uint64_t capacity;   // Records the segment was preallocated for
+  uint64_t records;    // Records written so far
+  uint64_t firstNs;    // CLOCK_REALTIME time of the earliest record, or 0
+  uint64_t lastNs;     // CLOCK_REALTIME time of the latest record, or 0
+  uint64_t segment;    // Number of the segment, also in its file name
+  uint64_t reserved2;  // Zero, pads the header to 64 bytes
+};
+
+// One sample of one interface. Rates are left out, a reader derives them
+// from consecutive records of the interface
+struct JournalRecord {
+  uint64_t timestampNs;           // CLOCK_REALTIME time of the sample
+  char name[journalNameSize];     // Interface name, NUL-padded
+  uint64_t counters[STAT_COUNT];  // Counter values indexed by STAT
+  uint8_t operstate;              // IF_OPER_* code of the operational state
+  uint8_t flags;                  // STATS_* flags of the sample
+  uint8_t reserved[6];            // Zero, pads the record to 8 bytes
+};
+
+static_assert(sizeof(JournalHeader) == 64, "JournalHeader layout changed");
+static_assert(sizeof(JournalRecord) == 112, "JournalRecord layout changed");
+
+// Writer side, owned by networkMonitor
+struct SampleJournal {
+  std::string directory;               // Directory holding the segments
+  int fd;                              // Segment being appended to, or -1
+  JournalHeader header;                // Header of that segment
+  uint64_t segmentRecords;             // Capacity of new segments
+  size_t maxSegments;                  // Segments kept, the oldest go first
+  int64_t realtimeOffsetNs;            // CLOCK_REALTIME - CLOCK_MONOTONIC
+  std::vector<JournalRecord> pending;  // Records of the current tick
+};
+
+// Reader side, one segment mapped read-only
+struct JournalSegment {
+  const JournalHeader *header;  // Start of the mapping
+  const JournalRecord *records; // First record, right after the header
+  uint64_t count;               // Records the header vouches for
+  size_t mappingSize;           // Size of the mapping
+};
+
+int openSampleJournal(SampleJournal &journal, const std::string &directory,
+                      uint64_t segmentRecords, size_t maxSegments);
+void addJournalRecord(SampleJournal &journal, const std::string &name,
+                      uint64_t timestampNs, const StatsRecord &record);
+int flushSampleJournal(SampleJournal &journal);
+void closeSampleJournal(SampleJournal &journal);
+int listJournalSegments(const std::string &directory,
+                        std::vector<std::string> &paths);
+int mapJournalSegment(const std::string &path, JournalSegment &segment);
+void unmapJournalSegment(JournalSegment &segment);
+
+#endif // SAMPLE_JOURNAL_H
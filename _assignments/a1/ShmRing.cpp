@@ -0,0 +1,168 @@
+#include "ShmRing.h"
+#include <cerrno>        // For errno
+#include <cstring>       // For memcpy
+#include <fcntl.h>       // For fcntl and the F_SEAL_* flags
+#include <new>           // For placement new
+#include <sys/eventfd.h> // For eventfd
+#include <sys/mman.h>    // For memfd_create and mmap
+#include <sys/stat.h>    // For fstat
+#include <unistd.h>      // For ftruncate, write and close
+
+using namespace std;
+
+// ========== CONSTANTS ==========
+
+// Seals a ring's memfd must carry: its size can never change, so the
+// consumer's mapping can never lose pages under it (SIGBUS), and the seals
+// themselves cannot be lifted
+const int ringSeals = F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL;
+
+// ========== HELPER FUNCTIONS ==========
+
+// Bytes reserved for the control block, rounded to a whole cache line
+static size_t headerSize() { return (sizeof(RingHeader) + 63) & ~(size_t)63; }
+
+// Map the memfd and locate the control block and slots
+static int mapShmRing(ShmRing &ring) {
+  void *mapping = mmap(nullptr, ring.mappingSize, PROT_READ | PROT_WRITE,
+                       MAP_SHARED, ring.memFd, 0);
+  if (mapping == MAP_FAILED)
+    return -1;
+
+  ring.header = (RingHeader *)mapping;
+  ring.slots = (char *)mapping + headerSize();
+  return 0;
+}
+
+// ========== CORE FUNCTIONS ==========
+
+// Create a ring with slotCount slots (rounded up to a power of two) of
+// slotSize bytes, backed by a new memfd, plus its wakeup eventfd
+int createShmRing(ShmRing &ring, uint32_t slotCount, uint32_t slotSize) {
+  uint32_t roundedCount = 1;
+  while (roundedCount < slotCount)
+    roundedCount <<= 1;
+
+  ring.header = nullptr;
+  ring.mappingSize = headerSize() + (size_t)roundedCount * slotSize;
+  ring.memFd =
+      memfd_create("intfMonitor-ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  ring.eventFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (ring.memFd < 0 || ring.eventFd < 0 ||
+      ftruncate(ring.memFd, ring.mappingSize) < 0 ||
+      fcntl(ring.memFd, F_ADD_SEALS, ringSeals) < 0 || mapShmRing(ring) < 0) {
+    closeShmRing(ring);
+    return -1;
+  }
+
+  // Construct the control block in the fresh, zero-filled mapping
+  new (ring.header) RingHeader();
+  ring.header->slotCount = roundedCount;
+  ring.header->slotSize = slotSize;
+  ring.slotCount = roundedCount;
+  ring.slotSize = slotSize;
+  return 0;
+}
+
+// Map a ring created by the other process from the descriptors it sent.
+// Only a memfd sealed against resizing is accepted, so its size read here
+// holds for as long as it is mapped
+int attachShmRing(ShmRing &ring, int memFd, int eventFd) {
+  struct stat memStat;
+  ring.header = nullptr;
+  ring.memFd = memFd;
+  ring.eventFd = eventFd;
+
+  int seals = fcntl(memFd, F_GET_SEALS);
+  if (seals < 0 || (seals & ringSeals) != ringSeals) {
+    if (seals >= 0)
+      errno = EPERM;
+    closeShmRing(ring);
+    return -1;
+  }
+  if (fstat(memFd, &memStat) < 0 || (size_t)memStat.st_size < headerSize()) {
+    closeShmRing(ring);
+    return -1;
+  }
+  ring.mappingSize = memStat.st_size;
+  if (mapShmRing(ring) < 0) {
+    closeShmRing(ring);
+    return -1;
+  }
+
+  // Refuse a control block that does not match the mapping. The geometry is
+  // copied so later writes by the other process cannot move slots outside it
+  ring.slotCount = ring.header->slotCount;
+  ring.slotSize = ring.header->slotSize;
+  if (ring.slotCount == 0 || (ring.slotCount & (ring.slotCount - 1)) != 0 ||
+      headerSize() + (size_t)ring.slotCount * ring.slotSize >
+          ring.mappingSize) {
+    errno = EINVAL;
+    closeShmRing(ring);
+    return -1;
+  }
+  return 0;
+}
+
+// Unmap the ring and close its descriptors
+void closeShmRing(ShmRing &ring) {
+  if (ring.header != nullptr)
+    munmap(ring.header, ring.mappingSize);
+  if (ring.memFd >= 0)
+    close(ring.memFd);
+  if (ring.eventFd >= 0)
+    close(ring.eventFd);
+  ring.header = nullptr;
+  ring.memFd = -1;
+  ring.eventFd = -1;
+}
+
+// Producer: copy one record into the next free slot. Returns false, and
+// counts the record as dropped, when the consumer has fallen a full ring
+// behind or the record does not fit a slot
+bool pushShmRing(ShmRing &ring, const void *record, uint32_t length) {
+  RingHeader *header = ring.header;
+  uint64_t head = header->head.load(memory_order_relaxed);
+  uint64_t tail = header->tail.load(memory_order_acquire);
+
+  if (head - tail >= ring.slotCount || length > ring.slotSize) {
+    header->dropped.fetch_add(1, memory_order_relaxed);
+    return false;
+  }
+
+  char *slot = ring.slots + (head & (ring.slotCount - 1)) * ring.slotSize;
+  memcpy(slot, record, length);
+
+  // Publish the slot only once its contents are written
+  header->head.store(head + 1, memory_order_release);
+  return true;
+}
+
+// Producer: wake the consumer once per batch of pushed records
+void notifyShmRing(ShmRing &ring) {
+  uint64_t one = 1;
+  if (write(ring.eventFd, &one, sizeof(one)) < 0) {
+    // EAGAIN means the counter is saturated, the consumer is already awake
+  }
+}
+
+// Consumer: number of published slots, and the index of the first one.
+// A head more than a ring ahead can only come from a corrupt producer, it is
+// clamped so the consumer never reads a slot twice in one drain
+uint64_t readableShmRing(ShmRing &ring, uint64_t &first) {
+  first = ring.header->tail.load(memory_order_relaxed);
+  uint64_t head = ring.header->head.load(memory_order_acquire);
+  uint64_t readable = head - first;
+  return readable > ring.slotCount ? ring.slotCount : readable;
+}
+
+// Consumer: contents of the slot with the given index
+const char *peekShmRing(ShmRing &ring, uint64_t index) {
+  return ring.slots + (index & (ring.slotCount - 1)) * ring.slotSize;
+}
+
+// Consumer: hand count slots back to the producer
+void releaseShmRing(ShmRing &ring, uint64_t count) {
+  uint64_t tail = ring.header->tail.load(memory_order_relaxed);
+  ring.header->tail.store(tail + count, memory_order_release);
+}
@@ -0,0 +1,42 @@
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Single-producer single-consumer ring of fixed-size slots living in a
+// memfd mapping shared by an intfMonitor (producer) and networkMonitor
+// (consumer). An eventfd wakes the consumer; the data never crosses a socket
+
+// Control block at the start of the mapping. head and tail sit on separate
+// cache lines so producer and consumer do not false-share
+struct RingHeader {
+  alignas(64) std::atomic<uint64_t> head; // Next slot the producer writes
+  alignas(64) std::atomic<uint64_t> tail; // Next slot the consumer reads
+  alignas(64) std::atomic<uint64_t> dropped; // Records refused while full
+  uint32_t slotCount;                        // Number of slots, a power of 2
+  uint32_t slotSize;                         // Bytes per slot
+};
+
+// One side's view of a ring
+struct ShmRing {
+  RingHeader *header; // Control block inside the mapping
+  char *slots;        // First slot, right after the control block
+  size_t mappingSize; // Size of the whole mapping
+  uint32_t slotCount; // Local copy of the slot count, validated on attach
+  uint32_t slotSize;  // Local copy of the slot size, validated on attach
+  int memFd;          // memfd backing the mapping
+  int eventFd;        // eventfd used as the consumer's wakeup
+};
+
+int createShmRing(ShmRing &ring, uint32_t slotCount, uint32_t slotSize);
+int attachShmRing(ShmRing &ring, int memFd, int eventFd);
+void closeShmRing(ShmRing &ring);
+bool pushShmRing(ShmRing &ring, const void *record, uint32_t length);
+void notifyShmRing(ShmRing &ring);
+const char *peekShmRing(ShmRing &ring, uint64_t index);
+uint64_t readableShmRing(ShmRing &ring, uint64_t &first);
+void releaseShmRing(ShmRing &ring, uint64_t count);
+
+#endif // SHM_RING_H
@@ -0,0 +1,130 @@
+#include "StatsSnapshot.h"
+#include "InterfaceStats.h"
+#include <algorithm> // For min and lower_bound
+#include <cstring>   // For memset
+#include <memory>    // For atomic_load and atomic_store on shared_ptr
+
+using namespace std;
+
+// ========== CONSTANTS ==========
+
+// Rate column behind each HISTORY_RATE
+static const STAT historyStats[HISTORY_RATE_COUNT] = {
+    STAT_RX_BYTES, STAT_TX_BYTES, STAT_RX_PACKETS, STAT_TX_PACKETS};
+
+// ========== HELPER FUNCTIONS ==========
+
+// Copy the latest sample and the recent history of one series
+static shared_ptr<const InterfaceSnapshot>
+snapshotInterface(const string &name, const InterfaceSeries &series) {
+  auto entry = make_shared<InterfaceSnapshot>();
+  entry->name = name;
+  entry->timestampNs = 0;
+  memset(&entry->latest, 0, sizeof(entry->latest));
+
+  // The names only change with the driver, so every snapshot shares them
+  entry->driverStatNames = series.driverStatNames;
+  entry->driverStats = series.driverStats;
+  entry->hasTraffic = series.hasTraffic;
+  entry->traffic = series.traffic;
+  entry->topFlows = series.topFlows;
+  entry->monitorRestarts = series.monitorRestarts;
+
+  const SampleRing &raw = series.raw;
+  if (raw.count == 0)
+    return entry;
+
+  // Rebuild the wire record of the newest sample from the columns
+  size_t slot = latestSampleIndex(raw, 0);
+  entry->timestampNs = raw.timestamps[slot];
+  entry->latest.flags = raw.flags[slot];
+  entry->latest.operstate = raw.operstates[slot];
+  for (int i = 0; i < STAT_COUNT; ++i) {
+    entry->latest.counters[i] = raw.counters[i][slot];
+    entry->latest.rates[i] = raw.rates[i][slot];
+  }
+
+  // Walk the newest samples from oldest to newest
+  size_t points = min(raw.count, snapshotHistory);
+  entry->history.resize(points);
+  for (size_t age = points; age-- > 0;) {
+    size_t pointSlot = latestSampleIndex(raw, age);
+    HistoryPoint &point = entry->history[points - 1 - age];
+    point.timestampNs = raw.timestamps[pointSlot];
+    point.isValid = raw.flags[pointSlot] & STATS_RATES_VALID;
+    for (int i = 0; i < HISTORY_RATE_COUNT; ++i)
+      point.rates[i] = raw.rates[historyStats[i]][pointSlot];
+  }
+  return entry;
+}
+
+// Order entries by interface name for lookups
+static bool entryBeforeName(const shared_ptr<const InterfaceSnapshot> &entry,
+                            const string &name) {
+  return entry->name < name;
+}
+
+// ========== CORE FUNCTIONS ==========
+
+// Start with an empty snapshot so readers never see a null pointer
+void initSnapshotPublisher(SnapshotPublisher &publisher) {
+  publisher.entries.clear();
+  publisher.changed.clear();
+  publisher.generation = 0;
+
+  auto empty = make_shared<StatsSnapshot>();
+  empty->generation = 0;
+  empty->publishedNs = monotonicTimeNs();
+  atomic_store(&publisher.current,
+               shared_ptr<const StatsSnapshot>(move(empty)));
+}
+
+// Remember that an interface received a sample since the last publish
+void markInterfaceChanged(SnapshotPublisher &publisher, const string &name) {
+  publisher.changed.insert(name);
+}
+
+// Rebuild the entries of changed interfaces, dropping those whose series was
+// erased, and swap in a new snapshot. Returns false, publishing nothing,
+// when no interface changed
+bool publishSnapshot(SnapshotPublisher &publisher,
+                     const TimeSeriesStore &store) {
+  if (publisher.changed.empty())
+    return false;
+
+  for (const string &name : publisher.changed) {
+    const InterfaceSeries *series = findSeries(store, name);
+    if (series != nullptr)
+      publisher.entries[name] = snapshotInterface(name, *series);
+    else
+      publisher.entries.erase(name);
+  }
+  publisher.changed.clear();
+
+  auto snapshot = make_shared<StatsSnapshot>();
+  snapshot->generation = ++publisher.generation;
+  snapshot->publishedNs = monotonicTimeNs();
+  snapshot->interfaces.reserve(publisher.entries.size());
+  for (const auto &entry : publisher.entries)
+    snapshot->interfaces.push_back(entry.second);
+
+  // Readers holding the previous snapshot keep it alive until they are done
+  atomic_store(&publisher.current,
+               shared_ptr<const StatsSnapshot>(move(snapshot)));
+  return true;
+}
+
+// Current snapshot, safe to call from any thread
+shared_ptr<const StatsSnapshot> loadSnapshot(const SnapshotPublisher &publisher) {
+  return atomic_load(&publisher.current);
+}
+
+// Entry of an interface in a snapshot, or nullptr if it has none
+const InterfaceSnapshot *findInterfaceSnapshot(const StatsSnapshot &snapshot,
+                                               const string &name) {
+  auto entry = lower_bound(snapshot.interfaces.begin(),
+                           snapshot.interfaces.end(), name, entryBeforeName);
+  if (entry == snapshot.interfaces.end() || (*entry)->name != name)
+    return nullptr;
+  return entry->get();
+}
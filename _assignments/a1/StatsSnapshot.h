@@ -0,0 +1,78 @@
+#ifndef STATS_SNAPSHOT_H
+#define STATS_SNAPSHOT_H
+
+#include "TimeSeriesStore.h"
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+// Immutable views of the time-series store for readers on other threads.
+// networkMonitor builds a new snapshot once per tick and swaps it in with an
+// atomic shared_ptr store; readers atomically load the pointer and keep the
+// snapshot alive for as long as they use it, so neither side ever waits on
+// the other (RCU-style, the reference count stands in for the grace period)
+
+// Most recent samples kept in a snapshot for history queries
+const size_t snapshotHistory = 60;
+
+// Traffic rates kept per history point
+typedef enum {
+  HISTORY_RX_BYTES,
+  HISTORY_TX_BYTES,
+  HISTORY_RX_PACKETS,
+  HISTORY_TX_PACKETS,
+  HISTORY_RATE_COUNT
+} HISTORY_RATE;
+
+// Rates of one past sample
+struct HistoryPoint {
+  uint64_t timestampNs;              // CLOCK_MONOTONIC time of the sample
+  double rates[HISTORY_RATE_COUNT];  // Rates indexed by HISTORY_RATE
+  bool isValid;                      // Whether the rates were computed
+};
+
+// Latest sample and recent history of one interface
+struct InterfaceSnapshot {
+  std::string name;                 // Interface name
+  uint64_t timestampNs;             // Time of the latest sample
+  StatsRecord latest;               // Latest sample, as received
+  std::vector<HistoryPoint> history; // Up to snapshotHistory, oldest first
+  std::shared_ptr<const std::vector<std::string>> driverStatNames; // Or null
+  std::vector<uint64_t> driverStats; // Latest value of each driver statistic
+  bool hasTraffic;                   // Whether traffic was captured
+  TrafficRecord traffic;             // Latest traffic classes
+  std::vector<FlowRecord> topFlows;  // Heaviest flows, heaviest first
+  uint32_t monitorRestarts;          // Times its monitor died and restarted
+};
+
+// Every interface at one point in time, sorted by name. Entries of
+// interfaces without new samples are shared with the previous snapshot, and
+// an interface marked changed after its series was erased is left out
+struct StatsSnapshot {
+  uint64_t generation;  // Increases with every published snapshot
+  uint64_t publishedNs; // CLOCK_MONOTONIC time it was published
+  std::vector<std::shared_ptr<const InterfaceSnapshot>> interfaces;
+};
+
+// Writer side, owned by the thread that updates the store
+struct SnapshotPublisher {
+  std::shared_ptr<const StatsSnapshot> current; // Only via atomic_load/store
+  std::map<std::string, std::shared_ptr<const InterfaceSnapshot>> entries;
+  std::unordered_set<std::string> changed; // Interfaces with new samples
+  uint64_t generation;                     // Generation of current
+};
+
+void initSnapshotPublisher(SnapshotPublisher &publisher);
+void markInterfaceChanged(SnapshotPublisher &publisher,
+                          const std::string &name);
+bool publishSnapshot(SnapshotPublisher &publisher,
+                     const TimeSeriesStore &store);
+std::shared_ptr<const StatsSnapshot>
+loadSnapshot(const SnapshotPublisher &publisher);
+const InterfaceSnapshot *findInterfaceSnapshot(const StatsSnapshot &snapshot,
+                                               const std::string &name);
+
+#endif // STATS_SNAPSHOT_H
@@ -0,0 +1,144 @@
+#include "SysfsStats.h"
+#include <cerrno>   // For errno
+#include <cstdio>   // For snprintf
+#include <fcntl.h>  // For open
+#include <unistd.h> // For pread and close
+
+using namespace std;
+
+// ========== CONSTANTS ==========
+
+const char *defaultSysfsRoot = "/sys/class/net";
+
+// Path of each counter file relative to <root>/<interface>
+static const char *counterFileNames[STAT_COUNT] = {
+    "carrier_up_count",      "carrier_down_count",   "statistics/tx_bytes",
+    "statistics/rx_bytes",   "statistics/rx_dropped", "statistics/rx_errors",
+    "statistics/tx_packets", "statistics/tx_dropped", "statistics/tx_errors",
+    "statistics/rx_packets"};
+
+// Size of the stack buffer each file is read into
+static const int readBufferSize = 64;
+
+// Maximum length of a statistics file path
+static const int pathSize = 512;
+
+// ========== HELPER FUNCTIONS ==========
+
+// Parse the leading decimal number of a sysfs file without using streams
+static uint64_t parseCounter(const char *text, ssize_t length) {
+  uint64_t value = 0;
+  for (ssize_t i = 0; i < length && text[i] >= '0' && text[i] <= '9'; ++i)
+    value = value * 10 + (text[i] - '0');
+  return value;
+}
+
+// Open one file of the interface directory
+static int openInterfaceFile(const string &directory, const char *fileName) {
+  char statPath[pathSize];
+  snprintf(statPath, sizeof(statPath), "%s/%s", directory.c_str(), fileName);
+  return open(statPath, O_RDONLY | O_CLOEXEC);
+}
+
+// ========== CORE FUNCTIONS ==========
+
+// Prepare the structure for an interface whose files live under root, e.g.
+// /sys/class/net or a synthetic tree, without opening any file yet
+void initSysfsInterface(SysfsInterface &sysfsInterface, const string &name,
+                        const string &root) {
+  sysfsInterface.name = name;
+  sysfsInterface.directory = root + "/" + name;
+  sysfsInterface.operstateFd = -1;
+  for (int i = 0; i < STAT_COUNT; ++i)
+    sysfsInterface.counterFds[i] = -1;
+  sysfsInterface.isOpen = false;
+}
+
+// Open every statistics file of the interface, returns -1 if it is missing
+int openSysfsInterface(SysfsInterface &sysfsInterface) {
+  sysfsInterface.operstateFd =
+      openInterfaceFile(sysfsInterface.directory, "operstate");
+  if (sysfsInterface.operstateFd < 0)
+    return -1;
+
+  for (int i = 0; i < STAT_COUNT; ++i) {
+    sysfsInterface.counterFds[i] =
+        openInterfaceFile(sysfsInterface.directory, counterFileNames[i]);
+
+    // carrier_*_count do not exist on older kernels, every other file must
+    if (sysfsInterface.counterFds[i] < 0 && i != STAT_CARRIER_UP_COUNT &&
+        i != STAT_CARRIER_DOWN_COUNT) {
+      closeSysfsInterface(sysfsInterface);
+      return -1;
+    }
+  }
+
+  sysfsInterface.isOpen = true;
+  return 0;
+}
+
+// Close every statistics file of the interface
+void closeSysfsInterface(SysfsInterface &sysfsInterface) {
+  if (sysfsInterface.operstateFd >= 0)
+    close(sysfsInterface.operstateFd);
+  sysfsInterface.operstateFd = -1;
+
+  for (int i = 0; i < STAT_COUNT; ++i) {
+    if (sysfsInterface.counterFds[i] >= 0)
+      close(sysfsInterface.counterFds[i]);
+    sysfsInterface.counterFds[i] = -1;
+  }
+  sysfsInterface.isOpen = false;
+}
+
+// Re-read every statistics file from offset 0, reopening them if the
+// interface disappeared and came back. operstate is skipped unless requested,
+// for callers that track it from link notifications. Returns -1 if the
+// interface is missing
+int readSysfsInterface(SysfsInterface &sysfsInterface,
+                       InterfaceCounters &counters, bool readOperstate) {
+  char buffer[readBufferSize];
+
+  clearInterfaceCounters(counters);
+
+  // The files are only reopened once the interface exists again
+  if (!sysfsInterface.isOpen && openSysfsInterface(sysfsInterface) < 0)
+    return -1;
+
+  ssize_t bytesRead;
+  if (readOperstate) {
+    // ENODEV means the interface was removed, drop the stale descriptors
+    bytesRead = pread(sysfsInterface.operstateFd, buffer, sizeof(buffer), 0);
+    if (bytesRead < 0 && errno == ENODEV) {
+      closeSysfsInterface(sysfsInterface);
+      return -1;
+    }
+
+    // Strip the trailing newline from the state name
+    while (bytesRead > 0 &&
+           (buffer[bytesRead - 1] == '\n' || buffer[bytesRead - 1] == ' '))
+      --bytesRead;
+    if (bytesRead > 0)
+      counters.operstate.assign(buffer, bytesRead);
+  }
+
+  for (int i = 0; i < STAT_COUNT; ++i) {
+    if (sysfsInterface.counterFds[i] < 0)
+      continue;
+
+    bytesRead = pread(sysfsInterface.counterFds[i], buffer, sizeof(buffer), 0);
+    if (bytesRead < 0) {
+      if (errno == ENODEV) {
+        closeSysfsInterface(sysfsInterface);
+        clearInterfaceCounters(counters);
+        return -1;
+      }
+      continue;
+    }
+    counters.values[i] = parseCounter(buffer, bytesRead);
+  }
+
+  counters.timestampNs = monotonicTimeNs();
+  counters.isPresent = true;
+  return 0;
+}
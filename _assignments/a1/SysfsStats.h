@@ -0,0 +1,26 @@
+#ifndef SYSFS_STATS_H
+#define SYSFS_STATS_H
+
+#include "InterfaceStats.h"
+#include <string>
+
+// Directory the kernel lists network interfaces in
+extern const char *defaultSysfsRoot;
+
+// Statistics files of one interface, opened once and re-read with pread()
+struct SysfsInterface {
+  std::string name;           // Interface name, e.g. "eth0"
+  std::string directory;      // Directory of its files, <root>/<name>
+  int operstateFd;            // Descriptor of the operstate file
+  int counterFds[STAT_COUNT]; // Descriptor of each counter file
+  bool isOpen;                // Whether the descriptors are currently valid
+};
+
+void initSysfsInterface(SysfsInterface &sysfsInterface, const std::string &name,
+                        const std::string &root);
+int openSysfsInterface(SysfsInterface &sysfsInterface);
+void closeSysfsInterface(SysfsInterface &sysfsInterface);
+int readSysfsInterface(SysfsInterface &sysfsInterface,
+                       InterfaceCounters &counters, bool readOperstate);
+
+#endif // SYSFS_STATS_H
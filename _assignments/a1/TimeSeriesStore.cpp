@@ -0,0 +1,265 @@
+#include "TimeSeriesStore.h"
+#include <algorithm> // For min and max
+#include <limits>    // For numeric_limits
+
+using namespace std;
+
+// ========== CONSTANTS ==========
+
+// Width and retention of each rollup: 1 hour of 10 s buckets, 1 day of
+// 1 min buckets and 1 week of 1 h buckets
+static const uint64_t nsPerSecond = 1000000000ULL;
+static const uint64_t rollupWidthsNs[ROLLUP_COUNT] = {
+    10 * nsPerSecond, 60 * nsPerSecond, 3600 * nsPerSecond};
+static const size_t rollupCapacities[ROLLUP_COUNT] = {360, 1440, 168};
+
+// ========== HELPER FUNCTIONS ==========
+
+// Set up an empty full-resolution ring. Columns grow with the samples until
+// they reach the capacity, so idle or young interfaces stay small
+static void initSampleRing(SampleRing &raw, size_t capacity) {
+  raw.capacity = capacity;
+  raw.count = 0;
+  raw.next = 0;
+  raw.timestamps.clear();
+  raw.flags.clear();
+  raw.operstates.clear();
+  for (int i = 0; i < STAT_COUNT; ++i) {
+    raw.counters[i].clear();
+    raw.rates[i].clear();
+  }
+}
+
+// Set up an empty rollup ring, whose columns grow like the sample ring's
+static void initRollupRing(RollupRing &rollup, uint64_t widthNs,
+                           size_t capacity) {
+  rollup.widthNs = widthNs;
+  rollup.capacity = capacity;
+  rollup.count = 0;
+  rollup.next = 0;
+  rollup.starts.clear();
+  rollup.samples.clear();
+  for (int i = 0; i < STAT_COUNT; ++i) {
+    rollup.minimum[i].clear();
+    rollup.maximum[i].clear();
+    rollup.sum[i].clear();
+    rollup.last[i].clear();
+  }
+}
+
+// Slot of the bucket or sample that is age entries older than the newest
+static size_t slotByAge(size_t next, size_t capacity, size_t age) {
+  return (next + capacity - 1 - age) % capacity;
+}
+
+// Fold the rates of one sample into the bucket covering its timestamp,
+// opening a new bucket (and overwriting the oldest) when it starts a new one
+static void addToRollup(RollupRing &rollup, uint64_t timestampNs,
+                        const StatsRecord &record) {
+  uint64_t bucketStart = timestampNs - timestampNs % rollup.widthNs;
+  size_t slot = slotByAge(rollup.next, rollup.capacity, 0);
+
+  if (rollup.count == 0 || rollup.starts[slot] != bucketStart) {
+    // Samples older than the open bucket are ignored rather than reordered
+    if (rollup.count > 0 && bucketStart < rollup.starts[slot])
+      return;
+
+    slot = rollup.next;
+    rollup.next = (rollup.next + 1) % rollup.capacity;
+    rollup.count = min(rollup.count + 1, rollup.capacity);
+
+    // Until the ring first wraps, the new bucket is one past the end
+    if (slot == rollup.starts.size()) {
+      rollup.starts.push_back(0);
+      rollup.samples.push_back(0);
+      for (int i = 0; i < STAT_COUNT; ++i) {
+        rollup.minimum[i].push_back(0);
+        rollup.maximum[i].push_back(0);
+        rollup.sum[i].push_back(0);
+        rollup.last[i].push_back(0);
+      }
+    }
+    rollup.starts[slot] = bucketStart;
+    rollup.samples[slot] = 0;
+    for (int i = 0; i < STAT_COUNT; ++i) {
+      rollup.minimum[i][slot] = numeric_limits<double>::max();
+      rollup.maximum[i][slot] = numeric_limits<double>::lowest();
+      rollup.sum[i][slot] = 0;
+    }
+  }
+
+  ++rollup.samples[slot];
+  for (int i = 0; i < STAT_COUNT; ++i) {
+    double rate = record.rates[i];
+    rollup.minimum[i][slot] = min(rollup.minimum[i][slot], rate);
+    rollup.maximum[i][slot] = max(rollup.maximum[i][slot], rate);
+    rollup.sum[i][slot] += rate;
+    rollup.last[i][slot] = rate;
+  }
+}
+
+// Add one value, or one bucket of values, to a running aggregate whose sum
+// is kept apart until the average can be computed
+static void accumulate(RangeAggregate &result, double &rangeSum,
+                       double minimum, double maximum, double sum,
+                       uint64_t samples, double last) {
+  if (result.samples == 0) {
+    result.minimum = minimum;
+    result.maximum = maximum;
+  } else {
+    result.minimum = min(result.minimum, minimum);
+    result.maximum = max(result.maximum, maximum);
+  }
+  rangeSum += sum;
+  result.samples += samples;
+  result.last = last;
+}
+
+// ========== CORE FUNCTIONS ==========
+
+// Prepare an empty store keeping rawCapacity full-resolution samples per
+// interface; memory per interface is bounded by the ring capacities
+void initTimeSeriesStore(TimeSeriesStore &store, size_t rawCapacity) {
+  store.rawCapacity = rawCapacity;
+  store.interfaces.clear();
+}
+
+// Series of an interface, created empty on first use. The reference stays
+// valid while the store lives
+InterfaceSeries &seriesForInterface(TimeSeriesStore &store,
+                                    const string &name) {
+  auto existing = store.interfaces.find(name);
+  if (existing != store.interfaces.end())
+    return existing->second;
+
+  InterfaceSeries &series = store.interfaces[name];
+  initSampleRing(series.raw, store.rawCapacity);
+  for (int i = 0; i < ROLLUP_COUNT; ++i)
+    initRollupRing(series.rollups[i], rollupWidthsNs[i], rollupCapacities[i]);
+  series.hasTraffic = false;
+  series.monitorRestarts = 0;
+  return series;
+}
+
+// Series of an interface, or nullptr if nothing was stored for it
+const InterfaceSeries *findSeries(const TimeSeriesStore &store,
+                                  const string &name) {
+  auto existing = store.interfaces.find(name);
+  return existing != store.interfaces.end() ? &existing->second : nullptr;
+}
+
+// Forget everything stored for an interface. Pointers to its series are no
+// longer valid afterwards
+void eraseSeries(TimeSeriesStore &store, const string &name) {
+  store.interfaces.erase(name);
+}
+
+// Time of the newest full-resolution sample of a series, 0 if it has none
+uint64_t newestSampleNs(const InterfaceSeries &series) {
+  if (series.raw.count == 0)
+    return 0;
+  return series.raw.timestamps[latestSampleIndex(series.raw, 0)];
+}
+
+// Time the coarsest rollup reaches back, the longest any sample is retained
+uint64_t longestRetentionNs() {
+  uint64_t longest = 0;
+  for (int i = 0; i < ROLLUP_COUNT; ++i)
+    longest = max<uint64_t>(longest, rollupWidthsNs[i] * rollupCapacities[i]);
+  return longest;
+}
+
+// Store one sample at full resolution and fold its rates into every rollup
+void appendSample(InterfaceSeries &series, uint64_t timestampNs,
+                  const StatsRecord &record) {
+  SampleRing &raw = series.raw;
+  size_t slot = raw.next;
+  raw.next = (raw.next + 1) % raw.capacity;
+  raw.count = min(raw.count + 1, raw.capacity);
+
+  // Until the ring first wraps, the new sample is one past the end
+  if (slot == raw.timestamps.size()) {
+    raw.timestamps.push_back(0);
+    raw.flags.push_back(0);
+    raw.operstates.push_back(0);
+    for (int i = 0; i < STAT_COUNT; ++i) {
+      raw.counters[i].push_back(0);
+      raw.rates[i].push_back(0);
+    }
+  }
+
+  raw.timestamps[slot] = timestampNs;
+  raw.flags[slot] = record.flags;
+  raw.operstates[slot] = record.operstate;
+  for (int i = 0; i < STAT_COUNT; ++i) {
+    raw.counters[i][slot] = record.counters[i];
+    raw.rates[i][slot] = record.rates[i];
+  }
+
+  // Only samples with valid rates contribute to the rate rollups
+  if (record.flags & STATS_RATES_VALID) {
+    for (int i = 0; i < ROLLUP_COUNT; ++i)
+      addToRollup(series.rollups[i], timestampNs, record);
+  }
+}
+
+// Slot of the full-resolution sample that is age samples older than the
+// newest one; age must be below raw.count
+size_t latestSampleIndex(const SampleRing &raw, size_t age) {
+  return slotByAge(raw.next, raw.capacity, age);
+}
+
+// Aggregate one rate over [fromNs, toNs]. The full-resolution samples are
+// used while they reach back to fromNs, otherwise the finest rollup that
+// does. Returns false when no sample falls in the range
+bool aggregateRange(const InterfaceSeries &series, STAT stat, uint64_t fromNs,
+                    uint64_t toNs, RangeAggregate &result) {
+  result = RangeAggregate{0, 0, 0, 0, 0};
+  double rangeSum = 0;
+  const SampleRing &raw = series.raw;
+
+  bool rawCovers =
+      raw.count > 0 &&
+      raw.timestamps[latestSampleIndex(raw, raw.count - 1)] <= fromNs;
+
+  if (rawCovers) {
+    // Walk the timestamp column from oldest to newest
+    for (size_t age = raw.count; age-- > 0;) {
+      size_t slot = latestSampleIndex(raw, age);
+      uint64_t timestampNs = raw.timestamps[slot];
+      if (timestampNs < fromNs || timestampNs > toNs ||
+          !(raw.flags[slot] & STATS_RATES_VALID))
+        continue;
+      double rate = raw.rates[stat][slot];
+      accumulate(result, rangeSum, rate, rate, rate, 1, rate);
+    }
+  } else {
+    // Pick the finest rollup whose retention reaches back to fromNs
+    const RollupRing *rollup = &series.rollups[ROLLUP_COUNT - 1];
+    for (int i = 0; i < ROLLUP_COUNT; ++i) {
+      const RollupRing &candidate = series.rollups[i];
+      if (candidate.count > 0 &&
+          candidate.starts[slotByAge(candidate.next, candidate.capacity,
+                                     candidate.count - 1)] <= fromNs) {
+        rollup = &candidate;
+        break;
+      }
+    }
+
+    // Buckets overlapping the range contribute as a whole
+    for (size_t age = rollup->count; age-- > 0;) {
+      size_t slot = slotByAge(rollup->next, rollup->capacity, age);
+      uint64_t start = rollup->starts[slot];
+      if (start + rollup->widthNs <= fromNs || start > toNs)
+        continue;
+      accumulate(result, rangeSum, rollup->minimum[stat][slot],
+                 rollup->maximum[stat][slot], rollup->sum[stat][slot],
+                 rollup->samples[slot], rollup->last[stat][slot]);
+    }
+  }
+
+  if (result.samples == 0)
+    return false;
+  result.average = rangeSum / result.samples;
+  return true;
+}
@@ -0,0 +1,84 @@
+#ifndef TIME_SERIES_STORE_H
+#define TIME_SERIES_STORE_H
+
+#include "MonitorProtocol.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Resolutions pre-aggregated alongside the full-resolution samples
+typedef enum { ROLLUP_10S, ROLLUP_1MIN, ROLLUP_1H, ROLLUP_COUNT } ROLLUP;
+
+// Full-resolution samples of one interface in bounded rings. Every field is
+// its own column so a scan of one metric reads contiguous memory
+struct SampleRing {
+  size_t capacity;                         // Samples kept before overwriting
+  size_t count;                            // Samples currently held
+  size_t next;                             // Slot the next sample goes to
+  std::vector<uint64_t> timestamps;        // CLOCK_MONOTONIC sample times
+  std::vector<uint64_t> counters[STAT_COUNT]; // One column per counter
+  std::vector<double> rates[STAT_COUNT];   // One column per rate
+  std::vector<uint8_t> flags;              // STATS_* flags of each sample
+  std::vector<uint8_t> operstates;         // IF_OPER_* state of each sample
+};
+
+// Bounded number of buckets of one width, each holding min, max, sum, count
+// and last of every rate. The newest bucket is still being filled
+struct RollupRing {
+  uint64_t widthNs;                        // Time covered by one bucket
+  size_t capacity;                         // Buckets kept before overwriting
+  size_t count;                            // Buckets currently held
+  size_t next;                             // Slot the next bucket goes to
+  std::vector<uint64_t> starts;            // Start time of each bucket
+  std::vector<uint32_t> samples;           // Samples aggregated per bucket
+  std::vector<double> minimum[STAT_COUNT]; // Smallest rate per bucket
+  std::vector<double> maximum[STAT_COUNT]; // Largest rate per bucket
+  std::vector<double> sum[STAT_COUNT];     // Sum of rates, for the average
+  std::vector<double> last[STAT_COUNT];    // Latest rate per bucket
+};
+
+// Everything stored for one interface
+struct InterfaceSeries {
+  SampleRing raw;                     // Full-resolution samples
+  RollupRing rollups[ROLLUP_COUNT];   // Pre-aggregated resolutions
+  std::shared_ptr<const std::vector<std::string>> driverStatNames; // With -e
+  std::vector<uint64_t> driverStats;  // Latest driver values, no history
+  bool hasTraffic;                    // Whether traffic was captured, -c
+  TrafficRecord traffic;              // Latest traffic classes, no history
+  std::vector<FlowRecord> topFlows;   // Heaviest flows of the last interval
+  uint32_t monitorRestarts;           // Times its monitor died and restarted
+};
+
+// Aggregate of one rate over a time range
+struct RangeAggregate {
+  double minimum;   // Smallest rate in the range
+  double maximum;   // Largest rate in the range
+  double average;   // Mean rate in the range
+  double last;      // Latest rate in the range
+  uint64_t samples; // Samples the aggregate covers, 0 if none
+};
+
+// Series of every interface, keyed by interface name
+struct TimeSeriesStore {
+  size_t rawCapacity; // Full-resolution samples kept per interface
+  std::unordered_map<std::string, InterfaceSeries> interfaces;
+};
+
+void initTimeSeriesStore(TimeSeriesStore &store, size_t rawCapacity);
+InterfaceSeries &seriesForInterface(TimeSeriesStore &store,
+                                    const std::string &name);
+const InterfaceSeries *findSeries(const TimeSeriesStore &store,
+                                  const std::string &name);
+void eraseSeries(TimeSeriesStore &store, const std::string &name);
+uint64_t newestSampleNs(const InterfaceSeries &series);
+uint64_t longestRetentionNs();
+void appendSample(InterfaceSeries &series, uint64_t timestampNs,
+                  const StatsRecord &record);
+bool aggregateRange(const InterfaceSeries &series, STAT stat,
+                    uint64_t fromNs, uint64_t toNs, RangeAggregate &result);
+size_t latestSampleIndex(const SampleRing &raw, size_t age);
+
+#endif // TIME_SERIES_STORE_H
@@ -0,0 +1,469 @@
+#include "UpstreamForwarder.h"
+#include <algorithm>     // For min
+#include <cerrno>        // For errno
+#include <cstring>       // For memset
+#include <netdb.h>       // For getaddrinfo
+#include <netinet/in.h>  // For IPPROTO_TCP
+#include <netinet/tcp.h> // For TCP_NODELAY
+#include <sys/epoll.h>   // For epoll_ctl
+#include <sys/timerfd.h> // For timerfd_create and timerfd_settime
+#include <sys/uio.h>     // For iovec
+#include <time.h>        // For clock_gettime
+#include <unistd.h>      // For close, read and gethostname
+
+using namespace std;
+
+// ========== CONSTANTS ==========
+
+// Wait before the first reconnection attempt, doubled after every failure
+// up to the maximum and reset by the first acknowledgement
+const uint64_t upstreamRetryMs = 1000;
+const uint64_t maxUpstreamRetryMs = 30000;
+
+// Frames handed to a single sendmsg()
+const int maxUpstreamVectors = 64;
+
+// Bytes read from the collector at once
+const size_t upstreamReadSize = 4096;
+
+// ========== HELPER FUNCTIONS ==========
+
+// Split host:port, [address]:port or a bare host, which gets the default port
+static int splitTarget(const string &target, string &host, string &port) {
+  size_t colon = target.rfind(':');
+  size_t bracket = target.rfind(']');
+  if (colon == string::npos || (bracket != string::npos && colon < bracket)) {
+    host = target;
+    port = to_string(defaultUpstreamPort);
+  } else {
+    host = target.substr(0, colon);
+    port = target.substr(colon + 1);
+  }
+  if (host.size() >= 2 && host.front() == '[' && host.back() == ']')
+    host = host.substr(1, host.size() - 2);
+  return host.empty() || port.empty() ? -1 : 0;
+}
+
+// CLOCK_REALTIME minus CLOCK_MONOTONIC, to send sample times a collector on
+// another host can use
+static int64_t realtimeOffset() {
+  struct timespec realtime, monotonic;
+  clock_gettime(CLOCK_REALTIME, &realtime);
+  clock_gettime(CLOCK_MONOTONIC, &monotonic);
+  return (int64_t)(realtime.tv_sec - monotonic.tv_sec) * 1000000000LL +
+         (realtime.tv_nsec - monotonic.tv_nsec);
+}
+
+// Fire the connection timer once, delayMs from now
+static void armRetryTimer(UpstreamForwarder &forwarder, uint64_t delayMs) {
+  struct itimerspec timer;
+  memset(&timer, 0, sizeof(timer));
+  timer.it_value.tv_sec = delayMs / 1000;
+  timer.it_value.tv_nsec = delayMs % 1000 * 1000000 + 1;
+  timerfd_settime(forwarder.timerFd, 0, &timer, nullptr);
+}
+
+// Whether bytes are waiting to be written on the connection
+static bool hasUnsentBytes(const UpstreamForwarder &forwarder) {
+  return forwarder.helloOffset < forwarder.hello.size() ||
+         forwarder.nextToSend < forwarder.replay.size();
+}
+
+// Ask for EPOLLOUT only while connecting or while bytes are waiting
+static int updateEvents(UpstreamForwarder &forwarder) {
+  uint32_t events = EPOLLIN;
+  if (!forwarder.isConnected || hasUnsentBytes(forwarder))
+    events |= EPOLLOUT;
+  if (events == forwarder.events)
+    return 0;
+
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = events;
+  event.data.fd = forwarder.socketFd;
+  if (epoll_ctl(forwarder.epollFd, EPOLL_CTL_MOD, forwarder.socketFd,
+                &event) < 0)
+    return -1;
+  forwarder.events = events;
+  return 0;
+}
+
+// Drop the connection and schedule the next attempt, backing off while the
+// collector keeps failing
+static UPSTREAM_EVENT failConnection(UpstreamForwarder &forwarder, int error) {
+  if (forwarder.socketFd >= 0)
+    close(forwarder.socketFd);
+  forwarder.socketFd = -1;
+  forwarder.isConnected = false;
+  forwarder.lastError = error;
+  forwarder.hello.clear();
+  forwarder.input.clear();
+  forwarder.retryDelayMs =
+      forwarder.retryDelayMs == 0
+          ? upstreamRetryMs
+          : min(forwarder.retryDelayMs * 2, maxUpstreamRetryMs);
+  armRetryTimer(forwarder, forwarder.retryDelayMs);
+  return UPSTREAM_DISCONNECTED;
+}
+
+// Write the hello and as many snapshots as the socket accepts without
+// blocking, several per sendmsg(). Returns 0 once everything is written, 1
+// if the socket is full and -1 on error
+static int flushUpstream(UpstreamForwarder &forwarder) {
+  int result = 0;
+  while (hasUnsentBytes(forwarder)) {
+    struct iovec vectors[maxUpstreamVectors];
+    int count = 0;
+    if (forwarder.helloOffset < forwarder.hello.size()) {
+      vectors[count].iov_base = forwarder.hello.data() + forwarder.helloOffset;
+      vectors[count].iov_len = forwarder.hello.size() - forwarder.helloOffset;
+      ++count;
+    }
+    for (size_t i = forwarder.nextToSend;
+         i < forwarder.replay.size() && count < maxUpstreamVectors; ++i) {
+      size_t skip = i == forwarder.nextToSend ? forwarder.sendOffset : 0;
+      vectors[count].iov_base = forwarder.replay[i].data.data() + skip;
+      vectors[count].iov_len = forwarder.replay[i].data.size() - skip;
+      ++count;
+    }
+
+    // MSG_NOSIGNAL turns a collector that went away into EPIPE, not SIGPIPE
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = vectors;
+    message.msg_iovlen = count;
+    ssize_t sent =
+        sendmsg(forwarder.socketFd, &message, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (sent < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+        return -1;
+      result = 1;
+      break;
+    }
+
+    // Advance past the hello, then past every snapshot written in full
+    size_t written = sent;
+    size_t helloLeft = forwarder.hello.size() - forwarder.helloOffset;
+    size_t fromHello = min(written, helloLeft);
+    forwarder.helloOffset += fromHello;
+    written -= fromHello;
+    while (written > 0) {
+      UpstreamFrame &frame = forwarder.replay[forwarder.nextToSend];
+      size_t left = frame.data.size() - forwarder.sendOffset;
+      if (written < left) {
+        forwarder.sendOffset += written;
+        break;
+      }
+      written -= left;
+      forwarder.sendOffset = 0;
+      forwarder.sentSequence = max(forwarder.sentSequence, frame.sequence);
+      ++forwarder.nextToSend;
+    }
+  }
+  return updateEvents(forwarder) < 0 ? -1 : result;
+}
+
+// Greet the collector on a new connection and queue every unacknowledged
+// snapshot behind the hello, oldest first
+static UPSTREAM_EVENT completeConnection(UpstreamForwarder &forwarder) {
+  forwarder.isConnected = true;
+  forwarder.hello.clear();
+  appendUpstreamHeader(forwarder.hello, UPSTREAM_HELLO, 0, 0);
+  appendUint64(forwarder.hello, forwarder.sessionId);
+  forwarder.hello.insert(forwarder.hello.end(), forwarder.hostName.begin(),
+                         forwarder.hostName.end());
+  finishUpstreamFrame(forwarder.hello, 0);
+  forwarder.helloOffset = 0;
+  forwarder.input.clear();
+
+  // Frames that made it out on an earlier connection are replays
+  for (const auto &frame : forwarder.replay) {
+    if (frame.sequence > forwarder.sentSequence)
+      break;
+    ++forwarder.replayed;
+  }
+  forwarder.nextToSend = 0;
+  forwarder.sendOffset = 0;
+  if (flushUpstream(forwarder) < 0)
+    return failConnection(forwarder, errno);
+  return UPSTREAM_CONNECTED;
+}
+
+// Start a non-blocking connection to the collector
+static UPSTREAM_EVENT connectCollector(UpstreamForwarder &forwarder) {
+  forwarder.socketFd =
+      socket(forwarder.address.ss_family,
+             SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (forwarder.socketFd < 0)
+    return failConnection(forwarder, errno);
+
+  // Frames are already batched, so Nagle would only add latency; keepalive
+  // notices a collector host that vanished without a reset
+  int enable = 1;
+  setsockopt(forwarder.socketFd, IPPROTO_TCP, TCP_NODELAY, &enable,
+             sizeof(enable));
+  setsockopt(forwarder.socketFd, SOL_SOCKET, SO_KEEPALIVE, &enable,
+             sizeof(enable));
+
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN | EPOLLOUT;
+  event.data.fd = forwarder.socketFd;
+  forwarder.isConnected = false;
+  forwarder.events = event.events;
+  if (epoll_ctl(forwarder.epollFd, EPOLL_CTL_ADD, forwarder.socketFd,
+                &event) < 0)
+    return failConnection(forwarder, errno);
+
+  if (connect(forwarder.socketFd, (struct sockaddr *)&forwarder.address,
+              forwarder.addressLength) == 0)
+    return completeConnection(forwarder);
+  if (errno == EINPROGRESS)
+    return UPSTREAM_UNCHANGED;
+  return failConnection(forwarder, errno);
+}
+
+// Release the snapshots the collector has, except one being written
+static void applyAck(UpstreamForwarder &forwarder, uint64_t sequence) {
+  forwarder.ackedSequence = max(forwarder.ackedSequence, sequence);
+  while (!forwarder.replay.empty() &&
+         forwarder.replay.front().sequence <= sequence &&
+         !(forwarder.nextToSend == 0 && forwarder.sendOffset > 0)) {
+    forwarder.replayBytes -= forwarder.replay.front().data.size();
+    forwarder.replay.pop_front();
+    if (forwarder.nextToSend > 0)
+      --forwarder.nextToSend;
+  }
+
+  // A collector that answers is healthy again
+  forwarder.retryDelayMs = 0;
+}
+
+// Read the acknowledgements that arrived. Returns -1 with errno set if the
+// connection is closed or the collector sends anything else
+static int readAcks(UpstreamForwarder &forwarder) {
+  char chunk[upstreamReadSize];
+  while (true) {
+    ssize_t received = recv(forwarder.socketFd, chunk, sizeof(chunk),
+                            MSG_DONTWAIT);
+    if (received < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        break;
+      return -1;
+    }
+    if (received == 0) {
+      errno = ECONNRESET;
+      return -1;
+    }
+    forwarder.input.insert(forwarder.input.end(), chunk, chunk + received);
+  }
+
+  size_t offset = 0;
+  UpstreamHeader header;
+  const char *payload;
+  int result;
+  while ((result = extractUpstreamFrame(forwarder.input, offset, header,
+                                        payload)) > 0) {
+    if (header.type != UPSTREAM_ACK) {
+      errno = EPROTO;
+      return -1;
+    }
+    applyAck(forwarder, header.sequence);
+  }
+  if (result < 0) {
+    errno = EPROTO;
+    return -1;
+  }
+  forwarder.input.erase(forwarder.input.begin(),
+                        forwarder.input.begin() + offset);
+  return 0;
+}
+
+// ========== CORE FUNCTIONS ==========
+
+// Resolve target, a host and optional port, and start connecting to it from
+// epollFd's loop, keeping up to replayCapacity bytes of unacknowledged
+// snapshots. Returns -1 with a description in error if target is unusable
+int startUpstreamForwarder(UpstreamForwarder &forwarder, int epollFd,
+                           const string &target, size_t replayCapacity,
+                           string &error) {
+  forwarder.target = target;
+  forwarder.epollFd = epollFd;
+  forwarder.socketFd = -1;
+  forwarder.timerFd = -1;
+  forwarder.isConnected = false;
+  forwarder.events = 0;
+  forwarder.hello.clear();
+  forwarder.helloOffset = 0;
+  forwarder.replay.clear();
+  forwarder.replayBytes = 0;
+  forwarder.replayCapacity = replayCapacity;
+  forwarder.nextToSend = 0;
+  forwarder.sendOffset = 0;
+  forwarder.input.clear();
+  forwarder.nextSequence = 1;
+  forwarder.sentSequence = 0;
+  forwarder.ackedSequence = 0;
+  forwarder.retryDelayMs = 0;
+  forwarder.lastError = 0;
+  forwarder.forwarded = 0;
+  forwarder.replayed = 0;
+  forwarder.dropped = 0;
+
+  string host, port;
+  if (splitTarget(target, host, port) < 0) {
+    error = "expected host[:port]";
+    return -1;
+  }
+
+  // Resolved once, so a slow resolver never stalls the event loop later
+  struct addrinfo hints, *addresses;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  int status = getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses);
+  if (status != 0) {
+    error = gai_strerror(status);
+    return -1;
+  }
+  memcpy(&forwarder.address, addresses->ai_addr, addresses->ai_addrlen);
+  forwarder.addressLength = addresses->ai_addrlen;
+  freeaddrinfo(addresses);
+
+  char name[256] = "";
+  gethostname(name, sizeof(name) - 1);
+  forwarder.hostName = name;
+  forwarder.sessionId = monotonicTimeNs() + realtimeOffset();
+
+  // The first attempt goes through the timer like every retry
+  forwarder.timerFd =
+      timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN;
+  event.data.fd = forwarder.timerFd;
+  if (forwarder.timerFd < 0 ||
+      epoll_ctl(epollFd, EPOLL_CTL_ADD, forwarder.timerFd, &event) < 0) {
+    error = strerror(errno);
+    if (forwarder.timerFd >= 0)
+      close(forwarder.timerFd);
+    forwarder.timerFd = -1;
+    return -1;
+  }
+  armRetryTimer(forwarder, 0);
+  return 0;
+}
+
+// Encode the latest sample of every interface in a snapshot, keep it for
+// replay and write it if connected. The oldest unacknowledged snapshots are
+// dropped when the replay buffer is full
+UPSTREAM_EVENT forwardSnapshot(UpstreamForwarder &forwarder,
+                               const StatsSnapshot &snapshot) {
+  int64_t offsetNs = realtimeOffset();
+  UpstreamFrame frame;
+  frame.sequence = forwarder.nextSequence++;
+  appendUpstreamHeader(frame.data, UPSTREAM_SNAPSHOT, frame.sequence, 0);
+  appendUint64(frame.data, snapshot.publishedNs + offsetNs);
+
+  uint32_t count = 0;
+  for (const auto &entry : snapshot.interfaces)
+    count += entry->timestampNs != 0;
+  appendUint32(frame.data, count);
+
+  UpstreamInterface upstream;
+  for (const auto &entry : snapshot.interfaces) {
+    if (entry->timestampNs == 0)
+      continue;
+    upstream.name = entry->name;
+    upstream.timestampNs = entry->timestampNs + offsetNs;
+    for (int i = 0; i < STAT_COUNT; ++i) {
+      upstream.counters[i] = entry->latest.counters[i];
+      upstream.rates[i] = entry->latest.rates[i];
+    }
+    upstream.operstate = entry->latest.operstate;
+    upstream.flags = entry->latest.flags;
+    appendUpstreamInterface(frame.data, upstream);
+  }
+  finishUpstreamFrame(frame.data, 0);
+
+  forwarder.replayBytes += frame.data.size();
+  forwarder.replay.push_back(move(frame));
+  ++forwarder.forwarded;
+
+  // Make room without touching a frame halfway through being written, and
+  // always keep the new one
+  while (forwarder.replayBytes > forwarder.replayCapacity) {
+    size_t victim =
+        (forwarder.nextToSend == 0 && forwarder.sendOffset > 0) ? 1 : 0;
+    if (victim + 1 >= forwarder.replay.size())
+      break;
+    forwarder.replayBytes -= forwarder.replay[victim].data.size();
+    forwarder.replay.erase(forwarder.replay.begin() + victim);
+    if (victim < forwarder.nextToSend)
+      --forwarder.nextToSend;
+    ++forwarder.dropped;
+  }
+
+  if (forwarder.isConnected && flushUpstream(forwarder) < 0)
+    return failConnection(forwarder, errno);
+  return UPSTREAM_UNCHANGED;
+}
+
+// Whether epoll reported one of the forwarder's descriptors
+bool isUpstreamDescriptor(const UpstreamForwarder &forwarder, int fd) {
+  return fd >= 0 && (fd == forwarder.socketFd || fd == forwarder.timerFd);
+}
+
+// Handle epoll events of a forwarder descriptor: a due connection attempt,
+// a connection completing, acknowledgements or room to write
+UPSTREAM_EVENT handleUpstreamEvent(UpstreamForwarder &forwarder, int fd,
+                                   uint32_t events) {
+  if (fd == forwarder.timerFd) {
+    uint64_t expirations;
+    if (read(forwarder.timerFd, &expirations, sizeof(expirations)) > 0 &&
+        forwarder.socketFd < 0)
+      return connectCollector(forwarder);
+    return UPSTREAM_UNCHANGED;
+  }
+
+  // Events of a connection closed earlier in the same epoll_wait() batch
+  if (fd != forwarder.socketFd)
+    return UPSTREAM_UNCHANGED;
+
+  if (!forwarder.isConnected) {
+    if (!(events & (EPOLLOUT | EPOLLERR | EPOLLHUP)))
+      return UPSTREAM_UNCHANGED;
+    int error = 0;
+    socklen_t length = sizeof(error);
+    if (getsockopt(forwarder.socketFd, SOL_SOCKET, SO_ERROR, &error,
+                   &length) < 0)
+      error = errno;
+    if (error != 0)
+      return failConnection(forwarder, error);
+    return completeConnection(forwarder);
+  }
+
+  if ((events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && readAcks(forwarder) < 0)
+    return failConnection(forwarder, errno);
+  if ((events & EPOLLOUT) && flushUpstream(forwarder) < 0)
+    return failConnection(forwarder, errno);
+  return UPSTREAM_UNCHANGED;
+}
+
+// Write what the socket takes without waiting, then close everything.
+// Unacknowledged snapshots are lost
+void stopUpstreamForwarder(UpstreamForwarder &forwarder) {
+  if (forwarder.isConnected)
+    flushUpstream(forwarder);
+  if (forwarder.socketFd >= 0)
+    close(forwarder.socketFd);
+  if (forwarder.timerFd >= 0)
+    close(forwarder.timerFd);
+  forwarder.socketFd = -1;
+  forwarder.timerFd = -1;
+  forwarder.isConnected = false;
+}
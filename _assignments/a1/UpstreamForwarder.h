@@ -0,0 +1,75 @@
+#ifndef UPSTREAM_FORWARDER_H
+#define UPSTREAM_FORWARDER_H
+
+#include "StatsSnapshot.h"
+#include "UpstreamProtocol.h"
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <sys/socket.h>
+#include <vector>
+
+// Forwards every published snapshot to a central collector over one
+// persistent TCP connection, driven from networkMonitor's epoll loop.
+// Snapshots are written as soon as they are published, several per
+// sendmsg() when the socket was busy, without waiting for the collector's
+// acknowledgements. Each stays in a replay buffer until acknowledged, and
+// the whole buffer is sent again after a reconnect, so a collector restart
+// or network blip loses nothing unless the buffer overflows, in which case
+// the oldest snapshots go first
+
+// Result of handling a forwarder event, for the caller to report
+typedef enum {
+  UPSTREAM_UNCHANGED,   // Still connected, or still disconnected
+  UPSTREAM_CONNECTED,   // The connection was just established
+  UPSTREAM_DISCONNECTED // The connection failed or was lost; lastError tells
+                        // why and retryDelayMs when it is tried again
+} UPSTREAM_EVENT;
+
+// One encoded snapshot waiting for its acknowledgement
+struct UpstreamFrame {
+  uint64_t sequence;      // Sequence in the frame header
+  std::vector<char> data; // Header and payload
+};
+
+struct UpstreamForwarder {
+  std::string target;               // host:port, as given
+  struct sockaddr_storage address;  // Resolved address of the collector
+  socklen_t addressLength;          // Bytes of address used
+  std::string hostName;             // Name of this host, sent in the hello
+  uint64_t sessionId;               // Start time of this run, in the hello
+  int epollFd;                      // epoll instance the descriptors are in
+  int socketFd;                     // Connection to the collector, or -1
+  int timerFd;                      // Timer of the next connection attempt
+  bool isConnected;                 // Whether connect() completed
+  uint32_t events;                  // epoll events requested for socketFd
+  std::vector<char> hello;          // Hello of the current connection
+  size_t helloOffset;               // Bytes of hello already written
+  std::deque<UpstreamFrame> replay; // Unacknowledged snapshots, oldest first
+  size_t replayBytes;               // Bytes of every frame in replay
+  size_t replayCapacity;            // Most bytes replay may hold
+  size_t nextToSend;                // First frame of replay not fully sent
+  size_t sendOffset;                // Bytes of that frame already sent
+  std::vector<char> input;          // Received bytes not forming a frame
+  uint64_t nextSequence;            // Sequence of the next snapshot
+  uint64_t sentSequence;            // Highest sequence written in full
+  uint64_t ackedSequence;           // Highest sequence acknowledged
+  uint64_t retryDelayMs;            // Wait before the next attempt
+  int lastError;                    // errno of the last failure
+  uint64_t forwarded;               // Snapshots queued since the start
+  uint64_t replayed;                // Snapshots sent again on reconnect
+  uint64_t dropped;                 // Snapshots the buffer had no room for
+};
+
+int startUpstreamForwarder(UpstreamForwarder &forwarder, int epollFd,
+                           const std::string &target, size_t replayCapacity,
+                           std::string &error);
+UPSTREAM_EVENT forwardSnapshot(UpstreamForwarder &forwarder,
+                               const StatsSnapshot &snapshot);
+bool isUpstreamDescriptor(const UpstreamForwarder &forwarder, int fd);
+UPSTREAM_EVENT handleUpstreamEvent(UpstreamForwarder &forwarder, int fd,
+                                   uint32_t events);
+void stopUpstreamForwarder(UpstreamForwarder &forwarder);
+
+#endif // UPSTREAM_FORWARDER_H
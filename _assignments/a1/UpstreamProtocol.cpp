@@ -0,0 +1,152 @@
+#include "UpstreamProtocol.h"
+#include <algorithm> // For min
+#include <cstring>   // For memcpy
+#include <endian.h>  // For htobe64 and be64toh
+
+using namespace std;
+
+// ========== CORE FUNCTIONS ==========
+
+// Append an integer in network byte order
+void appendUint16(vector<char> &buffer, uint16_t value) {
+  uint16_t wire = htobe16(value);
+  buffer.insert(buffer.end(), (const char *)&wire,
+                (const char *)&wire + sizeof(wire));
+}
+
+// Append an integer in network byte order
+void appendUint32(vector<char> &buffer, uint32_t value) {
+  uint32_t wire = htobe32(value);
+  buffer.insert(buffer.end(), (const char *)&wire,
+                (const char *)&wire + sizeof(wire));
+}
+
+// Append an integer in network byte order
+void appendUint64(vector<char> &buffer, uint64_t value) {
+  uint64_t wire = htobe64(value);
+  buffer.insert(buffer.end(), (const char *)&wire,
+                (const char *)&wire + sizeof(wire));
+}
+
+// Read an integer written by appendUint16, advancing data. Returns -1 if it
+// runs past end
+int readUint16(const char *&data, const char *end, uint16_t &value) {
+  if (end - data < (ptrdiff_t)sizeof(value))
+    return -1;
+  memcpy(&value, data, sizeof(value));
+  value = be16toh(value);
+  data += sizeof(value);
+  return 0;
+}
+
+// Read an integer written by appendUint32, advancing data. Returns -1 if it
+// runs past end
+int readUint32(const char *&data, const char *end, uint32_t &value) {
+  if (end - data < (ptrdiff_t)sizeof(value))
+    return -1;
+  memcpy(&value, data, sizeof(value));
+  value = be32toh(value);
+  data += sizeof(value);
+  return 0;
+}
+
+// Read an integer written by appendUint64, advancing data. Returns -1 if it
+// runs past end
+int readUint64(const char *&data, const char *end, uint64_t &value) {
+  if (end - data < (ptrdiff_t)sizeof(value))
+    return -1;
+  memcpy(&value, data, sizeof(value));
+  value = be64toh(value);
+  data += sizeof(value);
+  return 0;
+}
+
+// Append a frame header. A payload of unknown length can be appended after
+// it and the length filled in with finishUpstreamFrame
+void appendUpstreamHeader(vector<char> &buffer, UPSTREAM_TYPE type,
+                          uint64_t sequence, uint32_t length) {
+  appendUint32(buffer, length);
+  appendUint16(buffer, upstreamVersion);
+  appendUint16(buffer, type);
+  appendUint64(buffer, sequence);
+}
+
+// Write the length of the frame starting at frameStart, now that its payload
+// runs to the end of the buffer
+void finishUpstreamFrame(vector<char> &buffer, size_t frameStart) {
+  uint32_t length =
+      htobe32(buffer.size() - frameStart - upstreamHeaderSize);
+  memcpy(buffer.data() + frameStart, &length, sizeof(length));
+}
+
+// Extract the next complete frame starting at offset in a reassembly buffer.
+// Returns 1 and advances offset when a frame was extracted, 0 when more bytes
+// are needed and -1 when the stream is corrupt
+int extractUpstreamFrame(const vector<char> &buffer, size_t &offset,
+                         UpstreamHeader &header, const char *&payload) {
+  if (buffer.size() - offset < upstreamHeaderSize)
+    return 0;
+
+  const char *data = buffer.data() + offset;
+  const char *end = data + upstreamHeaderSize;
+  readUint32(data, end, header.length);
+  readUint16(data, end, header.version);
+  readUint16(data, end, header.type);
+  readUint64(data, end, header.sequence);
+  if (header.version != upstreamVersion || header.length > maxUpstreamPayload)
+    return -1;
+
+  if (buffer.size() - offset - upstreamHeaderSize < header.length)
+    return 0;
+
+  payload = buffer.data() + offset + upstreamHeaderSize;
+  offset += upstreamHeaderSize + header.length;
+  return 1;
+}
+
+// Append one interface of an UPSTREAM_SNAPSHOT payload
+void appendUpstreamInterface(vector<char> &buffer,
+                             const UpstreamInterface &entry) {
+  size_t nameLength = min<size_t>(entry.name.size(), 255);
+  buffer.push_back((char)nameLength);
+  buffer.insert(buffer.end(), entry.name.begin(),
+                entry.name.begin() + nameLength);
+  buffer.push_back((char)entry.operstate);
+  buffer.push_back((char)entry.flags);
+  appendUint64(buffer, entry.timestampNs);
+  for (int i = 0; i < STAT_COUNT; ++i)
+    appendUint64(buffer, entry.counters[i]);
+  for (int i = 0; i < STAT_COUNT; ++i) {
+    uint64_t bits;
+    memcpy(&bits, &entry.rates[i], sizeof(bits));
+    appendUint64(buffer, bits);
+  }
+}
+
+// Read an interface written by appendUpstreamInterface, advancing data.
+// Returns -1 if it runs past end
+int readUpstreamInterface(const char *&data, const char *end,
+                          UpstreamInterface &entry) {
+  if (end - data < 1)
+    return -1;
+  size_t nameLength = (uint8_t)*data++;
+  if ((size_t)(end - data) < nameLength + 2)
+    return -1;
+  entry.name.assign(data, nameLength);
+  data += nameLength;
+  entry.operstate = *data++;
+  entry.flags = *data++;
+  if (readUint64(data, end, entry.timestampNs) < 0)
+    return -1;
+  for (int i = 0; i < STAT_COUNT; ++i) {
+    if (readUint64(data, end, entry.counters[i]) < 0)
+      return -1;
+  }
+  for (int i = 0; i < STAT_COUNT; ++i) {
+    uint64_t bits;
+    if (readUint64(data, end, bits) < 0)
+      return -1;
+    memcpy(&entry.rates[i], &bits, sizeof(bits));
+  }
+  return 0;
+}
@@ -0,0 +1,80 @@
+#ifndef UPSTREAM_PROTOCOL_H
+#define UPSTREAM_PROTOCOL_H
+
+#include "InterfaceStats.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Frames networkMonitor forwards to a central collector over TCP, and the
+// acknowledgements the collector sends back. Unlike MonitorProtocol.h the
+// two ends run on different hosts, so every integer is written in network
+// byte order, field by field, and every double as its IEEE 754 bits
+//
+//   forwarder -> collector  UPSTREAM_HELLO once per connection, then one
+//                           UPSTREAM_SNAPSHOT per tick, without waiting for
+//                           acknowledgements
+//   collector -> forwarder  UPSTREAM_ACK with the highest sequence received
+//                           of the session, in answer to the hello and then
+//                           at most once per batch of frames it reads
+//
+// Sequences start at 1 in every session, i.e. every run of networkMonitor,
+// so a collector tells replayed snapshots from new ones and notices the
+// snapshots a forwarder had to drop
+
+// Version of the frame layout, bumped whenever a payload changes
+const uint16_t upstreamVersion = 1;
+
+// Port a collector listens on unless told otherwise
+const uint16_t defaultUpstreamPort = 9512;
+
+// Largest payload a receiver accepts before dropping the connection
+const uint32_t maxUpstreamPayload = 16 << 20;
+
+// Bytes of the header in front of every frame: length, version, type and
+// sequence
+const size_t upstreamHeaderSize = 16;
+
+// Kind of payload carried by a frame
+typedef enum : uint16_t {
+  UPSTREAM_HELLO = 1,    // Payload is the session id and host name
+  UPSTREAM_SNAPSHOT = 2, // Payload is the tick time and UpstreamInterfaces
+  UPSTREAM_ACK = 3       // No payload, the header carries the sequence
+} UPSTREAM_TYPE;
+
+// Header in front of every frame, once decoded
+struct UpstreamHeader {
+  uint32_t length;   // Payload bytes following the header
+  uint16_t version;  // upstreamVersion of the sender
+  uint16_t type;     // UPSTREAM_TYPE of the payload
+  uint64_t sequence; // Snapshot sequence, or the one acknowledged
+};
+
+// Latest sample of one interface in a snapshot
+struct UpstreamInterface {
+  std::string name;              // Interface name, at most 255 bytes
+  uint64_t timestampNs;          // CLOCK_REALTIME time of the sample
+  uint64_t counters[STAT_COUNT]; // Counter values indexed by STAT
+  double rates[STAT_COUNT];      // Per-second rates indexed by STAT
+  uint8_t operstate;             // IF_OPER_* code of the operational state
+  uint8_t flags;                 // STATS_* flags of the sample
+};
+
+void appendUint16(std::vector<char> &buffer, uint16_t value);
+void appendUint32(std::vector<char> &buffer, uint32_t value);
+void appendUint64(std::vector<char> &buffer, uint64_t value);
+int readUint16(const char *&data, const char *end, uint16_t &value);
+int readUint32(const char *&data, const char *end, uint32_t &value);
+int readUint64(const char *&data, const char *end, uint64_t &value);
+void appendUpstreamHeader(std::vector<char> &buffer, UPSTREAM_TYPE type,
+                          uint64_t sequence, uint32_t length);
+void finishUpstreamFrame(std::vector<char> &buffer, size_t frameStart);
+int extractUpstreamFrame(const std::vector<char> &buffer, size_t &offset,
+                         UpstreamHeader &header, const char *&payload);
+void appendUpstreamInterface(std::vector<char> &buffer,
+                             const UpstreamInterface &entry);
+int readUpstreamInterface(const char *&data, const char *end,
+                          UpstreamInterface &entry);
+
+#endif // UPSTREAM_PROTOCOL_H
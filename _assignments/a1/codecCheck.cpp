@@ -0,0 +1,197 @@
+#include "SampleCodec.h"
+#include <cstdint>  // For UINT64_MAX
+#include <cstdlib>  // For EXIT_SUCCESS and EXIT_FAILURE
+#include <cstring>  // For memset
+#include <iostream> // For cout and cerr
+#include <vector>   // For vector
+
+using namespace std;
+
+// ========== CONSTANTS ==========
+
+// Time of the first sample and distance between two, in nanoseconds
+const uint64_t checkStartNs = 1000000000ULL;
+const uint64_t checkIntervalNs = 1000000000ULL;
+
+// Samples sent in a row, enough for the sequence byte to wrap twice
+const int sequenceWrapSamples = 600;
+
+// ========== FUNCTION DEFINITIONS ==========
+
+vector<char> encodeTick(SampleEncoder &encoder, int tick, uint64_t value);
+int decodeTick(SampleDecoder &decoder, const vector<char> &payload,
+               vector<BatchedSample> &samples);
+bool isDelta(const vector<char> &payload);
+bool hasCounters(const vector<BatchedSample> &samples, uint64_t value);
+bool checkCounterReset();
+bool checkWraparound();
+bool checkSequenceWrap();
+bool checkDroppedBase();
+
+// ========== HELPER FUNCTIONS ==========
+
+// Encode one sample of interface 0 at the given tick as a MSG_DELTA_SAMPLES
+// payload. Counter i holds value + i, so every counter moves alike
+vector<char> encodeTick(SampleEncoder &encoder, int tick, uint64_t value) {
+  StatsRecord record;
+  memset(&record, 0, sizeof(record));
+  record.flags = STATS_PRESENT;
+  for (int i = 0; i < STAT_COUNT; ++i)
+    record.counters[i] = value + i;
+
+  vector<char> payload;
+  appendVarint(payload, 1);
+  encodeSample(encoder, 0, checkStartNs + tick * checkIntervalNs, checkStartNs,
+               record, payload);
+  return payload;
+}
+
+// Decode a payload made by encodeTick
+int decodeTick(SampleDecoder &decoder, const vector<char> &payload,
+               vector<BatchedSample> &samples) {
+  return decodeSamples(decoder, checkStartNs, payload.data(), payload.size(),
+                       samples);
+}
+
+// Whether the record of a payload was sent as a delta
+bool isDelta(const vector<char> &payload) {
+  vector<uint32_t> interfaceIds;
+  bool isKeyframes;
+  return scanSampleRecords(payload.data(), payload.size(), interfaceIds,
+                           isKeyframes) == 0 &&
+         !isKeyframes;
+}
+
+// Whether a single sample came out with the counters encodeTick put in
+bool hasCounters(const vector<BatchedSample> &samples, uint64_t value) {
+  if (samples.size() != 1)
+    return false;
+  for (int i = 0; i < STAT_COUNT; ++i) {
+    if (samples[0].record.counters[i] != value + i)
+      return false;
+  }
+  return true;
+}
+
+// ========== CORE FUNCTIONS ==========
+
+// A counter going backwards, as when an interface is recreated, is sent as
+// a negative delta and flagged as a reset
+bool checkCounterReset() {
+  const uint64_t values[] = {1000, 250000, 5, 20};
+  SampleEncoder encoder;
+  SampleDecoder decoder;
+  initSampleEncoder(encoder, 1);
+  initSampleDecoder(decoder);
+
+  vector<BatchedSample> samples;
+  for (int tick = 0; tick < 4; ++tick) {
+    vector<char> payload = encodeTick(encoder, tick, values[tick]);
+    if ((tick > 0 && !isDelta(payload)) ||
+        decodeTick(decoder, payload, samples) < 0 ||
+        !hasCounters(samples, values[tick]))
+      return false;
+    bool isReset = samples[0].record.flags & STATS_COUNTER_RESET;
+    if (isReset != (tick == 2))
+      return false;
+  }
+  return decoder.discarded == 0;
+}
+
+// Counters near UINT64_MAX wrap around, and changes of up to half the range
+// either way, 2^63 included, come back exactly
+bool checkWraparound() {
+  const uint64_t values[] = {UINT64_MAX - 10 - STAT_COUNT,
+                             UINT64_MAX - STAT_COUNT,
+                             3,
+                             UINT64_MAX - STAT_COUNT,
+                             (1ULL << 63) - STAT_COUNT - 1,
+                             UINT64_MAX - STAT_COUNT,
+                             0};
+  const int valueCount = sizeof(values) / sizeof(values[0]);
+  SampleEncoder encoder;
+  SampleDecoder decoder;
+  initSampleEncoder(encoder, 1);
+  initSampleDecoder(decoder);
+
+  vector<BatchedSample> samples;
+  for (int tick = 0; tick < valueCount; ++tick) {
+    vector<char> payload = encodeTick(encoder, tick, values[tick]);
+    if ((tick > 0 && !isDelta(payload)) ||
+        decodeTick(decoder, payload, samples) < 0 ||
+        !hasCounters(samples, values[tick]))
+      return false;
+  }
+  return decoder.discarded == 0;
+}
+
+// The sequence byte wraps from 255 to 0 between two deltas without the
+// decoder taking it for a gap
+bool checkSequenceWrap() {
+  SampleEncoder encoder;
+  SampleDecoder decoder;
+  initSampleEncoder(encoder, 1);
+  initSampleDecoder(decoder);
+
+  vector<BatchedSample> samples;
+  for (int tick = 0; tick < sequenceWrapSamples; ++tick) {
+    uint64_t value = (uint64_t)tick * tick;
+    vector<char> payload = encodeTick(encoder, tick, value);
+    bool isKeyframe = tick % keyframeInterval == 0;
+    if (isDelta(payload) == isKeyframe ||
+        decodeTick(decoder, payload, samples) < 0 ||
+        !hasCounters(samples, value))
+      return false;
+  }
+  return decoder.discarded == 0;
+}
+
+// A delta whose base never arrived is discarded, as is every delta after
+// it, until the keyframe the encoder sends once told of the loss
+bool checkDroppedBase() {
+  SampleEncoder encoder;
+  SampleDecoder decoder;
+  initSampleEncoder(encoder, 1);
+  initSampleDecoder(decoder);
+
+  vector<BatchedSample> samples;
+  for (int tick = 0; tick < 7; ++tick) {
+    uint64_t value = 100 * tick;
+    if (tick == 5)
+      requestKeyframes(encoder);
+    vector<char> payload = encodeTick(encoder, tick, value);
+
+    // The sample of tick 2 is lost on the way
+    if (tick == 2)
+      continue;
+    if (decodeTick(decoder, payload, samples) < 0)
+      return false;
+    bool isDiscarded = tick == 3 || tick == 4;
+    if (isDiscarded ? !samples.empty() : !hasCounters(samples, value))
+      return false;
+  }
+  return decoder.discarded == 2;
+}
+
+// ==================== MAIN PROGRAM ====================
+int main() {
+  struct {
+    const char *name;
+    bool (*check)();
+  } checks[] = {{"counter reset", checkCounterReset},
+                {"wraparound", checkWraparound},
+                {"sequence wrap", checkSequenceWrap},
+                {"dropped base", checkDroppedBase}};
+
+  // Run every check, even after one failed
+  int failures = 0;
+  for (const auto &check : checks) {
+    if (check.check()) {
+      cout << "[codecCheck.cpp] " << check.name << ": ok" << endl;
+    } else {
+      cerr << "[codecCheck.cpp] " << check.name << ": FAILED" << endl;
+      ++failures;
+    }
+  }
+  return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
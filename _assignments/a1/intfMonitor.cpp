@@ -1,22 +1,37 @@
+#include "DriverStats.h"
+#include "FlowSketch.h"
+#include "LatencyHistogram.h"
+#include "MonitorProtocol.h"
+#include "NetlinkStats.h"
+#include "OutboundQueue.h"
+#include "PacketCapture.h"
+#include "SampleCodec.h"
+#include "ShmRing.h"
+#include "SysfsStats.h"
 #include <cstring>
+#include <dirent.h>
 #include <fcntl.h>
-#include <fstream>
 #include <iostream>
 #include <net/if.h>
 #include <signal.h>
 #include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
 #include <sys/un.h>
 #include <sys/wait.h>
 #include <unistd.h>
+#include <unordered_map>
+#include <vector>
 
 using namespace std;
 
 // ========== CONSTANTS ==========
 
-// Path for the UNIX socket
-const char *socketPath = "/tmp/networkMonitor";
+// Path for the UNIX socket unless -S is given
+const char *defaultSocketPath = "/tmp/networkMonitor";
 
 // Buffer size for message communication
 const int bufferSize = 256;
@@ -24,20 +39,198 @@ const int bufferSize = 256;
 // Maximum interface name length
 const int maxIfNameLen = 32;
 
+// Sampling interval used unless -i is given, and the shortest one allowed
+const int defaultIntervalMs = 1000;
+const int minIntervalMs = 10;
+
+// Sample frames queued for a stalled networkMonitor unless -q is given, or
+// two ticks' worth if that is more
+const int defaultQueueFrames = 256;
+
+// Latency budget used unless -L is given when batching
+const int defaultBatchLatencyMs = 1000;
+
+// Descriptors kept free for sockets, the timer and epoll when raising the
+// open file limit
+const int reservedFds = 64;
+
+// Period of the collection cost reports, or every tick if that is longer
+const int metricsReportMs = 10000;
+
+// ========== TYPES ==========
+
+// Source the interface statistics are read from
+typedef enum { BACKEND_NETLINK, BACKEND_SYSFS } STATS_BACKEND;
+
+// Path the samples take to networkMonitor
+typedef enum { TRANSPORT_SOCKET, TRANSPORT_SHM } TRANSPORT;
+
+// State kept for every monitored interface between samples
+struct MonitoredInterface {
+  SysfsInterface sysfs;       // Open statistics files, used by the sysfs backend
+  InterfaceCounters counters; // Most recent sample of the interface
+  InterfaceCounters previous; // Sample taken on the tick before
+  InterfaceRates rates;       // Rates between the previous and current sample
+  string linkState;           // Operational state last sent to networkMonitor
+  DriverStats driver;         // Driver and per-queue statistics, with -e
+  PacketCapture capture;      // Traffic classes seen on the link, with -c
+  FlowSketch flows;           // Heaviest flows of the interval, with -f
+};
+
 // ========== GLOBAL VARIABLES ==========
 
 // Flag to indicate whether monitoring is active
 bool isMonitoringActive = true;
 
-// String to store network interface statistics
-string networkInterfaceStatistics;
+// UNIX socket networkMonitor listens on
+const char *socketPath = defaultSocketPath;
+
+// Time between two samples, in milliseconds
+int samplingIntervalMs = defaultIntervalMs;
+
+// Samples taken and timer expirations that passed without a sample
+uint64_t ticksSampled = 0;
+uint64_t missedTicks = 0;
+
+// Socket receiving RTNLGRP_LINK notifications, -1 when operstate is polled
+int linkEventFd = -1;
+
+// Set when link notifications were lost and operstate must be re-read once
+bool resyncLinkState = true;
+
+// Index of every monitored interface by name, for link notifications
+unordered_map<string, size_t> interfaceIndexes;
+
+// Transport in use; the socket always carries the handshake and control
+TRANSPORT transport = TRANSPORT_SOCKET;
+
+// Shared-memory ring the samples are published to with the shm transport
+ShmRing sampleRing;
+
+// Outgoing frames of the current tick, reused to avoid reallocating
+vector<char> outgoingFrames;
+
+// Samples sent together over the socket, 1 sends each tick as it is taken
+uint32_t batchSamples = 1;
+
+// Longest a batched sample may wait before the batch is sent
+int batchLatencyMs = defaultBatchLatencyMs;
+
+// Samples waiting to be sent, and when the oldest of them was taken
+vector<BatchedSample> pendingSamples;
+uint64_t oldestPendingNs = 0;
+
+// Frames waiting for the non-blocking socket to accept them
+OutboundQueue outboundQueue;
+
+// Send samples over the socket as deltas against the previous ones unless
+// -w full is given, and the samples the queue had dropped when the last
+// were encoded, which calls for keyframes
+bool encodesDeltas = true;
+SampleEncoder sampleEncoder;
+uint64_t droppedAtEncoding = 0;
+
+// Samples of the current tick, delta-encoded together
+vector<BatchedSample> tickSamples;
+
+// Directory the interface statistics are read from, a synthetic tree with
+// -R. Synthetic interfaces are never brought up nor watched over netlink
+string statsRoot = defaultSysfsRoot;
+bool isSyntheticRoot = false;
+
+// Keep bringing interfaces up while they are down, unless -n or -R is given
+bool bringsInterfacesUp = true;
+
+// Also send driver and per-queue statistics with -e, read through this
+// SIOCETHTOOL socket
+bool collectsDriverStats = false;
+int ethtoolFd = -1;
+
+// Driver statistics frames of the current tick
+vector<char> driverFrames;
+
+// Also capture the traffic of every interface with -c and send it counted
+// per traffic class
+bool capturesTraffic = false;
+
+// Also track the heaviest flows of every interval with -f, which implies -c
+bool tracksFlows = false;
+
+// Traffic class and top flow frames of the current tick
+vector<char> trafficFrames;
+vector<FlowRecord> topFlows;
+
+// Index of the interface behind every open capture socket
+unordered_map<int, size_t> captureOwners;
+
+// epoll instance of the main loop, capture sockets join and leave it
+int epollFd = -1;
+
+// Control bytes received from networkMonitor but not yet framed
+vector<char> controlBuffer;
+
+// Cost of this monitor's own sampling since the last report: how long each
+// tick took and how late it started, the frame bytes it handed to the ring
+// (the outbound queue counts its own) and the CPU time used
+LatencyHistogram samplingDurations;
+LatencyHistogram timerLags;
+uint64_t ringBytesSent = 0;
+uint64_t metricsPeriodStartNs = 0;
+uint64_t bytesSentAtReport = 0;
+uint64_t cpuUserNsAtReport = 0;
+uint64_t cpuSystemNsAtReport = 0;
+
+// Network interfaces sampled by this monitor
+vector<MonitoredInterface> monitoredInterfaces;
+
+// Backend in use, netlink unless it is unavailable or sysfs was requested
+STATS_BACKEND statsBackend = BACKEND_NETLINK;
+
+// Netlink socket and the per-link results of its latest dump
+NetlinkStats netlinkStats;
+unordered_map<string, InterfaceCounters> linkCounters;
 
 // ========== FUNCTION DEFINITIONS ==========
 
 int createSocketForInterface();
 int bringInterfaceUp(const char *interfaceName);
-void collectInterfaceStats(const char *interface, string &interfaceData);
-void monitorNetworkInterface(const char *interfaceName, int socket);
+bool sampleInterfaceCounters(vector<MonitoredInterface> &interfaceList);
+bool updateLinkState(MonitoredInterface &monitoredInterface,
+                     uint32_t interfaceId, const string &operstate,
+                     bool hasCarrier, bool isPresent, int socket);
+void trackLinkStates(vector<MonitoredInterface> &interfaceList,
+                     bool operstateRead, int socket);
+void handleLinkEvents(vector<MonitoredInterface> &interfaceList, int socket);
+void computeRates(vector<MonitoredInterface> &interfaceList);
+void collectInterfaceStats(MonitoredInterface &monitoredInterface,
+                           StatsRecord &record);
+int announceInterfaces(const vector<MonitoredInterface> &interfaceList,
+                       int socket);
+int setupSampleRing(int socket);
+int publishFrames(const vector<char> &frames, int socket);
+int sendQueuedFrames(int socket);
+void fillCollectorStatus(CollectorStatus &status);
+void queueCollectorMetrics(int socket);
+void appendHistogramEntries(const LatencyHistogram &histogram,
+                            vector<char> &payload);
+int flushSampleBatch(int socket);
+void appendDeltaSamples(const vector<BatchedSample> &samples, uint64_t baseNs,
+                        vector<char> &frames);
+void queueDriverStats(vector<MonitoredInterface> &interfaceList, int socket);
+void reopenPacketCapture(MonitoredInterface &monitoredInterface,
+                         size_t interfaceId);
+void drainCapturedTraffic(MonitoredInterface &monitoredInterface);
+static void countFlowPacket(const PacketInfo &packet, void *context);
+void queueTrafficClasses(vector<MonitoredInterface> &interfaceList,
+                         int socket);
+void monitorNetworkInterfaces(vector<MonitoredInterface> &interfaceList,
+                              int socket);
+int createSamplingTimer(int intervalMs);
+int changeSamplingInterval(int timerFd, int intervalMs);
+int handleControlFrames(int socket, int timerFd);
+int listAllInterfaces(vector<string> &interfaceList);
+void raiseOpenFileLimit(size_t needed);
+ssize_t writeAll(int socket, const char *data, size_t length);
 static void signalHandler(int signal);
 
 // ========== CORE FUNCTIONS ==========
@@ -87,9 +280,6 @@ int bringInterfaceUp(const char *interfaceName) {
   strncpy(interfaceRequest.ifr_name, interfaceName, IFNAMSIZ);
   interfaceRequest.ifr_name[IFNAMSIZ - 1] = '\0'; // Ensure null termination
 
-  // Set the interface flags to bring it up
-  interfaceRequest.ifr_flags = IFF_UP;
-
   // Create a socket for the ioctl call (use AF_INET for network-related
   // operations)
   int socketFd = socket(AF_INET, SOCK_DGRAM, 0);
@@ -100,8 +290,14 @@ int bringInterfaceUp(const char *interfaceName) {
     return EXIT_FAILURE; // Return failure code
   }
 
-  // Attempt to bring the interface up using the ioctl system call
-  int result = ioctl(socketFd, SIOCSIFFLAGS, &interfaceRequest);
+  // Add IFF_UP to the current flags so flags such as NOARP are kept
+  int result = ioctl(socketFd, SIOCGIFFLAGS, &interfaceRequest);
+  if (result == 0) {
+    interfaceRequest.ifr_flags |= IFF_UP;
+
+    // Attempt to bring the interface up using the ioctl system call
+    result = ioctl(socketFd, SIOCSIFFLAGS, &interfaceRequest);
+  }
   if (result < 0) {
     // If ioctl fails, print error with the interface name and return failure
     cerr << "[intfMonitor.cpp] Failed to bring interface up: '" << interfaceName
@@ -115,158 +311,558 @@ int bringInterfaceUp(const char *interfaceName) {
   return result;
 }
 
+// Read the counters of every monitored interface from the active backend.
+// Returns whether operstate was read along with the counters
+bool sampleInterfaceCounters(vector<MonitoredInterface> &interfaceList) {
+  // Keep the last sample of each interface to compute rates against
+  for (auto &monitoredInterface : interfaceList)
+    monitoredInterface.previous = monitoredInterface.counters;
+
+  // One netlink dump returns the statistics of every link at once
+  if (statsBackend == BACKEND_NETLINK) {
+    if (dumpNetlinkStats(netlinkStats, linkCounters) == 0) {
+      for (auto &monitoredInterface : interfaceList) {
+        auto link = linkCounters.find(monitoredInterface.sysfs.name);
+        if (link != linkCounters.end())
+          monitoredInterface.counters = link->second;
+        else
+          clearInterfaceCounters(monitoredInterface.counters);
+      }
+      computeRates(interfaceList);
+      return true;
+    }
+
+    // Fall back to sysfs for the rest of the run if the dump fails
+    cerr << "[intfMonitor.cpp] Netlink dump failed, falling back to sysfs: "
+         << strerror(errno) << endl;
+    closeNetlinkStats(netlinkStats);
+    statsBackend = BACKEND_SYSFS;
+  }
+
+  // Re-read the already open statistics files of each interface. operstate
+  // is only polled when link notifications are unavailable or were lost
+  bool readOperstate = linkEventFd < 0 || resyncLinkState;
+  for (auto &monitoredInterface : interfaceList) {
+    readSysfsInterface(monitoredInterface.sysfs, monitoredInterface.counters,
+                       readOperstate);
+  }
+  computeRates(interfaceList);
+  return readOperstate;
+}
+
+// Remember the new operational state of an interface and, if it changed,
+// send a link event to networkMonitor straight away. Returns whether the
+// state changed
+bool updateLinkState(MonitoredInterface &monitoredInterface,
+                     uint32_t interfaceId, const string &operstate,
+                     bool hasCarrier, bool isPresent, int socket) {
+  string newState = isPresent ? operstate : "notpresent";
+  if (newState == monitoredInterface.linkState)
+    return false;
+  monitoredInterface.linkState = newState;
+
+  // A link that changed may have been recreated or reconfigured, look up
+  // its driver statistics and queues again
+  if (collectsDriverStats && isPresent)
+    openDriverStats(monitoredInterface.driver, ethtoolFd);
+  if (capturesTraffic && isPresent)
+    reopenPacketCapture(monitoredInterface, interfaceId);
+
+  LinkEventRecord record;
+  memset(&record, 0, sizeof(record));
+  record.operstate = operstateCode(newState);
+  record.hasCarrier = hasCarrier;
+  record.isRemoved = !isPresent;
+
+  // Link events are queued ahead of any later sample and never dropped
+  vector<char> frame;
+  appendFrame(frame, MSG_LINK_EVENT, interfaceId, monotonicTimeNs(), &record,
+              sizeof(record));
+  enqueueFrames(outboundQueue, frame);
+  if (sendQueuedFrames(socket) < 0) {
+    cerr << "[intfMonitor.cpp] Failed to send link event: " << strerror(errno)
+         << endl;
+  }
+  return true;
+}
+
+// After a sample, either pick up state changes from the freshly read
+// operstate or fill in the state tracked from link notifications
+void trackLinkStates(vector<MonitoredInterface> &interfaceList,
+                     bool operstateRead, int socket) {
+  for (size_t i = 0; i < interfaceList.size(); ++i) {
+    MonitoredInterface &monitoredInterface = interfaceList[i];
+    InterfaceCounters &counters = monitoredInterface.counters;
+
+    if (operstateRead) {
+      // Polled states carry no carrier flag, derive it from the state
+      bool hasCarrier = counters.operstate != "down" &&
+                        counters.operstate != "lowerlayerdown";
+      updateLinkState(monitoredInterface, i, counters.operstate, hasCarrier,
+                      counters.isPresent, socket);
+    } else if (counters.isPresent) {
+      counters.operstate = monitoredInterface.linkState;
+    }
+  }
+  resyncLinkState = false;
+}
+
+// Forward every pending link notification of a monitored interface and try
+// to bring the link back up as soon as it goes down
+void handleLinkEvents(vector<MonitoredInterface> &interfaceList, int socket) {
+  vector<LinkEvent> events;
+
+  // Notifications were dropped, the next sample re-reads every state
+  if (readLinkEvents(linkEventFd, events) < 0) {
+    if (errno == ENOBUFS)
+      resyncLinkState = true;
+    else
+      cerr << "[intfMonitor.cpp] Failed to read link events: "
+           << strerror(errno) << endl;
+  }
+
+  for (const auto &event : events) {
+    auto index = interfaceIndexes.find(event.name);
+    if (index == interfaceIndexes.end())
+      continue;
+
+    MonitoredInterface &monitoredInterface = interfaceList[index->second];
+    if (updateLinkState(monitoredInterface, index->second, event.operstate,
+                        event.hasCarrier, !event.isRemoved, socket) &&
+        monitoredInterface.linkState == "down") {
+      cout << "[intfMonitor.cpp] Interface " << event.name
+           << " xxxxx DOWN xxxxx" << endl;
+      if (bringsInterfacesUp)
+        bringInterfaceUp(event.name.c_str());
+    }
+  }
+}
+
+// Derive the per-second rates of every interface from its last two samples
+void computeRates(vector<MonitoredInterface> &interfaceList) {
+  uint64_t nowNs = monotonicTimeNs();
+  for (auto &monitoredInterface : interfaceList) {
+    // Missing interfaces are still reported at the time of this sample
+    if (!monitoredInterface.counters.isPresent)
+      monitoredInterface.counters.timestampNs = nowNs;
+    computeInterfaceRates(monitoredInterface.previous,
+                          monitoredInterface.counters,
+                          monitoredInterface.rates);
+  }
+}
+
 // Collect statistics for the specified network interface
-void collectInterfaceStats(const char *interface, string &interfaceData) {
-  string operstate;
-  int carrierUpCount = 0, carrierDownCount = 0;
-  int txBytes = 0, rxBytes = 0;
-  int rxDropped = 0, rxErrors = 0;
-  int txPackets = 0, rxPackets = 0;
-  int txDropped = 0, txErrors = 0;
-  char statPath[bufferSize];
-  ifstream infile;
-
-  // Read interface operational state
-  snprintf(statPath, sizeof(statPath), "/sys/class/net/%s/operstate",
-           interface);
-  infile.open(statPath);
-  if (infile.is_open()) {
-    infile >> operstate;
-    infile.close();
-  }
-
-  // Read carrier up count
-  snprintf(statPath, sizeof(statPath), "/sys/class/net/%s/carrier_up_count",
-           interface);
-  infile.open(statPath);
-  if (infile.is_open()) {
-    infile >> carrierUpCount;
-    infile.close();
-  }
-
-  // Read carrier down count
-  snprintf(statPath, sizeof(statPath), "/sys/class/net/%s/carrier_down_count",
-           interface);
-  infile.open(statPath);
-  if (infile.is_open()) {
-    infile >> carrierDownCount;
-    infile.close();
-  }
-
-  // Read transmit bytes
-  snprintf(statPath, sizeof(statPath), "/sys/class/net/%s/statistics/tx_bytes",
-           interface);
-  infile.open(statPath);
-  if (infile.is_open()) {
-    infile >> txBytes;
-    infile.close();
-  }
-
-  // Read receive bytes
-  snprintf(statPath, sizeof(statPath), "/sys/class/net/%s/statistics/rx_bytes",
-           interface);
-  infile.open(statPath);
-  if (infile.is_open()) {
-    infile >> rxBytes;
-    infile.close();
-  }
-
-  // Read receive dropped packets
-  snprintf(statPath, sizeof(statPath),
-           "/sys/class/net/%s/statistics/rx_dropped", interface);
-  infile.open(statPath);
-  if (infile.is_open()) {
-    infile >> rxDropped;
-    infile.close();
-  }
-
-  // Read receive errors
-  snprintf(statPath, sizeof(statPath), "/sys/class/net/%s/statistics/rx_errors",
-           interface);
-  infile.open(statPath);
-  if (infile.is_open()) {
-    infile >> rxErrors;
-    infile.close();
-  }
-
-  // Read transmit packets
-  snprintf(statPath, sizeof(statPath),
-           "/sys/class/net/%s/statistics/tx_packets", interface);
-  infile.open(statPath);
-  if (infile.is_open()) {
-    infile >> txPackets;
-    infile.close();
-  }
-
-  // Read transmit dropped packets
-  snprintf(statPath, sizeof(statPath),
-           "/sys/class/net/%s/statistics/tx_dropped", interface);
-  infile.open(statPath);
-  if (infile.is_open()) {
-    infile >> txDropped;
-    infile.close();
-  }
-
-  // Read transmit errors
-  snprintf(statPath, sizeof(statPath), "/sys/class/net/%s/statistics/tx_errors",
-           interface);
-  infile.open(statPath);
-  if (infile.is_open()) {
-    infile >> txErrors;
-    infile.close();
-  }
-
-  // Read receive packets
-  snprintf(statPath, sizeof(statPath),
-           "/sys/class/net/%s/statistics/rx_packets", interface);
-  infile.open(statPath);
-  if (infile.is_open()) {
-    infile >> rxPackets;
-    infile.close();
-  }
-
-  // Check interface state and attempt to bring it up if down
-  if (operstate == "down") {
+void collectInterfaceStats(MonitoredInterface &monitoredInterface,
+                           StatsRecord &record) {
+  const char *interface = monitoredInterface.sysfs.name.c_str();
+
+  // Check interface state and keep trying to bring it up while it is down
+  if (monitoredInterface.linkState == "down" && bringsInterfacesUp) {
     cout << "[intfMonitor.cpp] Interface " << interface << " xxxxx DOWN xxxxx"
          << endl;
     bringInterfaceUp(interface);
   }
 
-  // Format the collected statistics
-  interfaceData = "Interface: " + string(interface) + " state: " + operstate +
-                  " up_count: " + to_string(carrierUpCount) +
-                  " down_count: " + to_string(carrierDownCount) + "\n" +
-                  " rx_bytes: " + to_string(rxBytes) +
-                  " rx_dropped: " + to_string(rxDropped) +
-                  " rx_errors: " + to_string(rxErrors) +
-                  " rx_packets: " + to_string(rxPackets) + "\n" +
-                  " tx_bytes: " + to_string(txBytes) +
-                  " tx_dropped: " + to_string(txDropped) +
-                  " tx_errors: " + to_string(txErrors) +
-                  " tx_packets: " + to_string(txPackets) + "\n";
+  // Copy the collected statistics into the fixed-layout wire record
+  fillStatsRecord(monitoredInterface.counters, monitoredInterface.rates,
+                  record);
 }
 
-// Monitor and send interface statistics
-void monitorNetworkInterface(const char *interfaceName, int socket) {
-  // Buffer to hold the data to be sent
-  char buffer[bufferSize];
+// Tell networkMonitor the name behind every interface id used in frames
+int announceInterfaces(const vector<MonitoredInterface> &interfaceList,
+                       int socket) {
+  outgoingFrames.clear();
+  for (size_t i = 0; i < interfaceList.size(); ++i) {
+    const string &name = interfaceList[i].sysfs.name;
+    appendFrame(outgoingFrames, MSG_INTERFACE_NAME, i, monotonicTimeNs(),
+                name.data(), name.size());
+  }
+  return writeAll(socket, outgoingFrames.data(), outgoingFrames.size());
+}
+
+// Create the shared-memory ring and pass its memfd and eventfd to
+// networkMonitor over the socket
+int setupSampleRing(int socket) {
+  if (createShmRing(sampleRing, ringSlotCount, ringSlotSize) < 0)
+    return -1;
+
+  // The frame header is the data, the descriptors travel as SCM_RIGHTS
+  vector<char> frame;
+  appendFrame(frame, MSG_SHM_RING, collectorInterfaceId, monotonicTimeNs(),
+              nullptr, 0);
+
+  int descriptors[2] = {sampleRing.memFd, sampleRing.eventFd};
+  char control[CMSG_SPACE(sizeof(descriptors))];
+  memset(control, 0, sizeof(control));
+
+  struct iovec data = {frame.data(), frame.size()};
+  struct msghdr message;
+  memset(&message, 0, sizeof(message));
+  message.msg_iov = &data;
+  message.msg_iovlen = 1;
+  message.msg_control = control;
+  message.msg_controllen = sizeof(control);
+
+  struct cmsghdr *controlMessage = CMSG_FIRSTHDR(&message);
+  controlMessage->cmsg_level = SOL_SOCKET;
+  controlMessage->cmsg_type = SCM_RIGHTS;
+  controlMessage->cmsg_len = CMSG_LEN(sizeof(descriptors));
+  memcpy(CMSG_DATA(controlMessage), descriptors, sizeof(descriptors));
+
+  if (sendmsg(socket, &message, 0) != (ssize_t)frame.size()) {
+    closeShmRing(sampleRing);
+    return -1;
+  }
+  return 0;
+}
+
+// Write whatever the socket accepts of the queued frames without blocking,
+// the rest goes out when epoll reports the socket writable again
+int sendQueuedFrames(int socket) {
+  return flushOutboundQueue(outboundQueue, socket) < 0 ? -1 : 0;
+}
+
+// Send a buffer of frames to networkMonitor. Over the socket they pass
+// through the bounded outbound queue; with the shm transport each frame is
+// copied into its own ring slot and the consumer is woken once
+int publishFrames(const vector<char> &frames, int socket) {
+  if (transport == TRANSPORT_SOCKET) {
+    enqueueFrames(outboundQueue, frames);
+    return sendQueuedFrames(socket);
+  }
+
+  FrameHeader header;
+  size_t offset = 0;
+  while (offset + sizeof(FrameHeader) <= frames.size()) {
+    memcpy(&header, frames.data() + offset, sizeof(header));
+    uint32_t frameLength = sizeof(FrameHeader) + header.length;
 
-  // Clear the buffer before use
-  memset(buffer, 0, sizeof(buffer));
+    // A full ring drops the frame and counts it in the ring header
+    pushShmRing(sampleRing, frames.data() + offset, frameLength);
+    ringBytesSent += frameLength;
+    offset += frameLength;
+  }
+  notifyShmRing(sampleRing);
+  return 0;
+}
+
+// Queue the pending samples as one batch frame followed by the latest
+// collector status, then send them with the rest of the queue
+int flushSampleBatch(int socket) {
+  if (pendingSamples.empty())
+    return 0;
+
+  outgoingFrames.clear();
+  if (encodesDeltas) {
+    appendDeltaSamples(pendingSamples, oldestPendingNs, outgoingFrames);
+    pendingSamples.clear();
+    CollectorStatus status;
+    fillCollectorStatus(status);
+    appendFrame(outgoingFrames, MSG_COLLECTOR_STATUS, collectorInterfaceId,
+                monotonicTimeNs(), &status, sizeof(status));
+    enqueueFrames(outboundQueue, outgoingFrames);
+    return sendQueuedFrames(socket);
+  }
+
+  FrameHeader header;
+  BatchHeader batch;
+  uint32_t samplesLength = pendingSamples.size() * sizeof(BatchedSample);
+  fillFrameHeader(header, MSG_SAMPLE_BATCH, collectorInterfaceId,
+                  oldestPendingNs, sizeof(BatchHeader) + samplesLength);
+  batch.count = pendingSamples.size();
+  batch.reserved = 0;
+
+  const char *headerBytes = (const char *)&header;
+  const char *batchBytes = (const char *)&batch;
+  const char *sampleBytes = (const char *)pendingSamples.data();
+  outgoingFrames.insert(outgoingFrames.end(), headerBytes,
+                        headerBytes + sizeof(header));
+  outgoingFrames.insert(outgoingFrames.end(), batchBytes,
+                        batchBytes + sizeof(batch));
+  outgoingFrames.insert(outgoingFrames.end(), sampleBytes,
+                        sampleBytes + samplesLength);
+  pendingSamples.clear();
+
+  CollectorStatus status;
+  fillCollectorStatus(status);
+  appendFrame(outgoingFrames, MSG_COLLECTOR_STATUS, collectorInterfaceId,
+              monotonicTimeNs(), &status, sizeof(status));
+
+  enqueueFrames(outboundQueue, outgoingFrames);
+  return sendQueuedFrames(socket);
+}
+
+// Append samples as MSG_DELTA_SAMPLES frames of at most maxBatchSamples
+// records, timed against baseNs. Every record is a keyframe if the queue
+// dropped samples since the last call, as the decoder lost their bases, or
+// if it is full with -o coalesce, so the frames can replace queued ones
+void appendDeltaSamples(const vector<BatchedSample> &samples, uint64_t baseNs,
+                        vector<char> &frames) {
+  if (outboundQueue.policy == OVERFLOW_COALESCE &&
+      outboundQueue.sampleFrames >= outboundQueue.capacity)
+    requestKeyframes(sampleEncoder);
+  if (outboundQueue.droppedSamples != droppedAtEncoding) {
+    requestKeyframes(sampleEncoder);
+    droppedAtEncoding = outboundQueue.droppedSamples;
+  }
+
+  vector<char> payload;
+  for (size_t first = 0; first < samples.size(); first += maxBatchSamples) {
+    size_t count = min<size_t>(samples.size() - first, maxBatchSamples);
+    payload.clear();
+    appendVarint(payload, count);
+    for (size_t i = first; i < first + count; ++i)
+      encodeSample(sampleEncoder, samples[i].interfaceId,
+                   samples[i].timestampNs, baseNs, samples[i].record,
+                   payload);
+    appendFrame(frames, MSG_DELTA_SAMPLES, collectorInterfaceId, baseNs,
+                payload.data(), payload.size());
+  }
+}
+
+// Read the driver statistics of every interface and queue them for
+// networkMonitor, announcing their names first whenever those changed. They
+// always go over the socket, the ring slots only fit fixed-size samples
+void queueDriverStats(vector<MonitoredInterface> &interfaceList, int socket) {
+  vector<char> names;
+  driverFrames.clear();
+  for (size_t i = 0; i < interfaceList.size(); ++i) {
+    DriverStats &driver = interfaceList[i].driver;
+    if (readDriverStats(driver, ethtoolFd) < 0)
+      continue;
+
+    uint64_t timestampNs = interfaceList[i].counters.timestampNs;
+    if (driver.namesChanged) {
+      names.clear();
+      appendDriverStatNames(driver, names);
+      appendFrame(driverFrames, MSG_DRIVER_STAT_NAMES, i, timestampNs,
+                  names.data(), names.size());
+      driver.namesChanged = false;
+    }
+    appendFrame(driverFrames, MSG_DRIVER_STATS, i, timestampNs,
+                driver.values.data(), driver.values.size() * sizeof(uint64_t));
+  }
+
+  if (driverFrames.empty())
+    return;
+  enqueueFrames(outboundQueue, driverFrames);
+  if (sendQueuedFrames(socket) < 0) {
+    cerr << "[intfMonitor.cpp] Failed to send driver statistics: "
+         << strerror(errno) << endl;
+  }
+}
 
-  // Collect network interface statistics (assuming this function is implemented
-  // elsewhere)
-  collectInterfaceStats(interfaceName, networkInterfaceStatistics);
+// Capture the traffic of an interface on a fresh ring bound to its current
+// index, so a recreated link is followed. Filled blocks wake the main loop
+void reopenPacketCapture(MonitoredInterface &monitoredInterface,
+                         size_t interfaceId) {
+  PacketCapture &capture = monitoredInterface.capture;
+  if (capture.socketFd >= 0) {
+    drainCapturedTraffic(monitoredInterface);
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, capture.socketFd, nullptr);
+    captureOwners.erase(capture.socketFd);
+  }
+
+  if (openPacketCapture(capture) < 0) {
+    cerr << "[intfMonitor.cpp] Unable to capture on " << capture.name << ": "
+         << strerror(errno) << endl;
+    return;
+  }
+
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN;
+  event.data.fd = capture.socketFd;
+  epoll_ctl(epollFd, EPOLL_CTL_ADD, capture.socketFd, &event);
+  captureOwners[capture.socketFd] = interfaceId;
+}
+
+// Classify the filled blocks of an interface's capture ring, feeding every
+// packet to its flow sketch with -f
+void drainCapturedTraffic(MonitoredInterface &monitoredInterface) {
+  if (tracksFlows)
+    drainPacketCapture(monitoredInterface.capture, countFlowPacket,
+                       &monitoredInterface.flows);
+  else
+    drainPacketCapture(monitoredInterface.capture, nullptr, nullptr);
+}
 
-  // Ensure that the networkInterfaceStatistics is properly copied into the
-  // buffer, and make sure not to overflow the buffer
-  // Ensure null termination in case the string is too long
-  strncpy(buffer, networkInterfaceStatistics.c_str(), bufferSize - 1);
-  buffer[bufferSize - 1] = '\0';
+// Classify what is left in every capture ring and queue the per-class
+// counters for networkMonitor, followed by the heaviest flows of the
+// interval with -f. Like the driver statistics they always go over the
+// socket
+void queueTrafficClasses(vector<MonitoredInterface> &interfaceList,
+                         int socket) {
+  trafficFrames.clear();
+  for (size_t i = 0; i < interfaceList.size(); ++i) {
+    PacketCapture &capture = interfaceList[i].capture;
+    uint64_t timestampNs = interfaceList[i].counters.timestampNs;
+    drainCapturedTraffic(interfaceList[i]);
+    updateCaptureDrops(capture);
+    appendFrame(trafficFrames, MSG_TRAFFIC_CLASSES, i, timestampNs,
+                &capture.traffic, sizeof(capture.traffic));
 
-  // Send the data over the socket
+    // Every interval starts from an empty sketch, an empty list included
+    if (tracksFlows) {
+      copyTopFlows(interfaceList[i].flows, topFlows);
+      resetFlowSketch(interfaceList[i].flows);
+      appendFrame(trafficFrames, MSG_TOP_FLOWS, i, timestampNs,
+                  topFlows.data(), topFlows.size() * sizeof(FlowRecord));
+    }
+  }
+
+  enqueueFrames(outboundQueue, trafficFrames);
+  if (sendQueuedFrames(socket) < 0) {
+    cerr << "[intfMonitor.cpp] Failed to send traffic classes: "
+         << strerror(errno) << endl;
+  }
+}
+
+// Capture visitor adding a packet to the flow sketch it was drained for
+static void countFlowPacket(const PacketInfo &packet, void *context) {
+  addFlowPacket(*(FlowSketch *)context, packet);
+}
+
+// Fill in the health of the sampling loop and of the outbound queue
+void fillCollectorStatus(CollectorStatus &status) {
+  memset(&status, 0, sizeof(status));
+  status.ticks = ticksSampled;
+  status.missedTicks = missedTicks;
+  status.droppedSamples = outboundQueue.droppedSamples;
+  status.intervalMs = samplingIntervalMs;
+}
+
+// Report the cost of sampling since the last report and start a new period.
+// Only the non-empty buckets of the histograms are sent
+void queueCollectorMetrics(int socket) {
+  uint64_t nowNs = monotonicTimeNs();
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  uint64_t cpuUserNs = usage.ru_utime.tv_sec * 1000000000ULL +
+                       usage.ru_utime.tv_usec * 1000ULL;
+  uint64_t cpuSystemNs = usage.ru_stime.tv_sec * 1000000000ULL +
+                         usage.ru_stime.tv_usec * 1000ULL;
+  uint64_t bytesSent = outboundQueue.bytesWritten + ringBytesSent;
+
+  CollectorMetrics metrics;
+  memset(&metrics, 0, sizeof(metrics));
+  metrics.periodNs = nowNs - metricsPeriodStartNs;
+  metrics.bytesSent = bytesSent - bytesSentAtReport;
+  metrics.cpuUserNs = cpuUserNs - cpuUserNsAtReport;
+  metrics.cpuSystemNs = cpuSystemNs - cpuSystemNsAtReport;
+  metrics.durationSumNs = samplingDurations.sum;
+  metrics.durationMaxNs = samplingDurations.maximum;
+  metrics.lagSumNs = timerLags.sum;
+  metrics.lagMaxNs = timerLags.maximum;
+
+  vector<char> payload(sizeof(metrics));
+  appendHistogramEntries(samplingDurations, payload);
+  metrics.durationBuckets =
+      (payload.size() - sizeof(metrics)) / sizeof(HistogramEntry);
+  appendHistogramEntries(timerLags, payload);
+  metrics.lagBuckets = (payload.size() - sizeof(metrics)) /
+                           sizeof(HistogramEntry) -
+                       metrics.durationBuckets;
+  memcpy(payload.data(), &metrics, sizeof(metrics));
+
+  vector<char> frame;
+  appendFrame(frame, MSG_COLLECTOR_METRICS, collectorInterfaceId, nowNs,
+              payload.data(), payload.size());
+  enqueueFrames(outboundQueue, frame);
+  if (sendQueuedFrames(socket) < 0) {
+    cerr << "[intfMonitor.cpp] Failed to send collector metrics: "
+         << strerror(errno) << endl;
+  }
+
+  clearLatencyHistogram(samplingDurations);
+  clearLatencyHistogram(timerLags);
+  metricsPeriodStartNs = nowNs;
+  bytesSentAtReport = bytesSent;
+  cpuUserNsAtReport = cpuUserNs;
+  cpuSystemNsAtReport = cpuSystemNs;
+}
+
+// Monitor every interface and queue one stats frame per interface for this
+// tick, or add the samples to the pending batch
+void monitorNetworkInterfaces(vector<MonitoredInterface> &interfaceList,
+                              int socket) {
+  StatsRecord record;
+  outgoingFrames.clear();
+
+  // Sample every interface before building the frames
+  bool operstateRead = sampleInterfaceCounters(interfaceList);
+  trackLinkStates(interfaceList, operstateRead, socket);
+  if (collectsDriverStats)
+    queueDriverStats(interfaceList, socket);
+  if (capturesTraffic)
+    queueTrafficClasses(interfaceList, socket);
+
+  // Batching only applies to the socket, the ring already avoids syscalls
+  bool isBatching = batchSamples > 1 && transport == TRANSPORT_SOCKET;
+  tickSamples.clear();
+
+  // Collect the statistics of each interface and append a frame for it
+  size_t batchLimit = min(batchSamples, maxBatchSamples);
+  for (size_t i = 0; i < interfaceList.size(); ++i) {
+    collectInterfaceStats(interfaceList[i], record);
+    if (isBatching) {
+      if (pendingSamples.empty())
+        oldestPendingNs = interfaceList[i].counters.timestampNs;
+      BatchedSample sample;
+      sample.interfaceId = i;
+      sample.reserved = 0;
+      sample.timestampNs = interfaceList[i].counters.timestampNs;
+      sample.record = record;
+      pendingSamples.push_back(sample);
+
+      // A tick with more interfaces than fit in one batch sends several
+      if (pendingSamples.size() >= batchLimit && flushSampleBatch(socket) < 0) {
+        cerr << "[intfMonitor.cpp] Failed to send data: " << strerror(errno)
+             << endl;
+      }
+      continue;
+    }
+    if (encodesDeltas) {
+      // Encoded together once every interface is sampled
+      BatchedSample sample;
+      sample.interfaceId = i;
+      sample.reserved = 0;
+      sample.timestampNs = interfaceList[i].counters.timestampNs;
+      sample.record = record;
+      tickSamples.push_back(sample);
+      continue;
+    }
+    appendFrame(outgoingFrames, MSG_INTERFACE_STATS, i,
+                interfaceList[i].counters.timestampNs, &record,
+                sizeof(record));
+  }
+  if (!tickSamples.empty())
+    appendDeltaSamples(tickSamples, tickSamples[0].timestampNs,
+                       outgoingFrames);
+
+  if (isBatching) {
+    // Send once the batch is full, or when waiting another tick would take
+    // the oldest sample past its latency budget
+    uint64_t nextTickNs = monotonicTimeNs() + samplingIntervalMs * 1000000ULL;
+    bool isFull = pendingSamples.size() + interfaceList.size() > batchLimit;
+    bool isDue = nextTickNs - oldestPendingNs >
+                 (uint64_t)batchLatencyMs * 1000000ULL;
+    if ((isFull || isDue) && flushSampleBatch(socket) < 0) {
+      cerr << "[intfMonitor.cpp] Failed to send data: " << strerror(errno)
+           << endl;
+    }
+    return;
+  }
+
+  // Report the health of the sampling loop after the interfaces
+  CollectorStatus status;
+  fillCollectorStatus(status);
+  appendFrame(outgoingFrames, MSG_COLLECTOR_STATUS, collectorInterfaceId,
+              monotonicTimeNs(), &status, sizeof(status));
+
+  // Send every frame over the socket or the ring
   // If the write operation fails, print an error message
-  if (write(socket, buffer, strlen(buffer)) < 0) {
+  if (publishFrames(outgoingFrames, socket) < 0) {
     cerr << "[intfMonitor.cpp] Failed to send data: " << strerror(errno)
          << endl;
   }
@@ -274,6 +870,140 @@ void monitorNetworkInterface(const char *interfaceName, int socket) {
 
 // =========== UTILITY FUNCTIONS ==========
 
+// Create a CLOCK_MONOTONIC timer firing every intervalMs. Ticks are
+// scheduled from the first expiration, so collection time never shifts them
+int createSamplingTimer(int intervalMs) {
+  int timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+  if (timerFd < 0)
+    return -1;
+
+  struct itimerspec timerSpec;
+  timerSpec.it_interval.tv_sec = intervalMs / 1000;
+  timerSpec.it_interval.tv_nsec = (intervalMs % 1000) * 1000000L;
+  timerSpec.it_value = timerSpec.it_interval;
+  if (timerfd_settime(timerFd, 0, &timerSpec, nullptr) < 0) {
+    close(timerFd);
+    return -1;
+  }
+  return timerFd;
+}
+
+// Switch the timer to a new interval, the next tick following one interval
+// from now. Rates stay correct as they are computed from sample timestamps
+int changeSamplingInterval(int timerFd, int intervalMs) {
+  struct itimerspec timerSpec;
+  timerSpec.it_interval.tv_sec = intervalMs / 1000;
+  timerSpec.it_interval.tv_nsec = (intervalMs % 1000) * 1000000L;
+  timerSpec.it_value = timerSpec.it_interval;
+  if (timerfd_settime(timerFd, 0, &timerSpec, nullptr) < 0)
+    return -1;
+  samplingIntervalMs = intervalMs;
+  return 0;
+}
+
+// Read every control frame networkMonitor sent and act on it. Returns -1
+// once networkMonitor has closed the connection or on error
+int handleControlFrames(int socket, int timerFd) {
+  char buffer[bufferSize];
+  while (true) {
+    ssize_t bytesRead = read(socket, buffer, sizeof(buffer));
+    if (bytesRead > 0) {
+      controlBuffer.insert(controlBuffer.end(), buffer, buffer + bytesRead);
+      continue;
+    }
+    if (bytesRead == 0)
+      return -1;
+    if (errno == EAGAIN || errno == EWOULDBLOCK)
+      break;
+    if (errno != EINTR)
+      return -1;
+  }
+
+  FrameHeader header;
+  const char *payload;
+  size_t offset = 0;
+  int result;
+  while ((result = extractFrame(controlBuffer, offset, header, payload)) > 0) {
+    if (header.type != MSG_SET_INTERVAL ||
+        header.length != sizeof(IntervalRecord))
+      continue;
+    IntervalRecord interval;
+    memcpy(&interval, payload, sizeof(interval));
+    if ((int)interval.intervalMs < minIntervalMs) {
+      cerr << "[intfMonitor.cpp] Ignoring sampling interval of "
+           << interval.intervalMs << " ms" << endl;
+    } else if ((int)interval.intervalMs != samplingIntervalMs) {
+      if (changeSamplingInterval(timerFd, interval.intervalMs) < 0)
+        cerr << "[intfMonitor.cpp] Failed to change the sampling interval: "
+             << strerror(errno) << endl;
+    }
+  }
+  controlBuffer.erase(controlBuffer.begin(), controlBuffer.begin() + offset);
+  return result;
+}
+
+// Fill the list with the name of every interface found in the stats root
+int listAllInterfaces(vector<string> &interfaceList) {
+  DIR *netClassDir = opendir(statsRoot.c_str());
+  if (netClassDir == nullptr) {
+    cerr << "[intfMonitor.cpp] Unable to list interfaces in " << statsRoot
+         << ": " << strerror(errno) << endl;
+    return -1;
+  }
+
+  // Every entry apart from "." and ".." is an interface
+  struct dirent *entry;
+  while ((entry = readdir(netClassDir)) != nullptr) {
+    if (entry->d_name[0] == '.')
+      continue;
+    interfaceList.push_back(entry->d_name);
+  }
+
+  closedir(netClassDir);
+  return 0;
+}
+
+// Raise the soft open file limit towards needed descriptors, as far as the
+// hard limit allows; sysfs keeps every statistics file open
+void raiseOpenFileLimit(size_t needed) {
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) < 0 || limit.rlim_cur >= needed)
+    return;
+
+  limit.rlim_cur = min<rlim_t>(needed, limit.rlim_max);
+  if (setrlimit(RLIMIT_NOFILE, &limit) < 0 || limit.rlim_cur < needed) {
+    cerr << "[intfMonitor.cpp] Open file limit " << limit.rlim_cur
+         << " is below the " << needed << " descriptors needed" << endl;
+  }
+}
+
+// Append a HistogramEntry for every non-empty bucket of a histogram
+void appendHistogramEntries(const LatencyHistogram &histogram,
+                            vector<char> &payload) {
+  for (int i = 0; i < histogramBuckets && histogram.count > 0; ++i) {
+    if (histogram.buckets[i] == 0)
+      continue;
+    HistogramEntry entry = {(uint32_t)i, (uint32_t)histogram.buckets[i]};
+    const char *bytes = (const char *)&entry;
+    payload.insert(payload.end(), bytes, bytes + sizeof(entry));
+  }
+}
+
+// Write the whole buffer, retrying on short writes and interrupted calls
+ssize_t writeAll(int socket, const char *data, size_t length) {
+  size_t bytesSent = 0;
+  while (bytesSent < length) {
+    ssize_t result = write(socket, data + bytesSent, length - bytesSent);
+    if (result < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    bytesSent += result;
+  }
+  return bytesSent;
+}
+
 // Handle incoming signals
 static void signalHandler(int signal) {
   if (signal == SIGUSR1) {
@@ -284,14 +1014,224 @@ static void signalHandler(int signal) {
 
 // ==================== MAIN PROGRAM ====================
 int main(int argc, char *argv[]) {
-  if (argc < 2) {
-    cerr << "Usage: " << argv[0] << " <network-interface>" << endl;
+  const char *usage = " [-b netlink|sysfs] [-i interval-ms] [-t socket|shm] "
+                      "[-B batch-samples] [-L latency-ms] "
+                      "[-q queue-frames] [-o drop-oldest|coalesce] "
+                      "[-R stats-root] [-S socket-path] [-w full|delta] "
+                      "[-n] [-e] [-c] [-f] "
+                      "<network-interface>... | all";
+
+  // Parse command line options
+  int option;
+  int queueFrames = 0;
+  OVERFLOW_POLICY overflowPolicy = OVERFLOW_DROP_OLDEST;
+  while ((option = getopt(argc, argv, "b:i:t:B:L:q:o:R:S:w:necf")) != -1) {
+    switch (option) {
+    case 'b':
+      // Statistics backend
+      if (strcmp(optarg, "netlink") == 0) {
+        statsBackend = BACKEND_NETLINK;
+      } else if (strcmp(optarg, "sysfs") == 0) {
+        statsBackend = BACKEND_SYSFS;
+      } else {
+        cerr << "Usage: " << argv[0] << usage << endl;
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'i':
+      // Sampling interval in milliseconds
+      samplingIntervalMs = atoi(optarg);
+      if (samplingIntervalMs < minIntervalMs) {
+        cerr << "[intfMonitor.cpp] Sampling interval must be at least "
+             << minIntervalMs << " ms" << endl;
+        return EXIT_FAILURE;
+      }
+      break;
+    case 't':
+      // Transport of the samples
+      if (strcmp(optarg, "socket") == 0) {
+        transport = TRANSPORT_SOCKET;
+      } else if (strcmp(optarg, "shm") == 0) {
+        transport = TRANSPORT_SHM;
+      } else {
+        cerr << "Usage: " << argv[0] << usage << endl;
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'B':
+      // Samples sent together in one batch
+      if (atoi(optarg) < 1) {
+        cerr << "Usage: " << argv[0] << usage << endl;
+        return EXIT_FAILURE;
+      }
+      batchSamples = atoi(optarg);
+      break;
+    case 'L':
+      // Longest a batched sample may wait, in milliseconds
+      batchLatencyMs = atoi(optarg);
+      if (batchLatencyMs < 0) {
+        cerr << "Usage: " << argv[0] << usage << endl;
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'q':
+      // Sample frames kept while networkMonitor is not reading
+      queueFrames = atoi(optarg);
+      if (queueFrames < 1) {
+        cerr << "Usage: " << argv[0] << usage << endl;
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'o':
+      // What to give up when the outbound queue is full
+      if (strcmp(optarg, "drop-oldest") == 0) {
+        overflowPolicy = OVERFLOW_DROP_OLDEST;
+      } else if (strcmp(optarg, "coalesce") == 0) {
+        overflowPolicy = OVERFLOW_COALESCE;
+      } else {
+        cerr << "Usage: " << argv[0] << usage << endl;
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'R':
+      // Synthetic tree laid out like /sys/class/net, only sysfs can read it
+      statsRoot = optarg;
+      isSyntheticRoot = statsRoot != defaultSysfsRoot;
+      if (isSyntheticRoot) {
+        statsBackend = BACKEND_SYSFS;
+        bringsInterfacesUp = false;
+      }
+      break;
+    case 'w':
+      // Encoding of the samples sent over the socket
+      if (strcmp(optarg, "full") == 0) {
+        encodesDeltas = false;
+      } else if (strcmp(optarg, "delta") == 0) {
+        encodesDeltas = true;
+      } else {
+        cerr << "Usage: " << argv[0] << usage << endl;
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'S':
+      // Socket of a networkMonitor configured with another path
+      socketPath = optarg;
+      break;
+    case 'n':
+      // Only observe, leave interfaces that are down as they are
+      bringsInterfacesUp = false;
+      break;
+    case 'e':
+      // Driver statistics and per-queue counters on top of the generic ones
+      collectsDriverStats = true;
+      break;
+    case 'c':
+      // Count the captured traffic per ethertype, protocol and port range
+      capturesTraffic = true;
+      break;
+    case 'f':
+      // Top talkers by 5-tuple, counted from the same capture
+      capturesTraffic = true;
+      tracksFlows = true;
+      break;
+    default:
+      cerr << "Usage: " << argv[0] << usage << endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (optind >= argc) {
+    cerr << "Usage: " << argv[0] << usage << endl;
     return EXIT_FAILURE;
   }
 
-  // Store the network interface name
-  char networkInterface[maxIfNameLen];
-  strncpy(networkInterface, argv[1], maxIfNameLen - 1);
+  // Store the network interface names, "all" expands to every interface
+  vector<string> interfaceNames;
+  for (int i = optind; i < argc; ++i) {
+    if (strcmp(argv[i], "all") == 0) {
+      if (listAllInterfaces(interfaceNames) < 0)
+        return EXIT_FAILURE;
+    } else if (strlen(argv[i]) >= (size_t)maxIfNameLen) {
+      cerr << "[intfMonitor.cpp] Interface name too long: " << argv[i] << endl;
+      return EXIT_FAILURE;
+    } else {
+      interfaceNames.push_back(argv[i]);
+    }
+  }
+
+  // Without -q, keep at least two ticks' worth of samples
+  if (queueFrames == 0)
+    queueFrames = max<int>(defaultQueueFrames, 2 * interfaceNames.size());
+  initOutboundQueue(outboundQueue, queueFrames, overflowPolicy);
+
+  monitoredInterfaces.resize(interfaceNames.size());
+  for (size_t i = 0; i < interfaceNames.size(); ++i) {
+    interfaceIndexes[interfaceNames[i]] = i;
+    initSysfsInterface(monitoredInterfaces[i].sysfs, interfaceNames[i],
+                       statsRoot);
+    clearInterfaceCounters(monitoredInterfaces[i].counters);
+    clearInterfaceCounters(monitoredInterfaces[i].previous);
+    initDriverStats(monitoredInterfaces[i].driver, interfaceNames[i],
+                    statsRoot);
+    initPacketCapture(monitoredInterfaces[i].capture, interfaceNames[i]);
+  }
+
+  // Driver statistic names are fetched once an interface is first seen
+  // present, see updateLinkState(). Synthetic interfaces have no driver
+  if (collectsDriverStats && isSyntheticRoot) {
+    cerr << "[intfMonitor.cpp] No driver statistics for a synthetic stats "
+            "root, ignoring -e"
+         << endl;
+    collectsDriverStats = false;
+  }
+  if (capturesTraffic && isSyntheticRoot) {
+    cerr << "[intfMonitor.cpp] No traffic to capture for a synthetic stats "
+            "root, ignoring -c"
+         << endl;
+    capturesTraffic = false;
+    tracksFlows = false;
+  }
+  if (tracksFlows) {
+    for (auto &monitoredInterface : monitoredInterfaces)
+      initFlowSketch(monitoredInterface.flows);
+  }
+  if (collectsDriverStats) {
+    ethtoolFd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (ethtoolFd < 0) {
+      cerr << "[intfMonitor.cpp] Driver statistics unavailable: "
+           << strerror(errno) << endl;
+      collectsDriverStats = false;
+    }
+  }
+
+  // Open the netlink socket, keeping sysfs as the fallback
+  if (statsBackend == BACKEND_NETLINK && openNetlinkStats(netlinkStats) < 0) {
+    cerr << "[intfMonitor.cpp] Netlink unavailable, falling back to sysfs: "
+         << strerror(errno) << endl;
+    statsBackend = BACKEND_SYSFS;
+  }
+
+  // Subscribe to link notifications, polling operstate if that fails or the
+  // interfaces are synthetic
+  if (!isSyntheticRoot)
+    linkEventFd = openLinkEvents();
+  if (linkEventFd < 0 && !isSyntheticRoot) {
+    cerr << "[intfMonitor.cpp] Link notifications unavailable, polling "
+            "operstate: "
+         << strerror(errno) << endl;
+  }
+
+  // With sysfs, open the statistics files of every interface once, up front
+  if (statsBackend == BACKEND_SYSFS) {
+    raiseOpenFileLimit(monitoredInterfaces.size() * (STAT_COUNT + 1) +
+                       reservedFds);
+    for (auto &monitoredInterface : monitoredInterfaces) {
+      if (openSysfsInterface(monitoredInterface.sysfs) < 0) {
+        cerr << "[intfMonitor.cpp] Interface " << monitoredInterface.sysfs.name
+             << " not found, waiting for it to appear" << endl;
+      }
+    }
+  }
 
   // Set up signal handler
   struct sigaction sigAction;
@@ -333,13 +1273,178 @@ int main(int argc, char *argv[]) {
     return EXIT_FAILURE;
   }
 
+  // Announce the interface names before the first stats frame
+  if (announceInterfaces(monitoredInterfaces, socketFd) < 0) {
+    cerr << "[intfMonitor.cpp] Failed to send interface names: "
+         << strerror(errno) << endl;
+    close(socketFd);
+    return EXIT_FAILURE;
+  }
+
+  // Switch the samples to the shared-memory ring, the socket stays the
+  // control plane
+  if (transport == TRANSPORT_SHM && setupSampleRing(socketFd) < 0) {
+    cerr << "[intfMonitor.cpp] Shared-memory ring unavailable, using the "
+            "socket: "
+         << strerror(errno) << endl;
+    transport = TRANSPORT_SOCKET;
+  }
+
+  // Ring slots hold one fixed-size sample each and never cross a socket, so
+  // only the socket transport encodes deltas
+  encodesDeltas = encodesDeltas && transport == TRANSPORT_SOCKET;
+  initSampleEncoder(sampleEncoder, monitoredInterfaces.size());
+
+  // From here on a stalled networkMonitor must not block sampling, frames
+  // it does not accept wait in the outbound queue
+  if (fcntl(socketFd, F_SETFL, fcntl(socketFd, F_GETFL) | O_NONBLOCK) < 0) {
+    cerr << "[intfMonitor.cpp] Failed to make the socket non-blocking: "
+         << strerror(errno) << endl;
+    close(socketFd);
+    return EXIT_FAILURE;
+  }
+
+  // Sample on every expiration of a monotonic timer
+  int timerFd = createSamplingTimer(samplingIntervalMs);
+  if (timerFd < 0) {
+    cerr << "[intfMonitor.cpp] Failed to create sampling timer: "
+         << strerror(errno) << endl;
+    close(socketFd);
+    return EXIT_FAILURE;
+  }
+
+  // Wait on the timer, the link notifications and the capture rings at the
+  // same time. Rings are added once their interface is first seen present
+  epollFd = epoll_create1(EPOLL_CLOEXEC);
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN;
+  event.data.fd = timerFd;
+  if (epollFd < 0 || epoll_ctl(epollFd, EPOLL_CTL_ADD, timerFd, &event) < 0) {
+    cerr << "[intfMonitor.cpp] Failed to set up epoll: " << strerror(errno)
+         << endl;
+    close(socketFd);
+    return EXIT_FAILURE;
+  }
+  if (linkEventFd >= 0) {
+    event.data.fd = linkEventFd;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, linkEventFd, &event);
+  }
+
+  // Edge-triggered writability resumes a queue the socket stopped accepting,
+  // readability brings control frames such as a new sampling interval
+  event.events = EPOLLIN | EPOLLOUT | EPOLLET;
+  event.data.fd = socketFd;
+  epoll_ctl(epollFd, EPOLL_CTL_ADD, socketFd, &event);
+
+  // The first cost report covers everything from here on
+  clearLatencyHistogram(samplingDurations);
+  clearLatencyHistogram(timerLags);
+  metricsPeriodStartNs = monotonicTimeNs();
+
   // Main monitoring loop
+  const int maxEvents = 64;
+  struct epoll_event events[maxEvents];
   while (isMonitoringActive) {
-    monitorNetworkInterface(networkInterface, socketFd);
-    sleep(1);
+    // Block until the next tick or link change, SIGUSR1 interrupts the wait
+    int eventCount = epoll_wait(epollFd, events, maxEvents, -1);
+    if (eventCount < 0) {
+      if (errno == EINTR)
+        continue;
+      cerr << "[intfMonitor.cpp] Failed to wait for events: "
+           << strerror(errno) << endl;
+      break;
+    }
+
+    for (int i = 0; i < eventCount; ++i) {
+      // Link changes are forwarded immediately, not on the next tick
+      if (events[i].data.fd == linkEventFd) {
+        handleLinkEvents(monitoredInterfaces, socketFd);
+        continue;
+      }
+
+      // A capture ring handed over filled blocks, classify them before the
+      // kernel runs out of room
+      auto capture = captureOwners.find(events[i].data.fd);
+      if (capture != captureOwners.end()) {
+        drainCapturedTraffic(monitoredInterfaces[capture->second]);
+        continue;
+      }
+
+      // networkMonitor caught up, send what queued up in the meantime, or
+      // sent control frames
+      if (events[i].data.fd == socketFd) {
+        if ((events[i].events & EPOLLOUT) && sendQueuedFrames(socketFd) < 0) {
+          cerr << "[intfMonitor.cpp] Failed to send data: " << strerror(errno)
+               << endl;
+        }
+        if ((events[i].events & (EPOLLIN | EPOLLHUP)) &&
+            handleControlFrames(socketFd, timerFd) < 0) {
+          cerr << "[intfMonitor.cpp] networkMonitor closed the connection, "
+                  "shutting down"
+               << endl;
+          isMonitoringActive = false;
+        }
+        continue;
+      }
+
+      uint64_t expirations;
+      if (read(timerFd, &expirations, sizeof(expirations)) < 0)
+        continue;
+
+      // More than one expiration means the previous sample overran its tick
+      missedTicks += expirations - 1;
+      ++ticksSampled;
+
+      // The time left until the next expiration tells how long ago the
+      // last one was
+      uint64_t startNs = monotonicTimeNs();
+      uint64_t intervalNs = samplingIntervalMs * 1000000ULL;
+      struct itimerspec timerSpec;
+      if (timerfd_gettime(timerFd, &timerSpec) == 0) {
+        uint64_t remainingNs = timerSpec.it_value.tv_sec * 1000000000ULL +
+                               timerSpec.it_value.tv_nsec;
+        recordLatency(timerLags,
+                      remainingNs < intervalNs ? intervalNs - remainingNs : 0);
+      }
+
+      monitorNetworkInterfaces(monitoredInterfaces, socketFd);
+      uint64_t endNs = monotonicTimeNs();
+      recordLatency(samplingDurations, endNs - startNs);
+
+      if (endNs - metricsPeriodStartNs >= metricsReportMs * 1000000ULL)
+        queueCollectorMetrics(socketFd);
+    }
+  }
+
+  // Send what is left of the current batch and the queue, as far as the
+  // socket accepts it without blocking
+  if (flushSampleBatch(socketFd) < 0 || sendQueuedFrames(socketFd) < 0) {
+    cerr << "[intfMonitor.cpp] Failed to send data: " << strerror(errno)
+         << endl;
+  }
+  if (outboundQueue.droppedEvents > 0) {
+    cerr << "[intfMonitor.cpp] Dropped " << outboundQueue.droppedEvents
+         << " link events and metrics reports the queue had no room for"
+         << endl;
   }
 
   // Clean up and exit
+  if (transport == TRANSPORT_SHM)
+    closeShmRing(sampleRing);
+  close(epollFd);
+  close(timerFd);
+  if (linkEventFd >= 0)
+    close(linkEventFd);
+  for (auto &monitoredInterface : monitoredInterfaces) {
+    closeSysfsInterface(monitoredInterface.sysfs);
+    closeDriverStats(monitoredInterface.driver);
+    closePacketCapture(monitoredInterface.capture);
+  }
+  if (ethtoolFd >= 0)
+    close(ethtoolFd);
+  if (statsBackend == BACKEND_NETLINK)
+    closeNetlinkStats(netlinkStats);
   close(socketFd);
   return EXIT_SUCCESS;
 }
\ No newline at end of file
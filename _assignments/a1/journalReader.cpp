@@ -0,0 +1,190 @@
+#include "InterfaceStats.h"
+#include "SampleJournal.h"
+#include <cerrno>        // For errno
+#include <cstdio>        // For snprintf
+#include <cstdlib>       // For strtod
+#include <cstring>       // For strerror, strncmp and memcpy
+#include <iostream>      // For cout and cerr
+#include <string>        // For string
+#include <time.h>        // For clock_gettime, localtime_r and strftime
+#include <unistd.h>      // For getopt
+#include <unordered_map> // For unordered_map
+#include <vector>        // For vector
+
+using namespace std;
+
+// ========== CONSTANTS ==========
+
+// Journal written by networkMonitor -J unless a directory is given
+const char *defaultJournalDir = "/tmp/networkMonitor.journal";
+
+// ========== TYPES ==========
+
+// What to print from the journal
+struct JournalQuery {
+  string interface; // Only this interface, or every one if empty
+  uint64_t fromNs;  // Earliest CLOCK_REALTIME time printed
+  uint64_t toNs;    // Latest CLOCK_REALTIME time printed
+};
+
+// ========== FUNCTION DEFINITIONS ==========
+
+int parseTime(const char *text, uint64_t &timeNs);
+void formatTime(uint64_t timeNs, char *text, size_t size);
+uint64_t scanSegment(const JournalSegment &segment, const JournalQuery &query,
+                     unordered_map<string, InterfaceCounters> &previous);
+void printRecord(const JournalRecord &record, const InterfaceCounters &current,
+                 const InterfaceCounters &previous);
+
+// ========== HELPER FUNCTIONS ==========
+
+// Parse a time as Unix seconds, or as seconds before now if negative
+int parseTime(const char *text, uint64_t &timeNs) {
+  char *end;
+  double seconds = strtod(text, &end);
+  if (end == text || *end != '\0')
+    return -1;
+  if (seconds < 0) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    seconds += now.tv_sec + now.tv_nsec / 1e9;
+  }
+  timeNs = seconds > 0 ? (uint64_t)(seconds * 1e9) : 0;
+  return 0;
+}
+
+// Format a CLOCK_REALTIME time as local date and time with milliseconds
+void formatTime(uint64_t timeNs, char *text, size_t size) {
+  time_t seconds = timeNs / 1000000000ULL;
+  struct tm local;
+  localtime_r(&seconds, &local);
+  size_t length = strftime(text, size, "%Y-%m-%d %H:%M:%S", &local);
+  snprintf(text + length, size - length, ".%03llu",
+           (unsigned long long)(timeNs / 1000000ULL % 1000));
+}
+
+// ========== CORE FUNCTIONS ==========
+
+// Print every record of a segment in the query's range, straight from the
+// mapping. Returns the records printed
+uint64_t scanSegment(const JournalSegment &segment, const JournalQuery &query,
+                     unordered_map<string, InterfaceCounters> &previous) {
+  uint64_t printed = 0;
+  for (uint64_t i = 0; i < segment.count; ++i) {
+    const JournalRecord &record = segment.records[i];
+    if (record.timestampNs < query.fromNs || record.timestampNs > query.toNs)
+      continue;
+    if (!query.interface.empty() &&
+        strncmp(record.name, query.interface.c_str(), journalNameSize) != 0)
+      continue;
+
+    // Rates come from the interface's previous record in the scan
+    string name(record.name, strnlen(record.name, journalNameSize));
+    InterfaceCounters current;
+    current.isPresent = record.flags & STATS_PRESENT;
+    current.timestampNs = record.timestampNs;
+    memcpy(current.values, record.counters, sizeof(current.values));
+    auto last = previous.find(name);
+    if (last == previous.end()) {
+      InterfaceCounters none;
+      clearInterfaceCounters(none);
+      printRecord(record, current, none);
+      previous[name] = current;
+    } else {
+      printRecord(record, current, last->second);
+      last->second = current;
+    }
+    ++printed;
+  }
+  return printed;
+}
+
+// Print one record with its counters and, given an earlier record of the
+// interface, its traffic rates
+void printRecord(const JournalRecord &record, const InterfaceCounters &current,
+                 const InterfaceCounters &previous) {
+  char line[1024];
+  formatTime(record.timestampNs, line, sizeof(line));
+  size_t length = strlen(line);
+  length += snprintf(line + length, sizeof(line) - length, " %.*s state=%s",
+                     (int)journalNameSize, record.name,
+                     (record.flags & STATS_PRESENT)
+                         ? operstateName(record.operstate)
+                         : "missing");
+  for (int i = 0; i < STAT_COUNT && length < sizeof(line); ++i)
+    length += snprintf(line + length, sizeof(line) - length, " %s=%llu",
+                       statName((STAT)i),
+                       (unsigned long long)record.counters[i]);
+
+  InterfaceRates rates;
+  computeInterfaceRates(previous, current, rates);
+  if (rates.isValid) {
+    for (int i = firstTrafficStat; i < STAT_COUNT && length < sizeof(line);
+         ++i)
+      length += snprintf(line + length, sizeof(line) - length, " %s/s=%.1f",
+                         statName((STAT)i), rates.values[i]);
+  }
+  cout << line << "\n";
+}
+
+// ==================== MAIN PROGRAM ====================
+int main(int argc, char *argv[]) {
+  const char *usage = " [-i interface] [-f from] [-t to] [journal-dir]\n"
+                      "  from and to are Unix seconds, or seconds before now "
+                      "if negative";
+
+  // Parse command line options
+  int option;
+  JournalQuery query;
+  query.fromNs = 0;
+  query.toNs = UINT64_MAX;
+  while ((option = getopt(argc, argv, "i:f:t:")) != -1) {
+    switch (option) {
+    case 'i':
+      query.interface = optarg;
+      break;
+    case 'f':
+    case 't':
+      if (parseTime(optarg, option == 'f' ? query.fromNs : query.toNs) < 0) {
+        cerr << "Usage: " << argv[0] << usage << endl;
+        return EXIT_FAILURE;
+      }
+      break;
+    default:
+      cerr << "Usage: " << argv[0] << usage << endl;
+      return EXIT_FAILURE;
+    }
+  }
+  string directory = optind < argc ? argv[optind] : defaultJournalDir;
+
+  vector<string> paths;
+  if (listJournalSegments(directory, paths) < 0) {
+    cerr << "[journalReader.cpp] Unable to read " << directory << ": "
+         << strerror(errno) << endl;
+    return EXIT_FAILURE;
+  }
+
+  // Segments are scanned oldest first; those whose time range misses the
+  // query are skipped by their header alone
+  unordered_map<string, InterfaceCounters> previous;
+  uint64_t printed = 0;
+  size_t scanned = 0;
+  for (const auto &path : paths) {
+    JournalSegment segment;
+    if (mapJournalSegment(path, segment) < 0) {
+      cerr << "[journalReader.cpp] Skipping " << path << ": "
+           << strerror(errno) << endl;
+      continue;
+    }
+    if (segment.count > 0 && segment.header->lastNs >= query.fromNs &&
+        segment.header->firstNs <= query.toNs) {
+      printed += scanSegment(segment, query, previous);
+      ++scanned;
+    }
+    unmapJournalSegment(segment);
+  }
+
+  cerr << "[journalReader.cpp] " << printed << " records from " << scanned
+       << " of " << paths.size() << " segments" << endl;
+  return EXIT_SUCCESS;
+}
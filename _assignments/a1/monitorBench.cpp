@@ -0,0 +1,481 @@
+#include "InterfaceStats.h"
+#include <arpa/inet.h>    // For htonl
+#include <cerrno>         // For errno
+#include <cstdio>         // For snprintf
+#include <cstdlib>        // For atoi
+#include <cstring>        // For strerror
+#include <fcntl.h>        // For open
+#include <iostream>       // For cout and cerr
+#include <netinet/in.h>   // For sockaddr_in
+#include <signal.h>       // For kill and sigaction
+#include <string>         // For string
+#include <sys/resource.h> // For getrusage
+#include <sys/socket.h>   // For socket and sendmmsg
+#include <sys/stat.h>     // For mkdir
+#include <sys/un.h>       // For sockaddr_un
+#include <sys/wait.h>     // For waitpid
+#include <time.h>         // For clock_nanosleep
+#include <unistd.h>       // For fork, pipe, pwrite and close
+#include <vector>         // For vector
+
+using namespace std;
+
+// ========== CONSTANTS ==========
+
+// Defaults of a run: where the synthetic tree goes, its size, how long the
+// pipeline runs and how often it samples
+const char *defaultBenchRoot = "/tmp/monitorBench";
+const int defaultBenchInterfaces = 1000;
+const int defaultBenchSeconds = 10;
+const int defaultBenchIntervalMs = 1000;
+
+// Full-resolution samples networkMonitor keeps per interface during a run
+const char *benchRawSamples = "60";
+
+// Counter files advanced on every tick, relative to an interface directory
+const char *trafficFiles[] = {"statistics/rx_bytes", "statistics/rx_packets",
+                              "statistics/tx_bytes", "statistics/tx_packets"};
+const int trafficFileCount = 4;
+
+// Every other counter file the sysfs backend opens, written once
+const char *staticFiles[] = {"carrier_up_count",     "carrier_down_count",
+                             "statistics/rx_dropped", "statistics/rx_errors",
+                             "statistics/tx_dropped", "statistics/tx_errors"};
+const int staticFileCount = 6;
+
+// Capture run with -c: UDP datagrams of capturePayload bytes are sent over
+// the loopback interface in batches of captureBatch with one sendmmsg()
+const char *captureInterface = "lo";
+const int capturePayload = 64;
+const int captureBatch = 64;
+
+// Query socket of networkMonitor, read before and after a capture run
+const char *querySocketPath = "/tmp/networkMonitor.query";
+
+// ========== GLOBAL VARIABLES ==========
+
+// Cleared by SIGINT to stop a generator started with -g
+volatile sig_atomic_t isGenerating = 1;
+
+// ========== FUNCTION DEFINITIONS ==========
+
+string syntheticName(int index);
+int writeTextFile(const string &path, const char *text);
+int writeCounterFile(const string &path, uint64_t value);
+int createSyntheticTree(const string &root, int interfaceCount);
+void advanceSyntheticTree(const string &root, int interfaceCount,
+                          uint64_t tick);
+pid_t startPipeline(const vector<string> &options, const string &answers);
+int queryTraffic(uint64_t &udpPackets, uint64_t &captureDrops);
+uint64_t blastLoopback(int durationSeconds);
+int runCaptureBench(int durationSeconds, int intervalMs,
+                    const vector<string> &extraOptions);
+void sleepUntil(uint64_t deadlineNs);
+static void signalHandler(int signal);
+
+// ========== CORE FUNCTIONS ==========
+
+// Lay out interfaceCount interfaces under root like /sys/class/net: an "up"
+// operstate and every counter file, all counters starting at zero
+int createSyntheticTree(const string &root, int interfaceCount) {
+  if (mkdir(root.c_str(), 0755) < 0 && errno != EEXIST)
+    return -1;
+
+  for (int i = 0; i < interfaceCount; ++i) {
+    string directory = root + "/" + syntheticName(i);
+    if ((mkdir(directory.c_str(), 0755) < 0 && errno != EEXIST) ||
+        (mkdir((directory + "/statistics").c_str(), 0755) < 0 &&
+         errno != EEXIST))
+      return -1;
+
+    if (writeTextFile(directory + "/operstate", "up\n") < 0)
+      return -1;
+    for (int j = 0; j < staticFileCount; ++j) {
+      if (writeCounterFile(directory + "/" + staticFiles[j], 0) < 0)
+        return -1;
+    }
+    for (int j = 0; j < trafficFileCount; ++j) {
+      if (writeCounterFile(directory + "/" + trafficFiles[j], 0) < 0)
+        return -1;
+    }
+  }
+  return 0;
+}
+
+// Move the traffic counters of every interface to their value at tick.
+// Interface i carries (i % 100 + 1) packets of 1000 bytes per tick each way,
+// so counters only ever grow and rates differ between interfaces
+void advanceSyntheticTree(const string &root, int interfaceCount,
+                          uint64_t tick) {
+  for (int i = 0; i < interfaceCount; ++i) {
+    string directory = root + "/" + syntheticName(i) + "/";
+    uint64_t packets = tick * (i % 100 + 1);
+    writeCounterFile(directory + trafficFiles[0], packets * 1000);
+    writeCounterFile(directory + trafficFiles[1], packets);
+    writeCounterFile(directory + trafficFiles[2], packets * 1000);
+    writeCounterFile(directory + trafficFiles[3], packets);
+  }
+}
+
+// Start networkMonitor with the given command line and answer its prompts
+// with answers
+pid_t startPipeline(const vector<string> &options, const string &answers) {
+  int namePipe[2];
+  if (pipe(namePipe) < 0)
+    return -1;
+
+  pid_t processID = fork();
+  if (processID == 0) {
+    // Child Process
+    // Read the interface names from the pipe and run the whole pipeline
+    dup2(namePipe[0], STDIN_FILENO);
+    close(namePipe[0]);
+    close(namePipe[1]);
+
+    vector<char *> arguments;
+    for (auto &option : options)
+      arguments.push_back(const_cast<char *>(option.c_str()));
+    arguments.push_back(nullptr);
+    execvp(arguments[0], arguments.data());
+    cerr << "[monitorBench.cpp] Failed to execute networkMonitor: "
+         << strerror(errno) << endl;
+    exit(EXIT_FAILURE);
+  } else if (processID < 0) {
+    close(namePipe[0]);
+    close(namePipe[1]);
+    return -1;
+  }
+
+  // Parent Process
+  // Send the answers, then close the pipe
+  close(namePipe[0]);
+  size_t bytesSent = 0;
+  while (bytesSent < answers.size()) {
+    ssize_t result = write(namePipe[1], answers.data() + bytesSent,
+                           answers.size() - bytesSent);
+    if (result < 0 && errno != EINTR)
+      break;
+    if (result > 0)
+      bytesSent += result;
+  }
+  close(namePipe[1]);
+  return processID;
+}
+
+// Read the UDP packets and capture drops counted on the loopback interface
+// from networkMonitor's query socket. Returns -1 until they are available
+int queryTraffic(uint64_t &udpPackets, uint64_t &captureDrops) {
+  int socketFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (socketFd < 0)
+    return -1;
+  struct sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strncpy(address.sun_path, querySocketPath, sizeof(address.sun_path) - 1);
+
+  string request = string("TRAFFIC ") + captureInterface + "\n";
+  string answer;
+  char buffer[4096];
+  if (connect(socketFd, (struct sockaddr *)&address, sizeof(address)) == 0 &&
+      write(socketFd, request.data(), request.size()) ==
+          (ssize_t)request.size()) {
+    // The answer is complete at its END or ERR line
+    while (answer.find("END\n") == string::npos &&
+           answer.compare(0, 3, "ERR") != 0) {
+      ssize_t result = read(socketFd, buffer, sizeof(buffer));
+      if (result <= 0)
+        break;
+      answer.append(buffer, result);
+    }
+  }
+  close(socketFd);
+
+  string udpLine = string(captureInterface) + " udp packets=";
+  string dropLine = string(captureInterface) + " capture_drops=";
+  size_t udp = answer.find(udpLine);
+  size_t drops = answer.find(dropLine);
+  if (udp == string::npos || drops == string::npos)
+    return -1;
+  udpPackets = strtoull(answer.c_str() + udp + udpLine.size(), nullptr, 10);
+  captureDrops = strtoull(answer.c_str() + drops + dropLine.size(), nullptr, 10);
+  return 0;
+}
+
+// Send UDP datagrams as fast as possible over the loopback interface for
+// durationSeconds, to a socket bound for the purpose so no ICMP errors come
+// back. Returns the number of datagrams sent
+uint64_t blastLoopback(int durationSeconds) {
+  int receiverFd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  int senderFd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  struct sockaddr_in address;
+  socklen_t addressLength = sizeof(address);
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (receiverFd < 0 || senderFd < 0 ||
+      bind(receiverFd, (struct sockaddr *)&address, sizeof(address)) < 0 ||
+      getsockname(receiverFd, (struct sockaddr *)&address, &addressLength) <
+          0 ||
+      connect(senderFd, (struct sockaddr *)&address, sizeof(address)) < 0) {
+    cerr << "[monitorBench.cpp] Failed to set up the loopback sockets: "
+         << strerror(errno) << endl;
+    if (receiverFd >= 0)
+      close(receiverFd);
+    if (senderFd >= 0)
+      close(senderFd);
+    return 0;
+  }
+
+  // Every message of a batch sends the same payload
+  char payload[capturePayload];
+  memset(payload, 'x', sizeof(payload));
+  struct iovec data = {payload, sizeof(payload)};
+  struct mmsghdr messages[captureBatch];
+  memset(messages, 0, sizeof(messages));
+  for (int i = 0; i < captureBatch; ++i) {
+    messages[i].msg_hdr.msg_iov = &data;
+    messages[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  // The receiver is never read, datagrams it has no room for are dropped
+  // after the capture saw them
+  uint64_t sent = 0;
+  uint64_t endNs = monotonicTimeNs() + durationSeconds * 1000000000ULL;
+  while (isGenerating && monotonicTimeNs() < endNs) {
+    int result = sendmmsg(senderFd, messages, captureBatch, 0);
+    if (result > 0)
+      sent += result;
+  }
+  close(senderFd);
+  close(receiverFd);
+  return sent;
+}
+
+// Run networkMonitor capturing on the loopback interface, send traffic over
+// it for durationSeconds and compare what was captured with what was sent
+int runCaptureBench(int durationSeconds, int intervalMs,
+                    const vector<string> &extraOptions) {
+  vector<string> options = {"./networkMonitor", "-Q", "-c", "-i",
+                            to_string(intervalMs)};
+  options.insert(options.end(), extraOptions.begin(), extraOptions.end());
+  pid_t pipelinePID =
+      startPipeline(options, string("1\n") + captureInterface + "\n");
+  if (pipelinePID < 0) {
+    cerr << "[monitorBench.cpp] Failed to start networkMonitor: "
+         << strerror(errno) << endl;
+    return -1;
+  }
+
+  // The counters show up once the capture ring is open and a tick passed
+  uint64_t packetsBefore = 0, dropsBefore = 0;
+  uint64_t readyDeadlineNs = monotonicTimeNs() + 10 * 1000000000ULL;
+  while (queryTraffic(packetsBefore, dropsBefore) < 0) {
+    if (monotonicTimeNs() > readyDeadlineNs || !isGenerating) {
+      cerr << "[monitorBench.cpp] No traffic classes for "
+           << captureInterface << ", is intfMonitor allowed to capture?"
+           << endl;
+      kill(pipelinePID, SIGINT);
+      waitpid(pipelinePID, nullptr, 0);
+      return -1;
+    }
+    sleepUntil(monotonicTimeNs() + 100000000ULL);
+  }
+
+  uint64_t startNs = monotonicTimeNs();
+  uint64_t sent = blastLoopback(durationSeconds);
+  double elapsedSeconds = (monotonicTimeNs() - startNs) / 1e9;
+
+  // Two ticks later the last packets are classified and published
+  sleepUntil(monotonicTimeNs() + 2 * intervalMs * 1000000ULL + 100000000ULL);
+  uint64_t packetsAfter = packetsBefore, dropsAfter = dropsBefore;
+  queryTraffic(packetsAfter, dropsAfter);
+
+  kill(pipelinePID, SIGINT);
+  waitpid(pipelinePID, nullptr, 0);
+
+  struct rusage resourceUsage;
+  getrusage(RUSAGE_CHILDREN, &resourceUsage);
+  double cpuSeconds =
+      resourceUsage.ru_utime.tv_sec + resourceUsage.ru_utime.tv_usec / 1e6 +
+      resourceUsage.ru_stime.tv_sec + resourceUsage.ru_stime.tv_usec / 1e6;
+
+  // Other loopback traffic during the run is counted too, so more than
+  // 100% can be captured
+  uint64_t captured = packetsAfter - packetsBefore;
+  char report[256];
+  snprintf(report, sizeof(report),
+           "[monitorBench.cpp] Sent %llu packets in %.1f s (%.0f packets/s), "
+           "captured %llu (%.2f%%), %llu dropped by the ring, pipeline CPU "
+           "%.2f s",
+           (unsigned long long)sent, elapsedSeconds, sent / elapsedSeconds,
+           (unsigned long long)captured,
+           sent > 0 ? captured * 100.0 / sent : 0.0,
+           (unsigned long long)(dropsAfter - dropsBefore), cpuSeconds);
+  cout << report << endl;
+  return 0;
+}
+
+// ========== HELPER FUNCTIONS ==========
+
+// Name of the synthetic interface with the given index
+string syntheticName(int index) { return "syn" + to_string(index); }
+
+// Replace the start of a file with text, creating it if needed
+int writeTextFile(const string &path, const char *text) {
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+  if (fd < 0)
+    return -1;
+  ssize_t result = pwrite(fd, text, strlen(text), 0);
+  close(fd);
+  return result < 0 ? -1 : 0;
+}
+
+// Write a counter the way sysfs shows it. Counters never shrink, so writing
+// over the old value without truncating leaves no stale digits behind
+int writeCounterFile(const string &path, uint64_t value) {
+  char text[32];
+  snprintf(text, sizeof(text), "%llu\n", (unsigned long long)value);
+  return writeTextFile(path, text);
+}
+
+// Sleep until an absolute CLOCK_MONOTONIC time
+void sleepUntil(uint64_t deadlineNs) {
+  struct timespec deadline;
+  deadline.tv_sec = deadlineNs / 1000000000ULL;
+  deadline.tv_nsec = deadlineNs % 1000000000ULL;
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline,
+                         nullptr) == EINTR && isGenerating) {
+  }
+}
+
+// Stop the generator on SIGINT
+static void signalHandler(int signal) {
+  if (signal == SIGINT)
+    isGenerating = 0;
+}
+
+// ==================== MAIN PROGRAM ====================
+int main(int argc, char *argv[]) {
+  const char *usage = " [-g | -c] [-n interfaces] [-d seconds] "
+                      "[-i interval-ms] [-R root] [-- networkMonitor-options]";
+
+  // Parse command line options
+  int option;
+  bool onlyGenerate = false;
+  bool benchesCapture = false;
+  int interfaceCount = defaultBenchInterfaces;
+  int durationSeconds = defaultBenchSeconds;
+  int intervalMs = defaultBenchIntervalMs;
+  string root = defaultBenchRoot;
+  while ((option = getopt(argc, argv, "gcn:d:i:R:")) != -1) {
+    switch (option) {
+    case 'g':
+      // Only keep the synthetic tree advancing, until SIGINT
+      onlyGenerate = true;
+      break;
+    case 'c':
+      // Measure the traffic capture on the loopback interface instead
+      benchesCapture = true;
+      break;
+    case 'n':
+      interfaceCount = atoi(optarg);
+      break;
+    case 'd':
+      durationSeconds = atoi(optarg);
+      break;
+    case 'i':
+      intervalMs = atoi(optarg);
+      break;
+    case 'R':
+      root = optarg;
+      break;
+    default:
+      cerr << "Usage: " << argv[0] << usage << endl;
+      return EXIT_FAILURE;
+    }
+  }
+  if (interfaceCount < 1 || durationSeconds < 1 || intervalMs < 1) {
+    cerr << "Usage: " << argv[0] << usage << endl;
+    return EXIT_FAILURE;
+  }
+
+  // Options after "--" go to networkMonitor unchanged, e.g. -B or -t shm
+  vector<string> extraOptions(argv + optind, argv + argc);
+
+  // Stop the generator, or the traffic of a capture run, on SIGINT
+  struct sigaction sigAction;
+  sigAction.sa_handler = signalHandler;
+  sigemptyset(&sigAction.sa_mask);
+  sigAction.sa_flags = 0;
+  sigaction(SIGINT, &sigAction, nullptr);
+
+  if (benchesCapture) {
+    return runCaptureBench(durationSeconds, intervalMs, extraOptions) < 0
+               ? EXIT_FAILURE
+               : EXIT_SUCCESS;
+  }
+
+  if (createSyntheticTree(root, interfaceCount) < 0) {
+    cerr << "[monitorBench.cpp] Failed to create the synthetic tree in "
+         << root << ": " << strerror(errno) << endl;
+    return EXIT_FAILURE;
+  }
+  cout << "[monitorBench.cpp] " << interfaceCount << " synthetic interfaces in "
+       << root << endl;
+
+  pid_t pipelinePID = -1;
+  if (!onlyGenerate) {
+    // One collector reads the whole synthetic tree
+    vector<string> options = {"./networkMonitor", "-s", "-Q",
+                              "-R", root,         "-i", to_string(intervalMs),
+                              "-r", benchRawSamples};
+    options.insert(options.end(), extraOptions.begin(), extraOptions.end());
+    string answers = to_string(interfaceCount) + "\n";
+    for (int i = 0; i < interfaceCount; ++i)
+      answers += syntheticName(i) + "\n";
+    pipelinePID = startPipeline(options, answers);
+    if (pipelinePID < 0) {
+      cerr << "[monitorBench.cpp] Failed to start networkMonitor: "
+           << strerror(errno) << endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  // Advance the counters once per interval until the run is over
+  uint64_t intervalNs = intervalMs * 1000000ULL;
+  uint64_t startNs = monotonicTimeNs();
+  uint64_t endNs = startNs + durationSeconds * 1000000000ULL;
+  for (uint64_t tick = 1; isGenerating; ++tick) {
+    uint64_t deadlineNs = startNs + tick * intervalNs;
+    if (!onlyGenerate && deadlineNs > endNs)
+      break;
+    sleepUntil(deadlineNs);
+    advanceSyntheticTree(root, interfaceCount, tick);
+  }
+  if (onlyGenerate)
+    return EXIT_SUCCESS;
+
+  // Stop the pipeline; networkMonitor prints its throughput and latency and
+  // reaps intfMonitor before exiting
+  kill(pipelinePID, SIGINT);
+  waitpid(pipelinePID, nullptr, 0);
+  double elapsedSeconds = (monotonicTimeNs() - startNs) / 1e9;
+
+  // Children's usage covers networkMonitor and the intfMonitor it reaped,
+  // not the generator running in this process
+  struct rusage resourceUsage;
+  getrusage(RUSAGE_CHILDREN, &resourceUsage);
+  double cpuSeconds =
+      resourceUsage.ru_utime.tv_sec + resourceUsage.ru_utime.tv_usec / 1e6 +
+      resourceUsage.ru_stime.tv_sec + resourceUsage.ru_stime.tv_usec / 1e6;
+
+  char report[256];
+  snprintf(report, sizeof(report),
+           "[monitorBench.cpp] CPU %.2f s over %.1f s (%.1f%% of a core), "
+           "%.2f us per interface per second, peak RSS %.1f MB",
+           cpuSeconds, elapsedSeconds, cpuSeconds / elapsedSeconds * 100,
+           cpuSeconds / elapsedSeconds / interfaceCount * 1e6,
+           resourceUsage.ru_maxrss / 1024.0);
+  cout << report << endl;
+  return EXIT_SUCCESS;
+}
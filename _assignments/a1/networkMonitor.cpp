@@ -1,48 +1,293 @@
+#include "LatencyHistogram.h"
+#include "MonitorConfig.h"
+#include "MonitorProtocol.h"
+#include "NetlinkStats.h"
+#include "QueryServer.h"
+#include "SampleCodec.h"
+#include "SampleJournal.h"
+#include "ShmRing.h"
+#include "StatsSnapshot.h"
+#include "TimeSeriesStore.h"
+#include "UpstreamForwarder.h"
+#include <algorithm>
+#include <cstdio>
+#include <fcntl.h>
+#include <fnmatch.h>
 #include <iostream>
+#include <map>
 #include <signal.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
 #include <sys/socket.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
 #include <sys/un.h>
 #include <sys/wait.h>
 #include <unistd.h>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 using namespace std;
 
 // ========== CONSTANTS ==========
 
-// Path for the UNIX socket
-const char *socketPath = "/tmp/networkMonitor";
+// Path for the UNIX socket unless the configuration file sets socket_path
+const char *defaultSocketPath = "/tmp/networkMonitor";
+
+// Path for the UNIX socket answering stats and history queries, unless the
+// configuration file sets query_socket
+const char *defaultQuerySocketPath = "/tmp/networkMonitor.query";
+
+// Loopback TCP port serving /metrics unless -m is given, 0 turns it off
+const int defaultMetricsPort = 9511;
 
 // Buffer size for message communication
 const int bufferSize = 256;
 
-// Maximum amount of inerface monitors that can connect to this interface
-const int maxConnections = 10;
+// Connections the kernel queues before they are accepted, unless the
+// configuration file sets max_connections
+const int defaultMaxConnections = SOMAXCONN;
+
+// Full-resolution samples kept per interface unless -r is given
+const size_t defaultRawSamples = 3600;
+
+// Events returned by one epoll_wait() call
+const int maxEpollEvents = 64;
+
+// Handshake message sent by an interface monitor once it connects
+const char readyMessage[] = "ready_to_monitor";
+
+// Bytes requested from a monitor socket per read(), unless the
+// configuration file sets receive_buffer
+const int defaultReceiveBufferSize = 4096;
+
+// Snapshots are published once per sampling interval, 1 s unless -i is
+// given, and never more often than every 10 ms
+const int defaultPublishIntervalMs = 1000;
+const int minPublishIntervalMs = 10;
+
+// Segments of the sample journal written with -J: records per segment
+// (56 MiB each) and segments kept before the oldest is deleted
+const uint64_t journalSegmentRecords = 1 << 19;
+const size_t journalMaxSegments = 16;
+
+// Unacknowledged snapshots kept for a collector given with -U, the oldest
+// dropped first beyond it
+const size_t upstreamReplayBytes = 64 << 20;
+
+// A monitor that dies is started again after a delay doubling with every
+// crash in a row, from restartDelayMs up to maxRestartDelayMs. Running for
+// stableRunMs resets the delay, and crashLoopCrashes crashes in a row are
+// reported as a crash loop
+const uint64_t restartDelayMs = 500;
+const uint64_t maxRestartDelayMs = 60000;
+const uint64_t stableRunMs = 60000;
+const uint32_t crashLoopCrashes = 5;
+
+// A monitor that sends nothing for stallIntervals sampling intervals plus
+// its batch latency, and at least stallMinimumMs, is killed and restarted
+const uint64_t stallIntervals = 10;
+const uint64_t stallMinimumMs = 5000;
+
+// ========== TYPES ==========
+
+// State of one connected interface monitor
+struct MonitorConnection {
+  int socketFd;               // Connected, non-blocking socket
+  bool isStarted;             // Whether the handshake has completed
+  vector<char> receiveBuffer; // Bytes received but not yet framed
+  uint64_t missedTicks;       // Missed ticks last reported by the monitor
+  uint64_t droppedSamples;    // Samples the monitor dropped, last reported
+  vector<int> receivedFds;    // Descriptors received but not yet used
+  ShmRing ring;               // Sample ring of a monitor using shm transport
+  bool hasRing;               // Whether ring is attached
+  bool isRingWatched;         // Whether the ring's eventfd is in epoll
+  uint64_t ringDropped;       // Ring drops already reported
+  unordered_map<uint32_t, string> interfaceNames; // Interface id -> name
+  unordered_map<uint32_t, InterfaceSeries *> interfaceSeries; // Id -> series
+  pid_t pid;                  // Monitor process, from SO_PEERCRED
+  uint64_t lastReceiptNs;     // When anything last arrived from the monitor
+  bool isStallKilled;         // Whether it was killed for being stuck
+  uint32_t reportedIntervalMs;  // Interval in the last status, 0 before one
+  uint32_t requestedIntervalMs; // Interval last sent to the monitor, or 0
+  SampleDecoder decoder;        // Bases of the monitor's delta samples
+};
+
+// An intfMonitor started by this process, restarted whenever it dies while
+// networkMonitor is still running
+struct SupervisedMonitor {
+  vector<string> interfaces;   // Interfaces the monitor samples
+  pid_t pid;                   // Running process, -1 while waiting to restart
+  uint64_t startedNs;          // When the running process was started
+  uint64_t restartAtNs;        // When to start it again, while pid is -1
+  uint32_t consecutiveCrashes; // Crashes without a stable run in between
+  uint32_t totalCrashes;       // Crashes and stalls since startup
+};
 
 // ========== GLOBAL VARIABLES ==========
 
 // Flag to indicate whether the program is running
 bool isRunning = true;
 
+// Run one intfMonitor sampling every interface instead of one per interface
+bool useSingleCollector = false;
+
+// Options passed to every intfMonitor besides the interval, e.g. the
+// transport
+vector<string> monitorOptions;
+
+// Settings in effect, and those given on the command line or at the
+// prompts, which a reload of the configuration file -C is applied over
+MonitorConfig activeConfig;
+MonitorConfig commandLineConfig;
+const char *configPath = nullptr;
+
+// Timer publishing snapshots once per sampling interval
+int publishTimerFd = -1;
+
+// Chunk every monitor socket is read into, receive_buffer bytes
+vector<char> receiveChunk;
+
 // Maintaining a vector of child PIDs since it is easier to clean them up later
 vector<pid_t> childPIDs;
 
+// Connected interface monitors, keyed by socket descriptor
+unordered_map<int, MonitorConnection> monitorConnections;
+
+// Socket descriptor of the connection owning each sample ring's eventfd
+unordered_map<int, int> ringOwners;
+
+// History of every interface reported by any monitor
+TimeSeriesStore timeSeriesStore;
+
+// Interfaces whose monitor was stopped, and how long after its newest sample
+// the history of such an interface is kept before it is evicted, -k
+unordered_set<string> stoppedInterfaces;
+uint64_t historyKeepNs = 0;
+
+// Skip the prompts and per-sample output, e.g. when benchmarking
+bool isQuiet = false;
+
+// With -d, monitor every interface the kernel reports instead of asking,
+// starting and stopping monitors as interfaces appear and disappear
+bool isDiscovering = false;
+
+// Glob patterns of -I and -X selecting discovered interfaces. Without -I
+// every interface is included; -X wins over -I
+vector<string> includePatterns;
+vector<string> excludePatterns;
+
+// Discovered interfaces that have a monitor, and monitors that were told
+// to stop but have not been reaped yet
+unordered_set<string> discoveredMonitors;
+vector<pid_t> stoppingPIDs;
+
+// Every monitor to keep running, keyed by its interfaces joined with
+// spaces, and the key of each running monitor process
+map<string, SupervisedMonitor> supervisedMonitors;
+unordered_map<pid_t, string> supervisedPIDs;
+
+// Timer starting the monitors whose restart delay has passed
+int restartTimerFd = -1;
+
+// Batch latency of the monitors, to tell a stuck monitor from a quiet one
+int monitorBatchLatencyMs = 0;
+
+// Time from each sample being taken to it being handled here, and when the
+// first sample arrived
+LatencyHistogram pipelineLatency;
+uint64_t firstReceiptNs = 0;
+
+// Sampling cost reported by every interface monitor: tick durations, timer
+// lags, and the bytes and CPU time of all the reports added up
+LatencyHistogram collectorDurations;
+LatencyHistogram collectorLags;
+uint64_t collectorBytesSent = 0;
+uint64_t collectorCpuNs = 0;
+
+// Journal every received sample is appended to with -J, written once per
+// publish tick
+const char *journalDir = nullptr;
+SampleJournal sampleJournal;
+
+// Collector every published snapshot is forwarded to with -U
+const char *upstreamTarget = nullptr;
+UpstreamForwarder upstreamForwarder;
+
+// Snapshots of timeSeriesStore read by the query server thread
+SnapshotPublisher snapshotPublisher;
+QueryServer queryServer;
+
 // ========== FUNCTION DEFINITIONS ==========
 
 int initSocketConnection();
+void execMonitor(const vector<string> &interfaceList);
+pid_t startMonitoringForInterface(const string &networkInterface);
+pid_t startCollectorForInterfaces(const vector<string> &interfaceList);
 void monitorNetworkInterfaces(const vector<string> &interfaceList,
                               vector<pid_t> &childProcessIDs);
-void acceptMonitorConnections(int masterSocket, fd_set &masterSet,
-                              int &maxSocket, int monitorSockets[],
-                              int &activeMonitors);
-void processInterfaceMonitorData(int activeInterfaceMonitors,
-                                 int monitorSockets[], fd_set &readSet);
-void cleanupResources(int masterSocket, int activeMonitors,
-                      int monitorSockets[], fd_set &masterSet,
+bool isInterfaceSelected(const string &name);
+void startDiscoveredMonitor(const string &name,
+                            vector<pid_t> &childProcessIDs);
+void stopDiscoveredMonitor(const string &name, vector<pid_t> &childProcessIDs);
+void evictStoppedInterfaces();
+bool isSeriesConnected(const InterfaceSeries *series);
+int discoverInterfaces(vector<pid_t> &childProcessIDs);
+void handleDiscoveryEvents(int linkEventFd, vector<pid_t> &childProcessIDs);
+pid_t superviseMonitor(const vector<string> &interfaceList, pid_t childPID);
+void forgetSupervisedMonitor(const string &key);
+void handleChildExits(vector<pid_t> &childProcessIDs);
+void restartDueMonitors(vector<pid_t> &childProcessIDs);
+void armRestartTimer();
+void killStalledMonitors(unordered_map<int, MonitorConnection> &connections);
+int handleSignals(int signalFd, vector<pid_t> &childProcessIDs);
+pid_t stopMonitor(const string &key, vector<pid_t> &childProcessIDs);
+void reloadConfig(vector<pid_t> &childProcessIDs);
+void applyMonitoredInterfaces(const vector<string> &current,
+                              const vector<string> &next,
+                              vector<pid_t> &childProcessIDs);
+int setPublishInterval(int intervalMs);
+void sendMonitorInterval(MonitorConnection &connection);
+int addToEpoll(int epollFd, int socketFd);
+void acceptMonitorConnections(
+    int masterSocket, int epollFd,
+    unordered_map<int, MonitorConnection> &connections);
+int processInterfaceMonitorData(MonitorConnection &connection);
+int completeHandshake(MonitorConnection &connection);
+void closeMonitorConnection(
+    int epollFd, unordered_map<int, MonitorConnection> &connections,
+    int socketFd);
+int processMonitorFrames(MonitorConnection &connection);
+void attachMonitorRing(MonitorConnection &connection);
+int watchMonitorRing(int epollFd, MonitorConnection &connection);
+void drainMonitorRing(MonitorConnection &connection);
+void handleMonitorFrame(MonitorConnection &connection,
+                        const FrameHeader &header, const char *payload);
+void handleSampleBatch(MonitorConnection &connection,
+                       const FrameHeader &header, const char *payload);
+void handleDeltaSamples(MonitorConnection &connection,
+                        const FrameHeader &header, const char *payload);
+void handleStatsRecord(MonitorConnection &connection, uint32_t interfaceId,
+                       uint64_t timestampNs, const StatsRecord &record);
+void handleDriverStats(MonitorConnection &connection,
+                       const FrameHeader &header, const char *payload);
+void handleTrafficClasses(MonitorConnection &connection,
+                          const FrameHeader &header, const char *payload);
+void handleCollectorMetrics(MonitorConnection &connection,
+                            const FrameHeader &header, const char *payload);
+void printHistorySummary(const TimeSeriesStore &store);
+void printPipelineSummary();
+void printCollectorSummary();
+void reportUpstreamEvent(UPSTREAM_EVENT event);
+void printUpstreamSummary();
+void cleanupResources(int masterSocket, int epollFd,
+                      unordered_map<int, MonitorConnection> &connections,
                       vector<pid_t> &childProcessIDs);
-static void signalHandler(const int signal);
+string monitorKey(const vector<string> &interfaceList);
+string describeMonitor(const SupervisedMonitor &monitor);
+string describeExit(int status);
 
 // ========== CORE FUNCTIONS ==========
 
@@ -73,11 +318,11 @@ int initSocketConnection() {
   socketAddress.sun_family = AF_UNIX;
 
   // Copy the socket path into the address structure, ensuring no overflow
-  strncpy(socketAddress.sun_path, socketPath,
+  strncpy(socketAddress.sun_path, activeConfig.socketPath.c_str(),
           sizeof(socketAddress.sun_path) - 1);
 
   // Remove any existing socket file with the same path to prevent conflicts
-  unlink(socketPath);
+  unlink(activeConfig.socketPath.c_str());
 
   // Bind the master socket to the specified path
   if (bind(masterSocket, (struct sockaddr *)&socketAddress,
@@ -92,6 +337,35 @@ int initSocketConnection() {
   return masterSocket;
 }
 
+// Replace the current process with an intfMonitor for the interfaces. Only
+// returns if the exec failed
+void execMonitor(const vector<string> &interfaceList) {
+  // Build the argument list: program name, options, every interface,
+  // terminator. The interval is the one in effect, it changes on reload
+  string interval = to_string(activeConfig.intervalMs);
+  vector<char *> arguments;
+  arguments.push_back(const_cast<char *>("./intfMonitor"));
+  arguments.push_back(const_cast<char *>("-i"));
+  arguments.push_back(const_cast<char *>(interval.c_str()));
+  if (activeConfig.socketPath != defaultSocketPath) {
+    arguments.push_back(const_cast<char *>("-S"));
+    arguments.push_back(const_cast<char *>(activeConfig.socketPath.c_str()));
+  }
+  for (const auto &monitorOption : monitorOptions)
+    arguments.push_back(const_cast<char *>(monitorOption.c_str()));
+  for (const auto &interfaceName : interfaceList)
+    arguments.push_back(const_cast<char *>(interfaceName.c_str()));
+  arguments.push_back(nullptr);
+
+  // Signals this process takes through its signalfd stay blocked across
+  // fork(), give intfMonitor the default mask back
+  sigset_t noSignals;
+  sigemptyset(&noSignals);
+  sigprocmask(SIG_SETMASK, &noSignals, nullptr);
+
+  execvp(arguments[0], arguments.data());
+}
+
 // Function to fork a child process and run the monitor program for a specific
 // network interface
 pid_t startMonitoringForInterface(const string &networkInterface) {
@@ -100,13 +374,11 @@ pid_t startMonitoringForInterface(const string &networkInterface) {
   if (processID == 0) {
     // Child Process
     // Execute the monitoring program for the network interface
-    if (execlp("./intfMonitor", "./intfMonitor", networkInterface.c_str(),
-               nullptr) == -1) {
-      cerr << "[networkMonitor.cpp] Failed to execute intfMonitor for "
-              "interface '"
-           << networkInterface << "': " << strerror(errno) << endl;
-      exit(EXIT_FAILURE);
-    }
+    execMonitor(vector<string>(1, networkInterface));
+    cerr << "[networkMonitor.cpp] Failed to execute intfMonitor for "
+            "interface '"
+         << networkInterface << "': " << strerror(errno) << endl;
+    exit(EXIT_FAILURE);
   } else if (processID < 0) {
     // Fork Failed
     cerr << "[networkMonitor.cpp] Fork failed for interface '"
@@ -119,15 +391,55 @@ pid_t startMonitoringForInterface(const string &networkInterface) {
   return processID;
 }
 
+// Function to fork a single child process that runs the monitor program for
+// every network interface in the list
+pid_t startCollectorForInterfaces(const vector<string> &interfaceList) {
+  pid_t processID = fork();
+
+  if (processID == 0) {
+    // Child Process
+    // Execute the monitoring program for all network interfaces
+    execMonitor(interfaceList);
+    cerr << "[networkMonitor.cpp] Failed to execute intfMonitor for "
+         << interfaceList.size() << " interfaces: " << strerror(errno) << endl;
+    exit(EXIT_FAILURE);
+  } else if (processID < 0) {
+    // Fork Failed
+    cerr << "[networkMonitor.cpp] Fork failed for interface collector: "
+         << strerror(errno) << endl;
+    return -1;
+  }
+
+  // Parent Process
+  // Return the PID of the child process
+  return processID;
+}
+
 // Function to monitor multiple network interfaces
 void monitorNetworkInterfaces(const vector<string> &interfaceList,
                               vector<pid_t> &childProcessIDs) {
+  // A single collector samples every interface from one process, and there
+  // is nothing to start it for without interfaces
+  if (useSingleCollector) {
+    if (interfaceList.empty())
+      return;
+    pid_t childPID = startCollectorForInterfaces(interfaceList);
+    if (childPID > 0) {
+      childProcessIDs.push_back(superviseMonitor(interfaceList, childPID));
+    } else {
+      cerr << "[networkMonitor.cpp] Skipping monitoring for all interfaces"
+           << endl;
+    }
+    return;
+  }
+
   for (const auto &interfaceName : interfaceList) {
     // Start monitoring and capture the child's PID
     pid_t childPID = startMonitoringForInterface(interfaceName);
     if (childPID > 0) {
-      // If fork was successful, store the child's PID
-      childProcessIDs.push_back(childPID);
+      // If fork was successful, store the child's PID and keep it running
+      childProcessIDs.push_back(
+          superviseMonitor(vector<string>(1, interfaceName), childPID));
     } else {
       // Log error for failure to fork
       cerr << "[networkMonitor.cpp] Skipping monitoring for interface: "
@@ -136,121 +448,1084 @@ void monitorNetworkInterfaces(const vector<string> &interfaceList,
   }
 }
 
-// Accept connections from interface monitors
-void acceptMonitorConnections(
-    int masterSocket,     // The server socket accepting new connections
-    fd_set &masterSet,    // The set of file descriptors for select()
-    int &maxSocket,       // The highest-numbered socket, used by select()
-    int monitorSockets[], // Array to store monitor sockets
-    int &activeMonitors   // Counter for active monitor connections
-) {
-  // Buffer for reading and writing messages
-  char buffer[bufferSize];
+// Start a monitor for a newly discovered interface
+void startDiscoveredMonitor(const string &name,
+                            vector<pid_t> &childProcessIDs) {
+  pid_t childPID = startMonitoringForInterface(name);
+  if (childPID <= 0) {
+    cerr << "[networkMonitor.cpp] Skipping monitoring for interface: " << name
+         << endl;
+    return;
+  }
+  childProcessIDs.push_back(superviseMonitor(vector<string>(1, name), childPID));
+  discoveredMonitors.insert(name);
+  stoppedInterfaces.erase(name);
+  if (!isQuiet)
+    cout << "[networkMonitor.cpp] Interface " << name
+         << " appeared, monitoring it (PID: " << childPID << ")" << endl;
+}
+
+// Stop the monitor of an interface that disappeared. Its history continues
+// if the interface comes back under the same name before it is evicted
+void stopDiscoveredMonitor(const string &name,
+                           vector<pid_t> &childProcessIDs) {
+  if (discoveredMonitors.erase(name) == 0)
+    return;
+  stoppedInterfaces.insert(name);
+
+  pid_t childPID = stopMonitor(name, childProcessIDs);
+  if (childPID > 0 && !isQuiet)
+    cout << "[networkMonitor.cpp] Interface " << name
+         << " disappeared, stopped its monitor (PID: " << childPID << ")"
+         << endl;
+}
 
-  // Accept a new connection from an interface monitor
-  monitorSockets[activeMonitors] = accept(masterSocket, nullptr, nullptr);
+// Dump every link over netlink, monitor the selected ones that have no
+// monitor yet and stop the monitors of links that are gone
+int discoverInterfaces(vector<pid_t> &childProcessIDs) {
+  NetlinkStats netlinkStats;
+  unordered_map<string, InterfaceCounters> links;
+  if (openNetlinkStats(netlinkStats) < 0)
+    return -1;
+  int result = dumpNetlinkStats(netlinkStats, links);
+  closeNetlinkStats(netlinkStats);
+  if (result < 0)
+    return -1;
+
+  vector<string> vanished;
+  for (const auto &monitor : discoveredMonitors) {
+    if (links.find(monitor) == links.end())
+      vanished.push_back(monitor);
+  }
+  for (const auto &name : vanished)
+    stopDiscoveredMonitor(name, childProcessIDs);
+
+  for (const auto &link : links) {
+    if (discoveredMonitors.find(link.first) == discoveredMonitors.end() &&
+        isInterfaceSelected(link.first))
+      startDiscoveredMonitor(link.first, childProcessIDs);
+  }
+  return 0;
+}
 
-  // Exit the function as the connection failed
-  if (monitorSockets[activeMonitors] < 0) {
-    cerr << "[networkMonitor.cpp] Error accepting connection from interface "
-            "monitor: "
+// Start and stop monitors for the links that appeared or disappeared. When
+// notifications were lost, every link is dumped again instead
+void handleDiscoveryEvents(int linkEventFd, vector<pid_t> &childProcessIDs) {
+  vector<LinkEvent> events;
+  if (readLinkEvents(linkEventFd, events) < 0) {
+    if (errno == ENOBUFS && discoverInterfaces(childProcessIDs) == 0)
+      return;
+    cerr << "[networkMonitor.cpp] Failed to read link events: "
          << strerror(errno) << endl;
+  }
+
+  for (const auto &event : events) {
+    bool isMonitored =
+        discoveredMonitors.find(event.name) != discoveredMonitors.end();
+    if (event.isRemoved && isMonitored)
+      stopDiscoveredMonitor(event.name, childProcessIDs);
+    else if (!event.isRemoved && !isMonitored &&
+             isInterfaceSelected(event.name))
+      startDiscoveredMonitor(event.name, childProcessIDs);
+  }
+}
+
+// Keep a freshly started monitor running from now on. Returns its PID
+pid_t superviseMonitor(const vector<string> &interfaceList, pid_t childPID) {
+  string key = monitorKey(interfaceList);
+  SupervisedMonitor &monitor = supervisedMonitors[key];
+  monitor.interfaces = interfaceList;
+  monitor.pid = childPID;
+  monitor.startedNs = monotonicTimeNs();
+  monitor.restartAtNs = 0;
+  monitor.consecutiveCrashes = 0;
+  monitor.totalCrashes = 0;
+  supervisedPIDs[childPID] = key;
+  return childPID;
+}
+
+// Stop restarting a monitor, e.g. because its interface went away
+void forgetSupervisedMonitor(const string &key) {
+  auto monitor = supervisedMonitors.find(key);
+  if (monitor == supervisedMonitors.end())
     return;
+  if (monitor->second.pid > 0)
+    supervisedPIDs.erase(monitor->second.pid);
+  supervisedMonitors.erase(monitor);
+  armRestartTimer();
+}
+
+// Reap every child that exited. Supervised monitors are scheduled for a
+// restart with exponential backoff, and their crashes are counted against
+// the history of their interfaces
+void handleChildExits(vector<pid_t> &childProcessIDs) {
+  int status;
+  pid_t childPID;
+  while ((childPID = waitpid(-1, &status, WNOHANG)) > 0) {
+    childProcessIDs.erase(
+        remove(childProcessIDs.begin(), childProcessIDs.end(), childPID),
+        childProcessIDs.end());
+
+    // Monitors stopped on purpose are done
+    auto stopping = find(stoppingPIDs.begin(), stoppingPIDs.end(), childPID);
+    if (stopping != stoppingPIDs.end()) {
+      stoppingPIDs.erase(stopping);
+      continue;
+    }
+
+    auto key = supervisedPIDs.find(childPID);
+    if (key == supervisedPIDs.end())
+      continue;
+    SupervisedMonitor &monitor = supervisedMonitors[key->second];
+    supervisedPIDs.erase(key);
+
+    // A monitor that ran long enough before dying starts a new series
+    uint64_t nowNs = monotonicTimeNs();
+    if (nowNs - monitor.startedNs >= stableRunMs * 1000000ULL)
+      monitor.consecutiveCrashes = 0;
+    ++monitor.consecutiveCrashes;
+    ++monitor.totalCrashes;
+    uint64_t delayMs =
+        min(maxRestartDelayMs,
+            restartDelayMs << min<uint32_t>(monitor.consecutiveCrashes - 1, 20));
+    monitor.pid = -1;
+    monitor.restartAtNs = nowNs + delayMs * 1000000ULL;
+
+    cerr << "[networkMonitor.cpp] " << describeMonitor(monitor)
+         << " (PID: " << childPID << ") " << describeExit(status)
+         << ", restarting in " << delayMs / 1000.0 << " s (crash "
+         << monitor.consecutiveCrashes << " in a row, "
+         << monitor.totalCrashes << " in total)" << endl;
+    if (monitor.consecutiveCrashes == crashLoopCrashes) {
+      cerr << "[networkMonitor.cpp] " << describeMonitor(monitor)
+           << " is crash-looping" << endl;
+    }
+
+    // Queries and scrapes show how often each interface lost its monitor
+    for (const auto &name : monitor.interfaces) {
+      seriesForInterface(timeSeriesStore, name).monitorRestarts =
+          monitor.totalCrashes;
+      markInterfaceChanged(snapshotPublisher, name);
+    }
   }
+  armRestartTimer();
+}
 
-  // Add the newly accepted socket to the master file descriptor set
-  FD_SET(monitorSockets[activeMonitors], &masterSet);
+// Start every monitor whose restart delay has passed
+void restartDueMonitors(vector<pid_t> &childProcessIDs) {
+  uint64_t nowNs = monotonicTimeNs();
+  for (auto &entry : supervisedMonitors) {
+    SupervisedMonitor &monitor = entry.second;
+    if (monitor.pid > 0 || monitor.restartAtNs > nowNs)
+      continue;
+
+    pid_t childPID = monitor.interfaces.size() == 1 && !useSingleCollector
+                         ? startMonitoringForInterface(monitor.interfaces[0])
+                         : startCollectorForInterfaces(monitor.interfaces);
+    if (childPID <= 0) {
+      // Try again after the longest delay rather than spinning on fork()
+      monitor.restartAtNs = nowNs + maxRestartDelayMs * 1000000ULL;
+      continue;
+    }
+    monitor.pid = childPID;
+    monitor.startedNs = nowNs;
+    supervisedPIDs[childPID] = entry.first;
+    childProcessIDs.push_back(childPID);
+    if (!isQuiet)
+      cout << "[networkMonitor.cpp] Restarted " << describeMonitor(monitor)
+           << " (PID: " << childPID << ")" << endl;
+  }
+  armRestartTimer();
+}
 
-  // Read the initial message (expected to be "Ready") from the client
-  int bytesRead = read(monitorSockets[activeMonitors], buffer, bufferSize - 1);
-  if (bytesRead < 0) {
-    cerr << "[networkMonitor.cpp] Error reading from interface monitor: "
-         << strerror(errno) << endl;
-    // Close the faulty socket and exit
-    close(monitorSockets[activeMonitors]);
+// Set the restart timer to the earliest pending restart, or disarm it
+void armRestartTimer() {
+  if (restartTimerFd < 0)
     return;
+  uint64_t earliestNs = 0;
+  for (const auto &entry : supervisedMonitors) {
+    const SupervisedMonitor &monitor = entry.second;
+    if (monitor.pid <= 0 &&
+        (earliestNs == 0 || monitor.restartAtNs < earliestNs))
+      earliestNs = monitor.restartAtNs;
   }
 
-  // Null-terminate the buffer to safely use it as a C-style string
-  buffer[bytesRead] = '\0';
+  // An absolute expiry at time 0 would disarm the timer, and one in the
+  // past fires at once
+  struct itimerspec timerSpec;
+  memset(&timerSpec, 0, sizeof(timerSpec));
+  if (earliestNs != 0) {
+    earliestNs = max<uint64_t>(earliestNs, 1);
+    timerSpec.it_value.tv_sec = earliestNs / 1000000000ULL;
+    timerSpec.it_value.tv_nsec = earliestNs % 1000000000ULL;
+  }
+  timerfd_settime(restartTimerFd, TFD_TIMER_ABSTIME, &timerSpec, nullptr);
+}
 
-  // Check if the received message is "ready_to_monitor"
-  if (strcmp(buffer, "ready_to_monitor") == 0) {
+// Stop a supervised monitor for good, telling its process to exit. Returns
+// the PID told, or -1 if the monitor was waiting to be restarted
+pid_t stopMonitor(const string &key, vector<pid_t> &childProcessIDs) {
+  // A monitor waiting to be restarted has no process left to stop
+  auto monitor = supervisedMonitors.find(key);
+  pid_t childPID = monitor != supervisedMonitors.end() ? monitor->second.pid
+                                                        : -1;
+  forgetSupervisedMonitor(key);
+  if (childPID <= 0)
+    return -1;
 
-    // Prepare the response message
-    snprintf(buffer, bufferSize, "start_monitoring");
+  childProcessIDs.erase(
+      remove(childProcessIDs.begin(), childProcessIDs.end(), childPID),
+      childProcessIDs.end());
+  if (kill(childPID, SIGUSR1) == -1) {
+    cerr << "[networkMonitor.cpp] Failed to send SIGUSR1 to process "
+         << childPID << ": " << strerror(errno) << endl;
+  }
+  stoppingPIDs.push_back(childPID);
+  return childPID;
+}
+
+// Read the configuration file again and apply what changed: monitors are
+// only started and stopped for interfaces added or removed, and a new
+// interval is sent to the running monitors instead of restarting them. An
+// invalid file leaves everything as it is
+void reloadConfig(vector<pid_t> &childProcessIDs) {
+  if (configPath == nullptr) {
+    cerr << "[networkMonitor.cpp] SIGHUP without -C, nothing to reload"
+         << endl;
+    return;
+  }
+
+  // Settings the file no longer mentions fall back to the command line
+  MonitorConfig next = commandLineConfig;
+  string error;
+  if (loadMonitorConfig(configPath, next, error) < 0) {
+    cerr << "[networkMonitor.cpp] Keeping the current configuration, "
+         << configPath << ": " << error << endl;
+    return;
+  }
+  if (next.intervalMs < minPublishIntervalMs) {
+    cerr << "[networkMonitor.cpp] Keeping the current configuration, "
+         << "interval must be at least " << minPublishIntervalMs << " ms"
+         << endl;
+    return;
+  }
+  if (!hasSameStartupSettings(activeConfig, next)) {
+    cerr << "[networkMonitor.cpp] socket_path, query_socket, "
+            "max_connections and receive_buffer only change on restart"
+         << endl;
+  }
 
-    // Send the message to the client
-    if (write(monitorSockets[activeMonitors], buffer, strlen(buffer) + 1) ==
-        -1) {
-      cerr << "[networkMonitor.cpp] Error writing to interface monitor: "
+  // Sockets and buffers stay as they were set up
+  if (next.intervalMs != activeConfig.intervalMs) {
+    activeConfig.intervalMs = next.intervalMs;
+    if (setPublishInterval(activeConfig.intervalMs) < 0) {
+      cerr << "[networkMonitor.cpp] Failed to change the publish interval: "
            << strerror(errno) << endl;
-      // Close the faulty socket and exit
-      close(monitorSockets[activeMonitors]);
-      return;
     }
-  } else {
-    cerr << "[networkMonitor.cpp] Unexpected message from interface monitor: "
-         << buffer << endl;
-    // Close the faulty socket and exit
-    close(monitorSockets[activeMonitors]);
+    for (auto &connection : monitorConnections)
+      sendMonitorInterval(connection.second);
+    cout << "[networkMonitor.cpp] Sampling interval is now "
+         << activeConfig.intervalMs << " ms" << endl;
+  }
+
+  // A single collector samples every interface, and changing its list would
+  // mean restarting it and losing the history of all of them
+  if (useSingleCollector && !isDiscovering &&
+      next.interfaces != activeConfig.interfaces) {
+    cerr << "[networkMonitor.cpp] interfaces only change on restart with -s"
+         << endl;
+    next.interfaces = activeConfig.interfaces;
+  }
+
+  vector<string> current = activeConfig.interfaces;
+  activeConfig.interfaces = next.interfaces;
+  applyMonitoredInterfaces(current, next.interfaces, childProcessIDs);
+  cout << "[networkMonitor.cpp] Reloaded " << configPath << endl;
+}
+
+// Start and stop monitors to go from the current interfaces to the next.
+// Interfaces in both keep their monitor. A single collector keeps its list,
+// reloadConfig never changes it
+void applyMonitoredInterfaces(const vector<string> &current,
+                              const vector<string> &next,
+                              vector<pid_t> &childProcessIDs) {
+  if (current == next)
+    return;
+  if (isDiscovering) {
+    cerr << "[networkMonitor.cpp] Interfaces are discovered with -d, "
+            "ignoring the configured list"
+         << endl;
     return;
   }
 
-  // Update the maximum socket number for select()
-  maxSocket = max(maxSocket, monitorSockets[activeMonitors]);
+  for (const auto &name : current) {
+    if (find(next.begin(), next.end(), name) != next.end())
+      continue;
+    pid_t childPID = stopMonitor(name, childProcessIDs);
+    stoppedInterfaces.insert(name);
+    cout << "[networkMonitor.cpp] Stopped monitoring " << name;
+    if (childPID > 0)
+      cout << " (PID: " << childPID << ")";
+    cout << endl;
+  }
 
-  // Increment the count of active monitors
-  ++activeMonitors;
+  vector<string> added;
+  for (const auto &name : next) {
+    if (find(current.begin(), current.end(), name) == current.end())
+      added.push_back(name);
+  }
+  monitorNetworkInterfaces(added, childProcessIDs);
+  for (const auto &name : added) {
+    stoppedInterfaces.erase(name);
+    cout << "[networkMonitor.cpp] Started monitoring " << name << endl;
+  }
 }
 
-// Process data received from the interface monitors
-void processInterfaceMonitorData(
-    int activeInterfaceMonitors, // Number of active interface monitors
-    int monitorSockets[],        // Array of sockets for each interface monitor
-    fd_set &readSet              // Set of file descriptors ready for reading
+// Forget the history of every interface whose monitor was stopped once its
+// newest sample is older than -k, so churning interfaces do not pile up.
+// A series a connection still stores into is kept until it closes
+void evictStoppedInterfaces() {
+  uint64_t nowNs = monotonicTimeNs();
+  for (auto name = stoppedInterfaces.begin();
+       name != stoppedInterfaces.end();) {
+    const InterfaceSeries *series = findSeries(timeSeriesStore, *name);
+    if (series != nullptr) {
+      uint64_t newestNs = newestSampleNs(*series);
+      if ((newestNs <= nowNs && nowNs - newestNs < historyKeepNs) ||
+          isSeriesConnected(series)) {
+        ++name;
+        continue;
+      }
+      eraseSeries(timeSeriesStore, *name);
+      markInterfaceChanged(snapshotPublisher, *name);
+    }
+    name = stoppedInterfaces.erase(name);
+  }
+}
+
+// Whether a connection still maps an interface id to the series
+bool isSeriesConnected(const InterfaceSeries *series) {
+  for (const auto &connection : monitorConnections) {
+    for (const auto &entry : connection.second.interfaceSeries) {
+      if (entry.second == series)
+        return true;
+    }
+  }
+  return false;
+}
+
+// Publish snapshots every interval from now on
+int setPublishInterval(int intervalMs) {
+  struct itimerspec publishInterval;
+  publishInterval.it_interval.tv_sec = intervalMs / 1000;
+  publishInterval.it_interval.tv_nsec = intervalMs % 1000 * 1000000L;
+  publishInterval.it_value = publishInterval.it_interval;
+  return timerfd_settime(publishTimerFd, 0, &publishInterval, nullptr);
+}
+
+// Tell a monitor the interval in effect if it samples at another one. Only
+// monitors that have reported a status are told, as before that the
+// start_monitoring reply may still be unread
+void sendMonitorInterval(MonitorConnection &connection) {
+  uint32_t intervalMs = activeConfig.intervalMs;
+  if (connection.reportedIntervalMs == 0 ||
+      connection.reportedIntervalMs == intervalMs ||
+      connection.requestedIntervalMs == intervalMs)
+    return;
+
+  IntervalRecord interval;
+  memset(&interval, 0, sizeof(interval));
+  interval.intervalMs = intervalMs;
+  vector<char> frame;
+  appendFrame(frame, MSG_SET_INTERVAL, collectorInterfaceId, monotonicTimeNs(),
+              &interval, sizeof(interval));
+  if (write(connection.socketFd, frame.data(), frame.size()) !=
+      (ssize_t)frame.size()) {
+    cerr << "[networkMonitor.cpp] Failed to send the interval to the "
+            "interface monitor on socket "
+         << connection.socketFd << ": " << strerror(errno) << endl;
+    return;
+  }
+  connection.requestedIntervalMs = intervalMs;
+}
+
+// Kill every monitor that has sent nothing for far longer than its interval
+// and batch latency; the restart follows from its SIGCHLD
+void killStalledMonitors(unordered_map<int, MonitorConnection> &connections) {
+  uint64_t stallNs =
+      max<uint64_t>(stallMinimumMs,
+                    stallIntervals * activeConfig.intervalMs +
+                        monitorBatchLatencyMs) *
+      1000000ULL;
+  uint64_t nowNs = monotonicTimeNs();
+  for (auto &entry : connections) {
+    MonitorConnection &connection = entry.second;
+    if (connection.isStallKilled || connection.pid <= 0 ||
+        nowNs - connection.lastReceiptNs < stallNs ||
+        supervisedPIDs.find(connection.pid) == supervisedPIDs.end())
+      continue;
+
+    cerr << "[networkMonitor.cpp] Interface monitor on socket "
+         << connection.socketFd << " (PID: " << connection.pid
+         << ") sent nothing for " << (nowNs - connection.lastReceiptNs) / 1e9
+         << " s, killing it" << endl;
+    kill(connection.pid, SIGKILL);
+    connection.isStallKilled = true;
+  }
+}
+
+// Act on every signal queued on the signalfd: reap children, reload the
+// configuration on SIGHUP. Returns -1 once SIGINT asks for shutdown
+int handleSignals(int signalFd, vector<pid_t> &childProcessIDs) {
+  struct signalfd_siginfo info;
+  bool childExited = false;
+  bool isInterrupted = false;
+  bool isReloading = false;
+  while (read(signalFd, &info, sizeof(info)) == sizeof(info)) {
+    if (info.ssi_signo == SIGCHLD)
+      childExited = true;
+    else if (info.ssi_signo == SIGINT)
+      isInterrupted = true;
+    else if (info.ssi_signo == SIGHUP)
+      isReloading = true;
+  }
+
+  // SIGCHLD is not queued per child, reap every exited child at once
+  if (childExited)
+    handleChildExits(childProcessIDs);
+  if (isReloading && !isInterrupted)
+    reloadConfig(childProcessIDs);
+  if (isInterrupted) {
+    cout << endl << "[networkMonitor.cpp] CTRL-C - shutting down" << endl;
+    return -1;
+  }
+  return 0;
+}
+
+// Register a socket for edge-triggered read notifications
+int addToEpoll(int epollFd, int socketFd) {
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+  event.data.fd = socketFd;
+  return epoll_ctl(epollFd, EPOLL_CTL_ADD, socketFd, &event);
+}
+
+// Accept every pending connection from interface monitors. The master socket
+// is edge-triggered, so accept until the queue is empty
+void acceptMonitorConnections(
+    int masterSocket, // The non-blocking server socket
+    int epollFd,      // The epoll instance watching every socket
+    unordered_map<int, MonitorConnection> &connections // Connection table
 ) {
-  char buffer[bufferSize]; // Buffer to store incoming data from monitors
-
-  // Iterate through all active interface monitor sockets
-  for (int i = 0; i < activeInterfaceMonitors; ++i) {
-    // Check if the current socket is ready for reading
-    if (FD_ISSET(monitorSockets[i], &readSet)) {
-      // Clear the buffer to avoid carrying over old data
-      bzero(buffer, bufferSize);
-
-      // Read data from the current monitor socket
-      int bytesRead = read(monitorSockets[i], buffer, bufferSize);
-
-      if (bytesRead > 0) {
-        // Successfully read data; print it to the console
-        cout << "[networkMonitor.cpp] Interface monitor [" << i
-             << "] - Data received: \n"
-             << buffer << endl;
-      } else if (bytesRead == -1) {
-        // Error while reading from the socket
-        cerr << "[networkMonitor.cpp] networkMonitor - Error reading data from "
-                "interface monitor ["
-             << i << "]: " << strerror(errno) << endl;
-      } else if (bytesRead == 0) {
-        // Connection closed by the client
-        cerr << "[networkMonitor.cpp] networkMonitor - Interface monitor [" << i
-             << "] has closed the connection." << endl;
-
-        // Close the socket and mark it as inactive
-        close(monitorSockets[i]);
-        monitorSockets[i] = -1; // Optionally mark the socket as invalid
+  while (true) {
+    // Accept a new connection from an interface monitor
+    int socketFd =
+        accept4(masterSocket, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+    if (socketFd < 0) {
+      // Stop once every pending connection was accepted
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return;
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      cerr << "[networkMonitor.cpp] Error accepting connection from interface "
+              "monitor: "
+           << strerror(errno) << endl;
+      return;
+    }
+
+    // Watch the new socket; the handshake is completed once it is readable
+    if (addToEpoll(epollFd, socketFd) < 0) {
+      cerr << "[networkMonitor.cpp] Error watching interface monitor: "
+           << strerror(errno) << endl;
+      close(socketFd);
+      continue;
+    }
+
+    MonitorConnection &connection = connections[socketFd];
+    connection.socketFd = socketFd;
+    connection.isStarted = false;
+    connection.missedTicks = 0;
+    connection.droppedSamples = 0;
+    connection.receivedFds.clear();
+    connection.hasRing = false;
+    connection.isRingWatched = false;
+    connection.ringDropped = 0;
+    connection.receiveBuffer.clear();
+    connection.interfaceNames.clear();
+    connection.interfaceSeries.clear();
+    connection.lastReceiptNs = monotonicTimeNs();
+    connection.isStallKilled = false;
+    connection.reportedIntervalMs = 0;
+    connection.requestedIntervalMs = 0;
+    initSampleDecoder(connection.decoder);
+
+    // The peer's PID ties the connection to its supervised monitor
+    struct ucred credentials;
+    socklen_t credentialsLength = sizeof(credentials);
+    connection.pid = getsockopt(socketFd, SOL_SOCKET, SO_PEERCRED,
+                                &credentials, &credentialsLength) == 0
+                         ? credentials.pid
+                         : -1;
+  }
+}
+
+// Read everything available on an edge-triggered monitor socket and handle
+// the complete frames. Returns -1 when the connection must be closed
+int processInterfaceMonitorData(MonitorConnection &connection) {
+  char *buffer = receiveChunk.data(); // Chunk the monitor's data is read into
+
+  // Room for the descriptors a monitor passes with SCM_RIGHTS
+  char control[CMSG_SPACE(4 * sizeof(int))];
+
+  while (true) {
+    // Read data, and any descriptors sent with it, from the monitor socket
+    struct iovec data = {buffer, receiveChunk.size()};
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &data;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    int bytesRead = recvmsg(connection.socketFd, &message, MSG_CMSG_CLOEXEC);
+
+    // Keep received descriptors until the frame that uses them is handled
+    if (bytesRead >= 0) {
+      for (struct cmsghdr *controlMessage = CMSG_FIRSTHDR(&message);
+           controlMessage != nullptr;
+           controlMessage = CMSG_NXTHDR(&message, controlMessage)) {
+        if (controlMessage->cmsg_level != SOL_SOCKET ||
+            controlMessage->cmsg_type != SCM_RIGHTS)
+          continue;
+        int fdCount = (controlMessage->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        int *fds = (int *)CMSG_DATA(controlMessage);
+        connection.receivedFds.insert(connection.receivedFds.end(), fds,
+                                      fds + fdCount);
       }
     }
+
+    if (bytesRead > 0) {
+      // Append the data to the reassembly buffer
+      connection.lastReceiptNs = monotonicTimeNs();
+      connection.receiveBuffer.insert(connection.receiveBuffer.end(), buffer,
+                                      buffer + bytesRead);
+    } else if (bytesRead == 0) {
+      // Connection closed by the client
+      cerr << "[networkMonitor.cpp] networkMonitor - Interface monitor on "
+              "socket "
+           << connection.socketFd << " has closed the connection." << endl;
+      return -1;
+    } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      // Everything available has been read
+      break;
+    } else if (errno != EINTR) {
+      // Error while reading from the socket
+      cerr << "[networkMonitor.cpp] networkMonitor - Error reading data from "
+              "interface monitor on socket "
+           << connection.socketFd << ": " << strerror(errno) << endl;
+      return -1;
+    }
+  }
+
+  // The first bytes of a connection are the handshake
+  if (!connection.isStarted) {
+    int result = completeHandshake(connection);
+    if (result <= 0)
+      return result;
+  }
+
+  // Handle every complete frame the buffer now holds
+  if (processMonitorFrames(connection) < 0) {
+    cerr << "[networkMonitor.cpp] Interface monitor on socket "
+         << connection.socketFd
+         << " sent a malformed frame, closing the connection." << endl;
+    return -1;
+  }
+  return 0;
+}
+
+// Answer the ready_to_monitor handshake once it has fully arrived. Returns 1
+// once the monitor was started, 0 while waiting and -1 on failure
+int completeHandshake(MonitorConnection &connection) {
+  const size_t readyLength = strlen(readyMessage);
+  vector<char> &received = connection.receiveBuffer;
+
+  if (received.size() < readyLength)
+    return 0;
+
+  // Check if the received message is "ready_to_monitor"
+  if (memcmp(received.data(), readyMessage, readyLength) != 0) {
+    cerr << "[networkMonitor.cpp] Unexpected message from interface monitor: "
+         << string(received.data(), readyLength) << endl;
+    return -1;
+  }
+  received.erase(received.begin(), received.begin() + readyLength);
+
+  // Send the response message, terminator included. The socket buffer is
+  // empty at this point, so the short message is written in one go
+  const char startMessage[] = "start_monitoring";
+  if (write(connection.socketFd, startMessage, sizeof(startMessage)) !=
+      (ssize_t)sizeof(startMessage)) {
+    cerr << "[networkMonitor.cpp] Error writing to interface monitor: "
+         << strerror(errno) << endl;
+    return -1;
+  }
+
+  connection.isStarted = true;
+  return 1;
+}
+
+// Stop watching a monitor socket, close it and forget its connection
+void closeMonitorConnection(
+    int epollFd, unordered_map<int, MonitorConnection> &connections,
+    int socketFd) {
+  MonitorConnection &connection = connections[socketFd];
+
+  // Release the sample ring and any descriptors that were never used
+  if (connection.hasRing) {
+    if (connection.isRingWatched) {
+      epoll_ctl(epollFd, EPOLL_CTL_DEL, connection.ring.eventFd, nullptr);
+      ringOwners.erase(connection.ring.eventFd);
+    }
+    closeShmRing(connection.ring);
+  }
+  for (int fd : connection.receivedFds)
+    close(fd);
+
+  epoll_ctl(epollFd, EPOLL_CTL_DEL, socketFd, nullptr);
+  close(socketFd);
+  connections.erase(socketFd);
+}
+
+// Handle every complete frame in the reassembly buffer of a connection and
+// keep the trailing partial frame for the next read. Returns -1 if the
+// stream is corrupt
+int processMonitorFrames(MonitorConnection &connection) {
+  FrameHeader header;
+  const char *payload;
+  size_t offset = 0;
+  int result;
+
+  while ((result = extractFrame(connection.receiveBuffer, offset, header,
+                                payload)) > 0) {
+    handleMonitorFrame(connection, header, payload);
   }
+
+  // Drop the consumed bytes, leaving any partial frame at the front
+  connection.receiveBuffer.erase(connection.receiveBuffer.begin(),
+                                 connection.receiveBuffer.begin() + offset);
+  return result;
+}
+
+// Map the sample ring whose memfd and eventfd arrived with MSG_SHM_RING
+void attachMonitorRing(MonitorConnection &connection) {
+  vector<int> &fds = connection.receivedFds;
+  if (connection.hasRing || fds.size() < 2) {
+    cerr << "[networkMonitor.cpp] Interface monitor on socket "
+         << connection.socketFd << " sent an unusable sample ring" << endl;
+    return;
+  }
+
+  if (attachShmRing(connection.ring, fds[0], fds[1]) < 0) {
+    cerr << "[networkMonitor.cpp] Failed to map sample ring of interface "
+            "monitor on socket "
+         << connection.socketFd << ": " << strerror(errno) << endl;
+  } else {
+    connection.hasRing = true;
+  }
+  fds.erase(fds.begin(), fds.begin() + 2);
+}
+
+// Start watching the eventfd of a newly attached ring
+int watchMonitorRing(int epollFd, MonitorConnection &connection) {
+  if (!connection.hasRing || connection.isRingWatched)
+    return 0;
+
+  if (addToEpoll(epollFd, connection.ring.eventFd) < 0)
+    return -1;
+  ringOwners[connection.ring.eventFd] = connection.socketFd;
+  connection.isRingWatched = true;
+
+  // Records may have been published before the eventfd was watched
+  drainMonitorRing(connection);
+  return 0;
+}
+
+// Handle every frame published to a monitor's ring in one batch
+void drainMonitorRing(MonitorConnection &connection) {
+  ShmRing &ring = connection.ring;
+
+  // Reset the eventfd before draining so a later publish wakes us again
+  uint64_t wakeups;
+  if (read(ring.eventFd, &wakeups, sizeof(wakeups)) < 0) {
+    // EAGAIN: nothing was signalled, the ring is drained anyway
+  }
+
+  uint64_t first;
+  uint64_t readable = readableShmRing(ring, first);
+  if (readable > 0)
+    connection.lastReceiptNs = monotonicTimeNs();
+  for (uint64_t i = 0; i < readable; ++i) {
+    const char *slot = peekShmRing(ring, first + i);
+
+    // Validate every header, the slot memory is shared with the producer
+    FrameHeader header;
+    memcpy(&header, slot, sizeof(header));
+    if (header.version != protocolVersion ||
+        header.length > ring.slotSize - sizeof(FrameHeader))
+      continue;
+
+    handleMonitorFrame(connection, header, slot + sizeof(FrameHeader));
+  }
+  releaseShmRing(ring, readable);
+
+  // Report records the producer had to drop because the ring was full
+  uint64_t dropped = ring.header->dropped.load(memory_order_relaxed);
+  if (dropped > connection.ringDropped) {
+    cerr << "[networkMonitor.cpp] Interface monitor on socket "
+         << connection.socketFd << " dropped "
+         << dropped - connection.ringDropped << " records, ring full" << endl;
+    connection.ringDropped = dropped;
+  }
+}
+
+// Act on one frame received from an interface monitor
+void handleMonitorFrame(MonitorConnection &connection,
+                        const FrameHeader &header, const char *payload) {
+  if (header.type == MSG_SHM_RING) {
+    // Samples now arrive through the ring, the socket stays for control
+    attachMonitorRing(connection);
+    return;
+  }
+
+  if (header.type == MSG_INTERFACE_NAME) {
+    // Remember the name and series behind the id for the following stats
+    // frames, so storing a sample needs no lookup by name
+    string name(payload, header.length);
+    connection.interfaceNames[header.interfaceId] = name;
+    connection.interfaceSeries[header.interfaceId] =
+        &seriesForInterface(timeSeriesStore, name);
+    return;
+  }
+
+  if (header.type == MSG_COLLECTOR_STATUS &&
+      header.length == sizeof(CollectorStatus)) {
+    CollectorStatus status;
+    memcpy(&status, payload, sizeof(status));
+
+    // Warn whenever the monitor could not keep up with its interval
+    if (status.missedTicks > connection.missedTicks) {
+      cerr << "[networkMonitor.cpp] Interface monitor on socket "
+           << connection.socketFd << " missed "
+           << status.missedTicks - connection.missedTicks
+           << " sampling ticks of " << status.intervalMs << " ms" << endl;
+    }
+    connection.missedTicks = status.missedTicks;
+
+    // Warn whenever the monitor's outbound queue overflowed because this
+    // process was not reading fast enough
+    if (status.droppedSamples > connection.droppedSamples) {
+      cerr << "[networkMonitor.cpp] Interface monitor on socket "
+           << connection.socketFd << " dropped "
+           << status.droppedSamples - connection.droppedSamples
+           << " samples while its socket was full" << endl;
+    }
+    connection.droppedSamples = status.droppedSamples;
+
+    // A monitor started before the interval was changed is told now
+    connection.reportedIntervalMs = status.intervalMs;
+    sendMonitorInterval(connection);
+    return;
+  }
+
+  auto name = connection.interfaceNames.find(header.interfaceId);
+  string interface = name != connection.interfaceNames.end()
+                         ? name->second
+                         : "#" + to_string(header.interfaceId);
+
+  if (header.type == MSG_LINK_EVENT &&
+      header.length == sizeof(LinkEventRecord)) {
+    LinkEventRecord event;
+    memcpy(&event, payload, sizeof(event));
+
+    // Link changes are reported as soon as they arrive
+    if (isQuiet)
+      return;
+    cout << "[networkMonitor.cpp] Interface " << interface << " link "
+         << (event.isRemoved ? "removed" : operstateName(event.operstate))
+         << (event.hasCarrier ? " (carrier)" : " (no carrier)") << endl;
+    return;
+  }
+
+  if (header.type == MSG_SAMPLE_BATCH) {
+    handleSampleBatch(connection, header, payload);
+    return;
+  }
+
+  if (header.type == MSG_DELTA_SAMPLES) {
+    handleDeltaSamples(connection, header, payload);
+    return;
+  }
+
+  if (header.type == MSG_COLLECTOR_METRICS) {
+    handleCollectorMetrics(connection, header, payload);
+    return;
+  }
+
+  if (header.type == MSG_DRIVER_STAT_NAMES ||
+      header.type == MSG_DRIVER_STATS) {
+    handleDriverStats(connection, header, payload);
+    return;
+  }
+
+  if ((header.type == MSG_TRAFFIC_CLASSES &&
+       header.length == sizeof(TrafficRecord)) ||
+      (header.type == MSG_TOP_FLOWS && header.length % sizeof(FlowRecord) == 0 &&
+       header.length <= maxTopFlows * sizeof(FlowRecord))) {
+    handleTrafficClasses(connection, header, payload);
+    return;
+  }
+
+  if (header.type != MSG_INTERFACE_STATS || header.length != sizeof(StatsRecord))
+    return;
+
+  StatsRecord record;
+  memcpy(&record, payload, sizeof(record));
+  handleStatsRecord(connection, header.interfaceId, header.timestampNs, record);
+}
+
+// Unpack every sample of a batch frame in a single pass over its payload
+void handleSampleBatch(MonitorConnection &connection,
+                       const FrameHeader &header, const char *payload) {
+  if (header.length < sizeof(BatchHeader))
+    return;
+
+  BatchHeader batch;
+  memcpy(&batch, payload, sizeof(batch));
+
+  // A count that disagrees with the frame length means a corrupt batch
+  if (batch.count > maxBatchSamples ||
+      header.length !=
+          sizeof(BatchHeader) + batch.count * sizeof(BatchedSample)) {
+    cerr << "[networkMonitor.cpp] Malformed sample batch on socket "
+         << connection.socketFd << endl;
+    return;
+  }
+
+  const char *position = payload + sizeof(BatchHeader);
+  for (uint32_t i = 0; i < batch.count; ++i) {
+    BatchedSample sample;
+    memcpy(&sample, position, sizeof(sample));
+    position += sizeof(sample);
+    handleStatsRecord(connection, sample.interfaceId, sample.timestampNs,
+                      sample.record);
+  }
+}
+
+// Expand delta-encoded samples against the previous ones of their
+// interfaces and store them. Deltas whose base was lost are skipped until
+// the monitor sends a keyframe
+void handleDeltaSamples(MonitorConnection &connection,
+                        const FrameHeader &header, const char *payload) {
+  static vector<BatchedSample> samples;
+  uint64_t discarded = connection.decoder.discarded;
+  if (decodeSamples(connection.decoder, header.timestampNs, payload,
+                    header.length, samples) < 0) {
+    cerr << "[networkMonitor.cpp] Malformed delta samples on socket "
+         << connection.socketFd << endl;
+    return;
+  }
+  if (connection.decoder.discarded > discarded) {
+    cerr << "[networkMonitor.cpp] Interface monitor on socket "
+         << connection.socketFd << " sent "
+         << connection.decoder.discarded - discarded
+         << " delta samples without their base, waiting for a keyframe"
+         << endl;
+  }
+
+  for (const auto &sample : samples)
+    handleStatsRecord(connection, sample.interfaceId, sample.timestampNs,
+                      sample.record);
+}
+
+// Keep the driver statistic names of an interface, or its latest values.
+// Only the latest values are kept, they are served to queries and scrapes
+// but not stored as history
+void handleDriverStats(MonitorConnection &connection,
+                       const FrameHeader &header, const char *payload) {
+  auto series = connection.interfaceSeries.find(header.interfaceId);
+  if (series == connection.interfaceSeries.end())
+    return;
+  InterfaceSeries &interfaceSeries = *series->second;
+
+  if (header.type == MSG_DRIVER_STAT_NAMES) {
+    auto names = make_shared<vector<string>>();
+    for (size_t offset = 0; offset < header.length;) {
+      size_t length = strnlen(payload + offset, header.length - offset);
+      names->push_back(string(payload + offset, length));
+      offset += length + 1;
+    }
+    interfaceSeries.driverStatNames = move(names);
+    interfaceSeries.driverStats.assign(interfaceSeries.driverStatNames->size(),
+                                       0);
+    return;
+  }
+
+  // Values sent before the latest names no longer line up with them
+  if (!interfaceSeries.driverStatNames ||
+      header.length !=
+          interfaceSeries.driverStatNames->size() * sizeof(uint64_t))
+    return;
+  memcpy(interfaceSeries.driverStats.data(), payload, header.length);
+  markInterfaceChanged(snapshotPublisher,
+                       connection.interfaceNames[header.interfaceId]);
+}
+
+// Keep the latest traffic classes or top flows of an interface. Like the
+// driver statistics they are served without history
+void handleTrafficClasses(MonitorConnection &connection,
+                          const FrameHeader &header, const char *payload) {
+  auto series = connection.interfaceSeries.find(header.interfaceId);
+  if (series == connection.interfaceSeries.end())
+    return;
+  InterfaceSeries &interfaceSeries = *series->second;
+
+  if (header.type == MSG_TOP_FLOWS) {
+    // The payload sits at any offset of the receive buffer, so the records
+    // are copied out rather than read in place
+    interfaceSeries.topFlows.resize(header.length / sizeof(FlowRecord));
+    memcpy(interfaceSeries.topFlows.data(), payload,
+           interfaceSeries.topFlows.size() * sizeof(FlowRecord));
+  } else {
+    memcpy(&interfaceSeries.traffic, payload, sizeof(TrafficRecord));
+    interfaceSeries.hasTraffic = true;
+  }
+  markInterfaceChanged(snapshotPublisher,
+                       connection.interfaceNames[header.interfaceId]);
+}
+
+// Add a monitor's report on its own sampling cost to the totals, and print
+// it unless quiet
+void handleCollectorMetrics(MonitorConnection &connection,
+                            const FrameHeader &header, const char *payload) {
+  if (header.length < sizeof(CollectorMetrics))
+    return;
+  CollectorMetrics metrics;
+  memcpy(&metrics, payload, sizeof(metrics));
+  if (header.length != sizeof(CollectorMetrics) +
+                           ((uint64_t)metrics.durationBuckets +
+                            metrics.lagBuckets) *
+                               sizeof(HistogramEntry) ||
+      metrics.periodNs == 0)
+    return;
+
+  // Rebuild the report's histograms, then fold them into the totals
+  static LatencyHistogram durations;
+  static LatencyHistogram lags;
+  clearLatencyHistogram(durations);
+  clearLatencyHistogram(lags);
+  const char *position = payload + sizeof(CollectorMetrics);
+  for (uint32_t i = 0; i < metrics.durationBuckets + metrics.lagBuckets; ++i) {
+    HistogramEntry entry;
+    memcpy(&entry, position, sizeof(entry));
+    position += sizeof(entry);
+    LatencyHistogram &histogram =
+        i < metrics.durationBuckets ? durations : lags;
+    addLatencyBucket(histogram, entry.bucket, entry.count);
+    addLatencyBucket(i < metrics.durationBuckets ? collectorDurations
+                                                 : collectorLags,
+                     entry.bucket, entry.count);
+  }
+  durations.sum = metrics.durationSumNs;
+  durations.maximum = metrics.durationMaxNs;
+  lags.sum = metrics.lagSumNs;
+  lags.maximum = metrics.lagMaxNs;
+  collectorDurations.sum += metrics.durationSumNs;
+  collectorDurations.maximum =
+      max(collectorDurations.maximum, metrics.durationMaxNs);
+  collectorLags.sum += metrics.lagSumNs;
+  collectorLags.maximum = max(collectorLags.maximum, metrics.lagMaxNs);
+  collectorBytesSent += metrics.bytesSent;
+  collectorCpuNs += metrics.cpuUserNs + metrics.cpuSystemNs;
+  if (isQuiet)
+    return;
+
+  double seconds = metrics.periodNs / 1e9;
+  char report[bufferSize];
+  snprintf(report, sizeof(report),
+           "[networkMonitor.cpp] Interface monitor on socket %d: %llu ticks, "
+           "sampling p50 %.1f us p99 %.1f us max %.1f us, timer lag p99 "
+           "%.1f us, CPU %.2f%% user %.2f%% system, %.0f bytes/s",
+           connection.socketFd, (unsigned long long)durations.count,
+           latencyPercentile(durations, 50) / 1e3,
+           latencyPercentile(durations, 99) / 1e3, durations.maximum / 1e3,
+           latencyPercentile(lags, 99) / 1e3,
+           metrics.cpuUserNs / 1e7 / seconds,
+           metrics.cpuSystemNs / 1e7 / seconds, metrics.bytesSent / seconds);
+  cout << report << endl;
+}
+
+// Store one sample of an interface and print its statistics
+void handleStatsRecord(MonitorConnection &connection, uint32_t interfaceId,
+                       uint64_t timestampNs, const StatsRecord &record) {
+  auto name = connection.interfaceNames.find(interfaceId);
+  string interface = name != connection.interfaceNames.end()
+                         ? name->second
+                         : "#" + to_string(interfaceId);
+
+  // Keep the sample in the interface's history, and on disk with -J
+  auto series = connection.interfaceSeries.find(interfaceId);
+  if (series != connection.interfaceSeries.end()) {
+    appendSample(*series->second, timestampNs, record);
+    markInterfaceChanged(snapshotPublisher, interface);
+  }
+  if (sampleJournal.fd >= 0)
+    addJournalRecord(sampleJournal, interface, timestampNs, record);
+
+  // Measure how long the sample took to get here
+  uint64_t nowNs = monotonicTimeNs();
+  recordLatency(pipelineLatency, nowNs > timestampNs ? nowNs - timestampNs : 0);
+  if (firstReceiptNs == 0)
+    firstReceiptNs = nowNs;
+
+  if (isQuiet)
+    return;
+
+  // Print the statistics of the interface
+  cout << "Interface: " << interface
+       << " state: "
+       << ((record.flags & STATS_PRESENT) ? operstateName(record.operstate)
+                                          : "missing")
+       << " up_count: " << record.counters[STAT_CARRIER_UP_COUNT]
+       << " down_count: " << record.counters[STAT_CARRIER_DOWN_COUNT] << "\n"
+       << " rx_bytes: " << record.counters[STAT_RX_BYTES]
+       << " rx_dropped: " << record.counters[STAT_RX_DROPPED]
+       << " rx_errors: " << record.counters[STAT_RX_ERRORS]
+       << " rx_packets: " << record.counters[STAT_RX_PACKETS] << "\n"
+       << " tx_bytes: " << record.counters[STAT_TX_BYTES]
+       << " tx_dropped: " << record.counters[STAT_TX_DROPPED]
+       << " tx_errors: " << record.counters[STAT_TX_ERRORS]
+       << " tx_packets: " << record.counters[STAT_TX_PACKETS] << "\n";
+
+  if (record.flags & STATS_RATES_VALID) {
+    char rateLine[bufferSize];
+    snprintf(rateLine, sizeof(rateLine),
+             " rx_bytes/s: %.1f rx_packets/s: %.1f tx_bytes/s: %.1f "
+             "tx_packets/s: %.1f%s\n",
+             record.rates[STAT_RX_BYTES], record.rates[STAT_RX_PACKETS],
+             record.rates[STAT_TX_BYTES], record.rates[STAT_TX_PACKETS],
+             (record.flags & STATS_COUNTER_RESET) ? " (counter reset)" : "");
+    cout << rateLine;
+  }
+  cout << flush;
 }
 
 // Clean up resources and notify interface monitors before shutdown
 void cleanupResources(
-    int masterSocket,     // The master socket to be closed
-    int activeMonitors,   // Number of active monitor sockets
-    int monitorSockets[], // Array of monitor sockets to be cleaned up
-    fd_set &masterSet,    // Set of file descriptors for active sockets
+    int masterSocket, // The master socket to be closed
+    int epollFd,      // The epoll instance watching every socket
+    unordered_map<int, MonitorConnection> &connections, // Connections to close
     vector<pid_t> &childProcessIDs) {
   // Terminate child processes gracefully
   for (pid_t pid : childProcessIDs) {
@@ -270,15 +1545,23 @@ void cleanupResources(
   }
 
   // Handle monitor sockets
-  for (int i = 0; i < activeMonitors; ++i) {
-    // Remove socket from the master set
-    FD_CLR(monitorSockets[i], &masterSet);
+  for (auto &entry : connections) {
+    // Release the sample ring and unused descriptors of the connection
+    if (entry.second.hasRing)
+      closeShmRing(entry.second.ring);
+    for (int fd : entry.second.receivedFds)
+      close(fd);
 
     // Close the monitor socket
-    close(monitorSockets[i]);
-    cout << "[networkMonitor.cpp] Closed monitor socket " << monitorSockets[i]
+    close(entry.first);
+    cout << "[networkMonitor.cpp] Closed monitor socket " << entry.first
          << endl;
   }
+  connections.clear();
+
+  // Close the epoll instance
+  if (epollFd >= 0)
+    close(epollFd);
 
   // Close the master socket
   close(masterSocket);
@@ -286,7 +1569,7 @@ void cleanupResources(
 
   // Unlink the socket path to remove the file created for the UNIX domain
   // socket
-  if (unlink(socketPath) == -1) {
+  if (unlink(activeConfig.socketPath.c_str()) == -1) {
     cerr << "[networkMonitor.cpp] Failed to unlink socket path: "
          << strerror(errno) << endl;
   } else {
@@ -296,118 +1579,548 @@ void cleanupResources(
 
 // ========== UTILITY FUNCTIONS ==========
 
-// Handle termination signal (e.g., Ctrl+C)
-static void signalHandler(const int signal) {
-  // Set the running flag to false to exit the main loop if SIGINT (Ctrl+C) is
-  // received
-  if (signal == SIGINT) {
-    cout << endl << "[networkMonitor.cpp] CTRL-C - shutting down" << endl;
-    isRunning = false;
-  } else {
-    cout << endl << "[networkMonitor.cpp] undefined signal" << endl;
+// Whether a discovered interface matches the -I and -X patterns
+bool isInterfaceSelected(const string &name) {
+  for (const auto &pattern : excludePatterns) {
+    if (fnmatch(pattern.c_str(), name.c_str(), 0) == 0)
+      return false;
   }
+  if (includePatterns.empty())
+    return true;
+  for (const auto &pattern : includePatterns) {
+    if (fnmatch(pattern.c_str(), name.c_str(), 0) == 0)
+      return true;
+  }
+  return false;
+}
+
+// Key of a supervised monitor: its interfaces joined with spaces
+string monitorKey(const vector<string> &interfaceList) {
+  string key;
+  for (const auto &name : interfaceList) {
+    if (!key.empty())
+      key += ' ';
+    key += name;
+  }
+  return key;
+}
+
+// Name of a monitor for log messages
+string describeMonitor(const SupervisedMonitor &monitor) {
+  if (monitor.interfaces.size() == 1)
+    return "Monitor of " + monitor.interfaces[0];
+  return "Collector of " + to_string(monitor.interfaces.size()) +
+         " interfaces";
+}
+
+// How a child ended, from its waitpid() status
+string describeExit(int status) {
+  if (WIFSIGNALED(status))
+    return "was killed by signal " + to_string(WTERMSIG(status)) + " (" +
+           strsignal(WTERMSIG(status)) + ")";
+  return "exited with status " + to_string(WEXITSTATUS(status));
+}
+
+// Print the traffic of every interface over the last hour from the store
+void printHistorySummary(const TimeSeriesStore &store) {
+  const uint64_t hourNs = 3600ULL * 1000000000ULL;
+  uint64_t nowNs = monotonicTimeNs();
+  uint64_t fromNs = nowNs > hourNs ? nowNs - hourNs : 0;
+
+  for (const auto &entry : store.interfaces) {
+    RangeAggregate rx, tx;
+    if (!aggregateRange(entry.second, STAT_RX_BYTES, fromNs, nowNs, rx) ||
+        !aggregateRange(entry.second, STAT_TX_BYTES, fromNs, nowNs, tx))
+      continue;
+
+    char summary[bufferSize];
+    snprintf(summary, sizeof(summary),
+             "[networkMonitor.cpp] %s last hour: rx_bytes/s avg %.1f max %.1f"
+             ", tx_bytes/s avg %.1f max %.1f (%llu samples)",
+             entry.first.c_str(), rx.average, rx.maximum, tx.average,
+             tx.maximum, (unsigned long long)rx.samples);
+    cout << summary << endl;
+  }
+}
+
+// Print how many samples reached networkMonitor, how fast, and the
+// percentiles of their latency from being taken to being handled
+void printPipelineSummary() {
+  if (pipelineLatency.count == 0)
+    return;
+
+  // Throughput counts from the first sample until shutdown
+  double seconds = (monotonicTimeNs() - firstReceiptNs) / 1e9;
+  char summary[bufferSize];
+  snprintf(summary, sizeof(summary),
+           "[networkMonitor.cpp] Pipeline: %llu samples, %.1f samples/s, "
+           "latency p50 %.1f us p90 %.1f us p99 %.1f us max %.1f us",
+           (unsigned long long)pipelineLatency.count,
+           seconds > 0 ? pipelineLatency.count / seconds : 0.0,
+           latencyPercentile(pipelineLatency, 50) / 1e3,
+           latencyPercentile(pipelineLatency, 90) / 1e3,
+           latencyPercentile(pipelineLatency, 99) / 1e3,
+           pipelineLatency.maximum / 1e3);
+  cout << summary << endl;
+}
+
+// Print the sampling cost every interface monitor reported, all together
+void printCollectorSummary() {
+  if (collectorDurations.count == 0)
+    return;
+
+  // CPU and bytes are spread over the time since the first sample
+  double seconds = (monotonicTimeNs() - firstReceiptNs) / 1e9;
+  char summary[bufferSize];
+  snprintf(summary, sizeof(summary),
+           "[networkMonitor.cpp] Collectors: %llu ticks, sampling p50 %.1f us "
+           "p90 %.1f us p99 %.1f us max %.1f us, timer lag p99 %.1f us, "
+           "CPU %.2f%% of a core, %.0f bytes/s",
+           (unsigned long long)collectorDurations.count,
+           latencyPercentile(collectorDurations, 50) / 1e3,
+           latencyPercentile(collectorDurations, 90) / 1e3,
+           latencyPercentile(collectorDurations, 99) / 1e3,
+           collectorDurations.maximum / 1e3,
+           latencyPercentile(collectorLags, 99) / 1e3,
+           seconds > 0 ? collectorCpuNs / 1e7 / seconds : 0.0,
+           seconds > 0 ? collectorBytesSent / seconds : 0.0);
+  cout << summary << endl;
+}
+
+// Tell when the collector connection comes up or goes down
+void reportUpstreamEvent(UPSTREAM_EVENT event) {
+  if (event == UPSTREAM_CONNECTED)
+    cout << "[networkMonitor.cpp] Forwarding snapshots to "
+         << upstreamForwarder.target << ", "
+         << upstreamForwarder.replay.size() << " waiting" << endl;
+  else if (event == UPSTREAM_DISCONNECTED)
+    cerr << "[networkMonitor.cpp] Collector " << upstreamForwarder.target
+         << " unavailable: " << strerror(upstreamForwarder.lastError)
+         << ", retrying in " << upstreamForwarder.retryDelayMs << " ms"
+         << endl;
+}
+
+// Print how many snapshots reached the collector
+void printUpstreamSummary() {
+  char summary[bufferSize];
+  snprintf(summary, sizeof(summary),
+           "[networkMonitor.cpp] Upstream: %llu snapshots, %llu acknowledged, "
+           "%llu replayed, %llu dropped, %zu unacknowledged",
+           (unsigned long long)upstreamForwarder.forwarded,
+           (unsigned long long)upstreamForwarder.ackedSequence,
+           (unsigned long long)upstreamForwarder.replayed,
+           (unsigned long long)upstreamForwarder.dropped,
+           upstreamForwarder.replay.size());
+  cout << summary << endl;
 }
 
 // ==================== MAIN PROGRAM ====================
-int main() {
-  // Declare a variable to store the number of interfaces to monitor
-  int numInterfaces;
-  cout << "Please specify the number of interfaces to monitor: ";
-  cin >> numInterfaces;
+int main(int argc, char *argv[]) {
+  // Parse command line options
+  int option;
+  size_t rawSamples = defaultRawSamples;
+  uint64_t keepSeconds = 0;
+  int metricsPort = defaultMetricsPort;
+  commandLineConfig.socketPath = defaultSocketPath;
+  commandLineConfig.querySocketPath = defaultQuerySocketPath;
+  commandLineConfig.maxConnections = defaultMaxConnections;
+  commandLineConfig.receiveBufferSize = defaultReceiveBufferSize;
+  commandLineConfig.intervalMs = defaultPublishIntervalMs;
+  while ((option = getopt(argc, argv, "si:t:r:k:B:L:q:o:R:Qm:dI:X:ecfC:w:J:U:")) !=
+         -1) {
+    switch (option) {
+    case 's':
+      // Sample every interface from one intfMonitor process
+      useSingleCollector = true;
+      break;
+    case 'i':
+      // Sampling interval in milliseconds, which also paces the snapshots
+      // published to queries
+      commandLineConfig.intervalMs = atoi(optarg);
+      break;
+    case 'C':
+      // Configuration file, read again on SIGHUP
+      configPath = optarg;
+      break;
+    case 'J':
+      // Directory of the sample journal
+      journalDir = optarg;
+      break;
+    case 'U':
+      // Central collector, host[:port]
+      upstreamTarget = optarg;
+      break;
+    case 't':
+      // Transport of the samples, socket or shm, validated by intfMonitor
+      monitorOptions.push_back("-t");
+      monitorOptions.push_back(optarg);
+      break;
+    case 'L':
+      // Longest a batched sample may wait, also delays a monitor's frames
+      monitorBatchLatencyMs = max(atoi(optarg), 0);
+      monitorOptions.push_back("-L");
+      monitorOptions.push_back(optarg);
+      break;
+    case 'B':
+    case 'q':
+    case 'o':
+    case 'R':
+    case 'w':
+      // Batching, outbound queue, stats root and sample encoding, validated
+      // by intfMonitor
+      monitorOptions.push_back(string("-") + (char)option);
+      monitorOptions.push_back(optarg);
+      break;
+    case 'e':
+      // Driver and per-queue statistics, passed on to intfMonitor
+      monitorOptions.push_back("-e");
+      break;
+    case 'c':
+      // Traffic classes from a capture ring, passed on to intfMonitor
+      monitorOptions.push_back("-c");
+      break;
+    case 'f':
+      // Top talkers from the same capture, passed on to intfMonitor
+      monitorOptions.push_back("-f");
+      break;
+    case 'Q':
+      // Only warnings and the pipeline summary are printed
+      isQuiet = true;
+      break;
+    case 'd':
+      // Discover interfaces over netlink instead of asking for them
+      isDiscovering = true;
+      break;
+    case 'I':
+      includePatterns.push_back(optarg);
+      break;
+    case 'X':
+      excludePatterns.push_back(optarg);
+      break;
+    case 'm':
+      // Port of the Prometheus endpoint on 127.0.0.1, 0 to disable it
+      metricsPort = atoi(optarg);
+      if (metricsPort < 0 || metricsPort > 65535) {
+        cerr << "[networkMonitor.cpp] -m needs a port from 0 to 65535"
+             << endl;
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'r':
+      // Full-resolution samples kept per interface
+      rawSamples = strtoul(optarg, nullptr, 10);
+      if (rawSamples == 0) {
+        cerr << "[networkMonitor.cpp] -r needs a positive sample count"
+             << endl;
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'k':
+      // Seconds the history of an interface no longer monitored is kept
+      keepSeconds = strtoull(optarg, nullptr, 10);
+      if (keepSeconds == 0 ||
+          keepSeconds > longestRetentionNs() / 1000000000ULL) {
+        cerr << "[networkMonitor.cpp] -k needs a number of seconds from 1 to "
+             << longestRetentionNs() / 1000000000ULL << endl;
+        return EXIT_FAILURE;
+      }
+      break;
+    default:
+      cerr << "Usage: " << argv[0]
+           << " [-s] [-i interval-ms] [-t socket|shm] [-r raw-samples]"
+           << " [-k keep-seconds]"
+           << " [-B batch-samples] [-L latency-ms] [-q queue-frames]"
+           << " [-o drop-oldest|coalesce] [-R stats-root] [-w full|delta]"
+           << " [-Q] [-e] [-c] [-f]"
+           << " [-m metrics-port] [-d [-I include-glob]... [-X exclude-glob]...]"
+           << " [-C config-file] [-J journal-dir] [-U collector[:port]]"
+           << endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  // Interfaces come and go one at a time, so each gets its own monitor.
+  // Discovered monitors only observe, they never bring interfaces up
+  if (isDiscovering && useSingleCollector) {
+    cerr << "[networkMonitor.cpp] -d runs one intfMonitor per interface and "
+            "cannot be combined with -s"
+         << endl;
+    return EXIT_FAILURE;
+  }
+  if (isDiscovering)
+    monitorOptions.push_back("-n");
+
+  // Settings in the configuration file win over the command line
+  activeConfig = commandLineConfig;
+  if (configPath != nullptr) {
+    string error;
+    if (loadMonitorConfig(configPath, activeConfig, error) < 0) {
+      cerr << "[networkMonitor.cpp] Failed to read " << configPath << ": "
+           << error << endl;
+      return EXIT_FAILURE;
+    }
+  }
+  if (activeConfig.intervalMs < minPublishIntervalMs) {
+    cerr << "[networkMonitor.cpp] Sampling interval must be at least "
+         << minPublishIntervalMs << " ms" << endl;
+    return EXIT_FAILURE;
+  }
+  if (isDiscovering && !activeConfig.interfaces.empty()) {
+    cerr << "[networkMonitor.cpp] Interfaces are discovered with -d, "
+            "ignoring the configured list"
+         << endl;
+    activeConfig.interfaces.clear();
+  }
+  receiveChunk.resize(activeConfig.receiveBufferSize);
+
+  // Samples are kept across runs only with -J
+  sampleJournal.fd = -1;
+  if (journalDir != nullptr &&
+      openSampleJournal(sampleJournal, journalDir, journalSegmentRecords,
+                        journalMaxSegments) < 0) {
+    cerr << "[networkMonitor.cpp] Unable to journal to " << journalDir
+         << ": " << strerror(errno) << endl;
+    return EXIT_FAILURE;
+  }
+
+  // History kept for every interface, bounded whatever the uptime
+  initTimeSeriesStore(timeSeriesStore, rawSamples);
+  historyKeepNs =
+      keepSeconds > 0 ? keepSeconds * 1000000000ULL : longestRetentionNs();
+  initSnapshotPublisher(snapshotPublisher);
+
+  // Declare a variable to store the number of interfaces to monitor, only
+  // asked for when the configuration file lists none
+  int numInterfaces = 0;
+  if (!isDiscovering && activeConfig.interfaces.empty()) {
+    if (!isQuiet)
+      cout << "Please specify the number of interfaces to monitor: ";
+    cin >> numInterfaces;
+  }
 
   // Declare a vector to hold the names of interfaces
   vector<string> interfaceNames(numInterfaces);
 
   // Get the names of the interfaces to monitor from the user
   for (int i = 0; i < numInterfaces; ++i) {
-    cout << "Number " << i + 1 << ": ";
+    if (!isQuiet)
+      cout << "Number " << i + 1 << ": ";
     cin >> interfaceNames[i];
   }
-
-  // Set up the signal handler for graceful termination
-  // Handle SIGINT (Ctrl+C)
-  // No additional signals blocked during handler
-  struct sigaction sigAction;
-  sigAction.sa_handler = signalHandler;
-  sigemptyset(&sigAction.sa_mask);
-  sigAction.sa_flags = 0;
-
-  // Set the signal handler for SIGINT (Ctrl+C)
-  if (sigaction(SIGINT, &sigAction, nullptr) < 0) {
-    cerr << "[networkMonitor.cpp] Error setting up signal handler: "
+  if (numInterfaces > 0) {
+    // A reload of a file without interfaces keeps monitoring these
+    commandLineConfig.interfaces = interfaceNames;
+    activeConfig.interfaces = interfaceNames;
+  }
+  interfaceNames = activeConfig.interfaces;
+
+  // Take SIGINT (Ctrl+C), SIGCHLD and SIGHUP through a signalfd in the
+  // event loop instead of a handler, so a monitor that dies is restarted and
+  // the configuration reloaded from the loop
+  sigset_t handledSignals;
+  sigemptyset(&handledSignals);
+  sigaddset(&handledSignals, SIGINT);
+  sigaddset(&handledSignals, SIGCHLD);
+  sigaddset(&handledSignals, SIGHUP);
+  int signalFd = -1;
+  if (sigprocmask(SIG_BLOCK, &handledSignals, nullptr) < 0 ||
+      (signalFd = signalfd(-1, &handledSignals,
+                           SFD_NONBLOCK | SFD_CLOEXEC)) < 0) {
+    cerr << "[networkMonitor.cpp] Error setting up signal handling: "
          << strerror(errno) << endl;
-    // Exit if signal handler setup fails
+    // Exit if signal handling setup fails
     exit(EXIT_FAILURE);
   }
 
   // Set up the master socket to accept incoming connections
   int masterSocket = initSocketConnection();
 
-  // Initially, the master socket is the
-  // highest-numbered socket
-  int maxSocket = masterSocket;
-  fd_set masterSet, readSet;
-
-  // Initialize the read set for select()
-  FD_ZERO(&readSet);
+  // Accept connections without blocking, the loop drains them on each event
+  int epollFd = epoll_create1(EPOLL_CLOEXEC);
+  restartTimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (epollFd < 0 || fcntl(masterSocket, F_SETFL, O_NONBLOCK) < 0 ||
+      addToEpoll(epollFd, masterSocket) < 0 ||
+      addToEpoll(epollFd, signalFd) < 0 || restartTimerFd < 0 ||
+      addToEpoll(epollFd, restartTimerFd) < 0) {
+    cerr << "[networkMonitor.cpp] Error setting up epoll: " << strerror(errno)
+         << endl;
+    cleanupResources(masterSocket, epollFd, monitorConnections, childPIDs);
+    return EXIT_FAILURE;
+  }
 
-  // Initialize the master set for select()
-  FD_ZERO(&masterSet);
+  // Start listening for incoming connections on the master socket
+  if (listen(masterSocket, activeConfig.maxConnections) == -1) {
+    cerr << "[networkMonitor.cpp] Error starting listener: " << strerror(errno)
+         << endl;
+    // Cleanup and return failure if listen fails
+    cleanupResources(masterSocket, epollFd, monitorConnections, childPIDs);
+    return EXIT_FAILURE;
+  }
 
-  // Add the master socket to the master set
-  FD_SET(masterSocket, &masterSet);
+  // Publish a snapshot of the store once per interval for the query server
+  publishTimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+  if (publishTimerFd < 0 || setPublishInterval(activeConfig.intervalMs) < 0 ||
+      addToEpoll(epollFd, publishTimerFd) < 0) {
+    cerr << "[networkMonitor.cpp] Error setting up the publish timer: "
+         << strerror(errno) << endl;
+    if (publishTimerFd >= 0)
+      close(publishTimerFd);
+    cleanupResources(masterSocket, epollFd, monitorConnections, childPIDs);
+    return EXIT_FAILURE;
+  }
 
-  // Array to hold monitor sockets
-  int monitorSockets[maxConnections];
+  // Forward snapshots from the same loop, connecting in the background
+  string upstreamError;
+  if (upstreamTarget != nullptr &&
+      startUpstreamForwarder(upstreamForwarder, epollFd, upstreamTarget,
+                             upstreamReplayBytes, upstreamError) < 0) {
+    cerr << "[networkMonitor.cpp] Unable to forward to " << upstreamTarget
+         << ": " << upstreamError << endl;
+    close(publishTimerFd);
+    cleanupResources(masterSocket, epollFd, monitorConnections, childPIDs);
+    return EXIT_FAILURE;
+  }
 
-  // Keeps track of the number of active monitor connections
-  int activeMonitors = 0;
+  // Answer queries and scrapes from the snapshots on a thread of their own;
+  // monitoring goes on without them if the sockets cannot be set up
+  if (startQueryServer(queryServer, activeConfig.querySocketPath.c_str(),
+                       metricsPort, snapshotPublisher) < 0) {
+    cerr << "[networkMonitor.cpp] Query socket "
+         << activeConfig.querySocketPath << " unavailable: " << strerror(errno)
+         << endl;
+  } else if (queryServer.metricsError != 0) {
+    cerr << "[networkMonitor.cpp] Metrics port " << metricsPort
+         << " unavailable, serving queries only: "
+         << strerror(queryServer.metricsError) << endl;
+  }
 
-  // Create child processes for each interface to monitor
+  // Create child processes for each interface to monitor once the master
+  // socket is listening, so they never race the listen() call
   monitorNetworkInterfaces(interfaceNames, childPIDs);
 
-  // Start listening for incoming connections on the master socket
-  if (listen(masterSocket, maxConnections) == -1) {
-    cerr << "[networkMonitor.cpp] Error starting listener: " << strerror(errno)
-         << endl;
-    // Cleanup and return failure if listen fails
-    cleanupResources(masterSocket, activeMonitors, monitorSockets, masterSet,
-                     childPIDs);
-    return EXIT_FAILURE;
+  // Subscribe to link changes before the first dump, so no interface
+  // appearing in between is missed
+  int linkEventFd = -1;
+  if (isDiscovering) {
+    linkEventFd = openLinkEvents();
+    if (linkEventFd < 0 || addToEpoll(epollFd, linkEventFd) < 0 ||
+        discoverInterfaces(childPIDs) < 0) {
+      cerr << "[networkMonitor.cpp] Error discovering interfaces: "
+           << strerror(errno) << endl;
+      isRunning = false;
+    }
   }
 
-  // Main event loop for monitoring sockets
+  // Main event loop, only the sockets with activity are reported
+  struct epoll_event events[maxEpollEvents];
   while (isRunning) {
-    // Copy the master set to readSet for select()
-    readSet = masterSet;
-
-    // Use select() to monitor the sockets for activity
-    int result = select(maxSocket + 1, &readSet, nullptr, nullptr, nullptr);
+    int eventCount = epoll_wait(epollFd, events, maxEpollEvents, -1);
 
-    if (result < 0) {
-      // If interrupted by signal, restart select()
+    if (eventCount < 0) {
+      // If interrupted by signal, restart epoll_wait()
       if (errno == EINTR)
         continue;
-      cerr << "[networkMonitor.cpp] Error in select: " << strerror(errno)
+      cerr << "[networkMonitor.cpp] Error in epoll_wait: " << strerror(errno)
            << endl;
-      // Exit if select() fails
+      // Exit if epoll_wait() fails
       break;
     }
 
-    if (FD_ISSET(masterSocket, &readSet)) {
-      // If there's activity on the master socket, accept a new connection
-      acceptMonitorConnections(masterSocket, masterSet, maxSocket,
-                               monitorSockets, activeMonitors);
-    } else {
-      // If there's activity on any child socket, read data from interface
-      // monitor
-      processInterfaceMonitorData(activeMonitors, monitorSockets, readSet);
+    for (int i = 0; i < eventCount; ++i) {
+      int socketFd = events[i].data.fd;
+
+      if (socketFd == masterSocket) {
+        // If there's activity on the master socket, accept new connections
+        acceptMonitorConnections(masterSocket, epollFd, monitorConnections);
+        continue;
+      }
+
+      // Time to publish the samples received since the last snapshot
+      if (socketFd == publishTimerFd) {
+        uint64_t expirations;
+        evictStoppedInterfaces();
+        if (read(publishTimerFd, &expirations, sizeof(expirations)) > 0 &&
+            publishSnapshot(snapshotPublisher, timeSeriesStore) &&
+            upstreamTarget != nullptr)
+          reportUpstreamEvent(forwardSnapshot(
+              upstreamForwarder, *loadSnapshot(snapshotPublisher)));
+        if (sampleJournal.fd >= 0 && flushSampleJournal(sampleJournal) < 0)
+          cerr << "[networkMonitor.cpp] Journal write failed, no longer "
+                  "journaling: "
+               << strerror(errno) << endl;
+        killStalledMonitors(monitorConnections);
+        continue;
+      }
+
+      // Children exited, or Ctrl+C
+      if (socketFd == signalFd) {
+        if (handleSignals(signalFd, childPIDs) < 0)
+          isRunning = false;
+        continue;
+      }
+
+      // Monitors that died are due to be started again
+      if (socketFd == restartTimerFd) {
+        uint64_t expirations;
+        if (read(restartTimerFd, &expirations, sizeof(expirations)) > 0)
+          restartDueMonitors(childPIDs);
+        continue;
+      }
+
+      // Interfaces appeared or disappeared
+      if (socketFd == linkEventFd) {
+        handleDiscoveryEvents(linkEventFd, childPIDs);
+        continue;
+      }
+
+      // The collector connection progressed, acknowledged snapshots or
+      // is due to be tried again
+      if (upstreamTarget != nullptr &&
+          isUpstreamDescriptor(upstreamForwarder, socketFd)) {
+        reportUpstreamEvent(handleUpstreamEvent(upstreamForwarder, socketFd,
+                                                events[i].events));
+        continue;
+      }
+
+      // A sample ring was published to, drain it in one batch
+      auto ringOwner = ringOwners.find(socketFd);
+      if (ringOwner != ringOwners.end()) {
+        drainMonitorRing(monitorConnections[ringOwner->second]);
+        continue;
+      }
+
+      // Otherwise read data from the interface monitor, closing its
+      // connection on hangup or error
+      auto connection = monitorConnections.find(socketFd);
+      if (connection == monitorConnections.end())
+        continue;
+      if (processInterfaceMonitorData(connection->second) < 0 ||
+          watchMonitorRing(epollFd, connection->second) < 0)
+        closeMonitorConnection(epollFd, monitorConnections, socketFd);
     }
   }
 
+  // Summarize the stored history before it is discarded
+  if (!isQuiet)
+    printHistorySummary(timeSeriesStore);
+  printPipelineSummary();
+  printCollectorSummary();
+  closeSampleJournal(sampleJournal);
+  if (upstreamTarget != nullptr) {
+    printUpstreamSummary();
+    stopUpstreamForwarder(upstreamForwarder);
+  }
+
+  // Stop answering queries before the store goes away
+  stopQueryServer(queryServer);
+  close(publishTimerFd);
+  close(restartTimerFd);
+  close(signalFd);
+  if (linkEventFd >= 0)
+    close(linkEventFd);
+
   // Cleanup resources when the program exits
-  cleanupResources(masterSocket, activeMonitors, monitorSockets, masterSet,
-                   childPIDs);
+  cleanupResources(masterSocket, epollFd, monitorConnections, childPIDs);
 
   return EXIT_SUCCESS;
 }
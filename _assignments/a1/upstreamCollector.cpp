@@ -0,0 +1,415 @@
+#include "InterfaceStats.h"
+#include "MonitorProtocol.h"
+#include "UpstreamProtocol.h"
+#include <arpa/inet.h>    // For inet_ntop
+#include <cerrno>         // For errno
+#include <csignal>        // For sigset_t and sigprocmask
+#include <cstdio>         // For snprintf
+#include <cstdlib>        // For atoi
+#include <cstring>        // For strerror and memset
+#include <iostream>       // For cout and cerr
+#include <map>            // For map
+#include <netinet/in.h>   // For sockaddr_in6
+#include <string>         // For string
+#include <sys/epoll.h>    // For epoll_create1, epoll_ctl and epoll_wait
+#include <sys/signalfd.h> // For signalfd
+#include <sys/socket.h>   // For socket, bind, listen, accept4 and send
+#include <unistd.h>       // For close, read and getopt
+#include <unordered_map>  // For unordered_map
+#include <vector>         // For vector
+
+using namespace std;
+
+// Stand-in for a central collector, to test networkMonitor -U without one.
+// It accepts any number of forwarders, prints a line per snapshot, and
+// acknowledges what it received once per read, so forwarders can be stopped,
+// restarted or cut off and their replays checked
+
+// ========== CONSTANTS ==========
+
+// Descriptors reported by one epoll_wait()
+const int maxEpollEvents = 64;
+
+// Bytes read from a forwarder at once
+const size_t readChunkSize = 65536;
+
+// ========== TYPES ==========
+
+// One connected forwarder
+struct ForwarderConnection {
+  int socketFd;         // Non-blocking connection
+  string peer;          // Address of the forwarder, for messages
+  string host;          // Host name from the hello, empty before it
+  vector<char> input;   // Received bytes not yet forming a frame
+};
+
+// What has been received from one host, across its connections
+struct HostState {
+  uint64_t sessionId;    // Session of the latest hello
+  uint64_t lastSequence; // Highest snapshot sequence of the session
+  uint64_t snapshots;    // Snapshots accepted, every session
+  uint64_t duplicates;   // Snapshots received again, e.g. replays
+  uint64_t missed;       // Sequences skipped, dropped by the forwarder
+  uint64_t sessions;     // Sessions seen, i.e. networkMonitor runs
+  bool hasSequence;      // Whether a snapshot of the session arrived
+};
+
+// ========== GLOBAL VARIABLES ==========
+
+// Only the summary is printed with -Q
+bool isQuiet = false;
+
+// Hosts by name, in the order summaries are printed
+map<string, HostState> hosts;
+
+// ========== FUNCTION DEFINITIONS ==========
+
+int openListener(uint16_t port);
+int watchDescriptor(int epollFd, int fd);
+void acceptForwarders(int listenFd, int epollFd,
+                      unordered_map<int, ForwarderConnection> &connections);
+int readForwarder(ForwarderConnection &connection);
+int handleHello(ForwarderConnection &connection, const UpstreamHeader &header,
+                const char *payload);
+int handleSnapshot(ForwarderConnection &connection,
+                   const UpstreamHeader &header, const char *payload);
+int sendAck(ForwarderConnection &connection);
+string describePeer(const struct sockaddr_storage &address);
+void printSummary();
+
+// ========== CORE FUNCTIONS ==========
+
+// Listen for forwarders on every address of port. Returns the socket, or -1
+// with errno set
+int openListener(uint16_t port) {
+  int listenFd =
+      socket(AF_INET6, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (listenFd < 0)
+    return -1;
+
+  // One IPv6 socket takes IPv4 forwarders too, as mapped addresses
+  int reuse = 1, v6Only = 0;
+  struct sockaddr_in6 address;
+  memset(&address, 0, sizeof(address));
+  address.sin6_family = AF_INET6;
+  address.sin6_port = htons(port);
+  address.sin6_addr = in6addr_any;
+  if (setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) <
+          0 ||
+      setsockopt(listenFd, IPPROTO_IPV6, IPV6_V6ONLY, &v6Only,
+                 sizeof(v6Only)) < 0 ||
+      bind(listenFd, (struct sockaddr *)&address, sizeof(address)) < 0 ||
+      listen(listenFd, SOMAXCONN) < 0) {
+    int savedErrno = errno;
+    close(listenFd);
+    errno = savedErrno;
+    return -1;
+  }
+  return listenFd;
+}
+
+// Watch a listening socket or the signalfd
+int watchDescriptor(int epollFd, int fd) {
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN;
+  event.data.fd = fd;
+  return epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event);
+}
+
+// Accept every pending forwarder and watch it for frames
+void acceptForwarders(int listenFd, int epollFd,
+                      unordered_map<int, ForwarderConnection> &connections) {
+  while (true) {
+    struct sockaddr_storage address;
+    socklen_t length = sizeof(address);
+    int socketFd = accept4(listenFd, (struct sockaddr *)&address, &length,
+                           SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (socketFd < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        cerr << "[upstreamCollector.cpp] Error accepting: " << strerror(errno)
+             << endl;
+      if (errno == EINTR)
+        continue;
+      return;
+    }
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN | EPOLLRDHUP;
+    event.data.fd = socketFd;
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, socketFd, &event) < 0) {
+      close(socketFd);
+      continue;
+    }
+    ForwarderConnection &connection = connections[socketFd];
+    connection.socketFd = socketFd;
+    connection.peer = describePeer(address);
+    if (!isQuiet)
+      cout << "[upstreamCollector.cpp] Forwarder connected from "
+           << connection.peer << endl;
+  }
+}
+
+// Read what a forwarder sent and handle every complete frame, then
+// acknowledge the batch at once. Returns -1 when the connection should close
+int readForwarder(ForwarderConnection &connection) {
+  char chunk[readChunkSize];
+  bool isClosed = false;
+  while (true) {
+    ssize_t received = read(connection.socketFd, chunk, sizeof(chunk));
+    if (received < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        break;
+      return -1;
+    }
+    if (received == 0) {
+      isClosed = true;
+      break;
+    }
+    connection.input.insert(connection.input.end(), chunk, chunk + received);
+  }
+
+  size_t offset = 0;
+  UpstreamHeader header;
+  const char *payload;
+  int result;
+  int snapshots = 0;
+  while ((result = extractUpstreamFrame(connection.input, offset, header,
+                                        payload)) > 0) {
+    if (header.type == UPSTREAM_HELLO) {
+      result = handleHello(connection, header, payload);
+    } else if (header.type == UPSTREAM_SNAPSHOT && !connection.host.empty()) {
+      result = handleSnapshot(connection, header, payload);
+      ++snapshots;
+    } else {
+      result = -1;
+    }
+    if (result < 0)
+      break;
+  }
+  if (result < 0) {
+    cerr << "[upstreamCollector.cpp] Malformed stream from "
+         << connection.peer << ", closing it" << endl;
+    return -1;
+  }
+  connection.input.erase(connection.input.begin(),
+                         connection.input.begin() + offset);
+
+  // One acknowledgement covers every snapshot of the read
+  if (snapshots > 0)
+    sendAck(connection);
+  return isClosed ? -1 : 0;
+}
+
+// Identify the host of a connection, starting a new session if it restarted,
+// and tell it how far the collector got
+int handleHello(ForwarderConnection &connection, const UpstreamHeader &header,
+                const char *payload) {
+  const char *data = payload;
+  const char *end = payload + header.length;
+  uint64_t sessionId;
+  if (readUint64(data, end, sessionId) < 0 || data == end)
+    return -1;
+  connection.host.assign(data, end);
+
+  auto found = hosts.find(connection.host);
+  if (found == hosts.end()) {
+    HostState state;
+    memset(&state, 0, sizeof(state));
+    found = hosts.emplace(connection.host, state).first;
+  }
+  HostState &state = found->second;
+  if (state.sessions == 0 || state.sessionId != sessionId) {
+    state.sessionId = sessionId;
+    state.lastSequence = 0;
+    state.hasSequence = false;
+    ++state.sessions;
+  }
+  if (!isQuiet)
+    cout << "[upstreamCollector.cpp] " << connection.host << " (session "
+         << sessionId << ") resumes after snapshot " << state.lastSequence
+         << endl;
+  return sendAck(connection);
+}
+
+// Account for one snapshot and print it, unless it was received before
+int handleSnapshot(ForwarderConnection &connection,
+                   const UpstreamHeader &header, const char *payload) {
+  const char *data = payload;
+  const char *end = payload + header.length;
+  uint64_t tickNs;
+  uint32_t count;
+  if (readUint64(data, end, tickNs) < 0 || readUint32(data, end, count) < 0)
+    return -1;
+
+  // Totals over the interfaces with valid rates
+  double rxBytes = 0, txBytes = 0;
+  UpstreamInterface entry;
+  for (uint32_t i = 0; i < count; ++i) {
+    if (readUpstreamInterface(data, end, entry) < 0)
+      return -1;
+    if (entry.flags & STATS_RATES_VALID) {
+      rxBytes += entry.rates[STAT_RX_BYTES];
+      txBytes += entry.rates[STAT_TX_BYTES];
+    }
+  }
+  if (data != end)
+    return -1;
+
+  HostState &state = hosts[connection.host];
+  if (header.sequence <= state.lastSequence) {
+    ++state.duplicates;
+    return 0;
+  }
+  if (!state.hasSequence && header.sequence > 1) {
+    // Joined a session another collector saw the start of
+    if (!isQuiet)
+      cout << "[upstreamCollector.cpp] " << connection.host
+           << " joined at snapshot " << header.sequence << endl;
+  } else if (header.sequence > state.lastSequence + 1) {
+    state.missed += header.sequence - state.lastSequence - 1;
+    cerr << "[upstreamCollector.cpp] " << connection.host << " skipped "
+         << header.sequence - state.lastSequence - 1 << " snapshots" << endl;
+  }
+  state.lastSequence = header.sequence;
+  state.hasSequence = true;
+  ++state.snapshots;
+
+  if (!isQuiet) {
+    char line[256];
+    snprintf(line, sizeof(line),
+             "%s #%llu at %llu.%03llu: %u interfaces, rx %.1f B/s, tx %.1f B/s",
+             connection.host.c_str(), (unsigned long long)header.sequence,
+             (unsigned long long)(tickNs / 1000000000ULL),
+             (unsigned long long)(tickNs / 1000000ULL % 1000), count, rxBytes,
+             txBytes);
+    cout << line << endl;
+  }
+  return 0;
+}
+
+// Acknowledge the highest snapshot of the host's session. A full socket just
+// skips it, the next acknowledgement covers the same snapshots
+int sendAck(ForwarderConnection &connection) {
+  vector<char> frame;
+  appendUpstreamHeader(frame, UPSTREAM_ACK, hosts[connection.host].lastSequence,
+                       0);
+  ssize_t sent = send(connection.socketFd, frame.data(), frame.size(),
+                      MSG_NOSIGNAL | MSG_DONTWAIT);
+  if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+    return -1;
+  return 0;
+}
+
+// ========== HELPER FUNCTIONS ==========
+
+// Printable address and port of a forwarder
+string describePeer(const struct sockaddr_storage &address) {
+  char text[INET6_ADDRSTRLEN] = "?";
+  const struct sockaddr_in6 *ipv6 = (const struct sockaddr_in6 *)&address;
+  inet_ntop(AF_INET6, &ipv6->sin6_addr, text, sizeof(text));
+  return string(text) + " port " + to_string(ntohs(ipv6->sin6_port));
+}
+
+// Print what was received from every host
+void printSummary() {
+  for (const auto &host : hosts)
+    cout << "[upstreamCollector.cpp] " << host.first << ": "
+         << host.second.snapshots << " snapshots in " << host.second.sessions
+         << " sessions, " << host.second.duplicates << " duplicates, "
+         << host.second.missed << " missed" << endl;
+}
+
+// ==================== MAIN PROGRAM ====================
+int main(int argc, char *argv[]) {
+  // Parse command line options
+  int option;
+  int port = defaultUpstreamPort;
+  while ((option = getopt(argc, argv, "p:Q")) != -1) {
+    switch (option) {
+    case 'p':
+      port = atoi(optarg);
+      break;
+    case 'Q':
+      isQuiet = true;
+      break;
+    default:
+      cerr << "Usage: " << argv[0] << " [-p port] [-Q]" << endl;
+      return EXIT_FAILURE;
+    }
+  }
+  if (port <= 0 || port > 65535) {
+    cerr << "[upstreamCollector.cpp] -p needs a port from 1 to 65535" << endl;
+    return EXIT_FAILURE;
+  }
+
+  // Ctrl+C ends the loop through a signalfd so the summary gets printed
+  sigset_t handledSignals;
+  sigemptyset(&handledSignals);
+  sigaddset(&handledSignals, SIGINT);
+  sigaddset(&handledSignals, SIGTERM);
+  int signalFd = -1;
+  int listenFd = -1;
+  int epollFd = -1;
+  if (sigprocmask(SIG_BLOCK, &handledSignals, nullptr) < 0 ||
+      (signalFd = signalfd(-1, &handledSignals, SFD_CLOEXEC)) < 0 ||
+      (listenFd = openListener(port)) < 0 ||
+      (epollFd = epoll_create1(EPOLL_CLOEXEC)) < 0 ||
+      watchDescriptor(epollFd, listenFd) < 0 ||
+      watchDescriptor(epollFd, signalFd) < 0) {
+    cerr << "[upstreamCollector.cpp] Unable to listen on port " << port
+         << ": " << strerror(errno) << endl;
+    return EXIT_FAILURE;
+  }
+  if (!isQuiet)
+    cout << "[upstreamCollector.cpp] Listening on port " << port << endl;
+
+  // Main event loop
+  unordered_map<int, ForwarderConnection> connections;
+  struct epoll_event events[maxEpollEvents];
+  bool isRunning = true;
+  while (isRunning) {
+    int eventCount = epoll_wait(epollFd, events, maxEpollEvents, -1);
+    if (eventCount < 0) {
+      if (errno == EINTR)
+        continue;
+      cerr << "[upstreamCollector.cpp] Error in epoll_wait: "
+           << strerror(errno) << endl;
+      break;
+    }
+
+    for (int i = 0; i < eventCount; ++i) {
+      int fd = events[i].data.fd;
+      if (fd == listenFd) {
+        acceptForwarders(listenFd, epollFd, connections);
+        continue;
+      }
+      if (fd == signalFd) {
+        isRunning = false;
+        continue;
+      }
+
+      auto connection = connections.find(fd);
+      if (connection == connections.end())
+        continue;
+      if (readForwarder(connection->second) < 0) {
+        if (!isQuiet)
+          cout << "[upstreamCollector.cpp] Forwarder "
+               << connection->second.peer << " disconnected" << endl;
+        close(fd);
+        connections.erase(connection);
+      }
+    }
+  }
+
+  printSummary();
+  for (const auto &connection : connections)
+    close(connection.first);
+  close(epollFd);
+  close(listenFd);
+  close(signalFd);
+  return EXIT_SUCCESS;
+}